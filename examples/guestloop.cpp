@@ -0,0 +1,106 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <ftl.h>
+
+using namespace ftl;
+
+#define ITERATIONS 20000000ull
+
+struct guest_cpu {
+    u64 pc;
+    u64 sp;
+    u64 flags;
+    u64 acc;
+    u64 count;
+};
+
+// models a translated guest loop with one branch per iteration; every basic
+// block boundary flushes the register allocator
+static func gen_loop(guest_cpu& cpu, bool pin) {
+    func code(pin ? "pinned" : "unpinned", 4 * KiB);
+
+    value pc = code.gen_global_i64("pc", &cpu.pc);
+    value sp = code.gen_global_i64("sp", &cpu.sp);
+    value flags = code.gen_global_i64("flags", &cpu.flags);
+    value acc = code.gen_global_i64("acc", &cpu.acc);
+    value count = code.gen_global_i64("count", &cpu.count);
+
+    if (pin) {
+        code.gen_pin(pc);
+        code.gen_pin(sp);
+        code.gen_pin(flags);
+        code.gen_pin(acc);
+    }
+
+    label loop = code.gen_label("loop");
+    label even = code.gen_label("even");
+    label next = code.gen_label("next");
+
+    loop.place();
+    code.gen_add(pc, 4);
+    code.gen_add(acc, count);
+    code.gen_tst(acc, 1);
+    code.gen_jz(even);
+
+    code.gen_add(sp, 8);
+    code.gen_or(flags, 1);
+    code.gen_jmp(next);
+
+    even.place();
+    code.gen_sub(sp, 8);
+    code.gen_and(flags, ~1);
+
+    next.place();
+    code.gen_dec(count);
+    code.gen_jnz(loop);
+
+    code.gen_ret();
+    code.finish();
+
+    return code;
+}
+
+static double run(bool pin) {
+    guest_cpu cpu = { 0, 0x8000, 0, 0, ITERATIONS };
+    func loop = gen_loop(cpu, pin);
+
+    auto t0 = std::chrono::steady_clock::now();
+    loop();
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (cpu.count != 0 || cpu.pc != ITERATIONS * 4) {
+        std::cerr << "wrong guest state after " << loop.name() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    std::cout << loop.name() << ": " << loop.size() << " bytes, "
+              << ms << "ms" << std::endl;
+    return ms;
+}
+
+int main() {
+    double unpinned = run(false);
+    double pinned = run(true);
+
+    std::cout << "speedup: " << unpinned / pinned << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <ftl.h>
+
+using namespace ftl;
+
+#define ITERATIONS 200000000ull
+
+struct counters {
+    u64 count;
+    u64 acc;
+    u64 odd;
+};
+
+// a tight loop whose closing sub+jnz pair starts three bytes before a 32
+// byte boundary, the worst case for cores affected by the jcc erratum; with
+// branch alignment the pair gets moved behind the boundary
+static func gen_loop(counters& c, bool align) {
+    func code(align ? "aligned" : "unaligned", 4 * KiB);
+    code.get_emitter().set_align_branches(align);
+
+    value count = code.gen_global_i64("count", &c.count);
+    value acc = code.gen_global_i64("acc", &c.acc);
+    value odd = code.gen_global_i64("odd", &c.odd);
+
+    code.gen_pin(count);
+    code.gen_pin(acc);
+    code.gen_pin(odd);
+
+    label loop = code.gen_label("loop");
+    label even = code.gen_label("even");
+
+    loop.place(true, 64);
+    code.gen_add(acc, count);
+    code.gen_tst(acc, 1);
+    code.gen_jz(even);
+    code.gen_add(odd, 1);
+
+    even.place();
+    u64 offset = (u64)code.get_cbuffer().get_code_ptr() % 32;
+    code.get_cbuffer().pad((32 + 29 - offset) % 32);
+    code.gen_sub(count, 1);
+    code.gen_jnz(loop);
+
+    code.gen_ret();
+    code.finish();
+
+    return code;
+}
+
+static double run(bool align) {
+    counters c = { ITERATIONS, 0, 0 };
+    func loop = gen_loop(c, align);
+
+    auto t0 = std::chrono::steady_clock::now();
+    loop();
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (c.count != 0 || c.acc != ITERATIONS * (ITERATIONS + 1) / 2) {
+        std::cerr << "wrong counters after " << loop.name() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    std::cout << loop.name() << ": " << loop.size() << " bytes, "
+              << ms << "ms" << std::endl;
+    return ms;
+}
+
+int main() {
+    double unaligned = run(false);
+    double aligned = run(true);
+
+    std::cout << "speedup: " << unaligned / aligned << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,194 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <ftl.h>
+
+using namespace ftl;
+
+#define ITERATIONS 10000000ull
+#define PAGE_BITS 12
+#define PAGES 16
+#define GUEST_BASE 0x80000000ull
+#define GUEST_MASK (PAGES * (1ull << PAGE_BITS) - 1)
+
+struct tlb_entry {
+    u64 tag_read;
+    u64 tag_write;
+    u64 addend;
+    u64 unused;
+};
+
+struct guest_cpu {
+    u64 addr;
+    u64 acc;
+    u64 count;
+    u64 misses;
+
+    tlb_entry tlb[256];
+    u8 mem[PAGES << PAGE_BITS];
+};
+
+static u8* translate(guest_cpu* cpu, u64 addr) {
+    tlb_entry& e = cpu->tlb[(addr >> PAGE_BITS) % FTL_ARRAY_SIZE(cpu->tlb)];
+    if (e.tag_read == (addr & ~((1ull << PAGE_BITS) - 1)))
+        return (u8*)(addr + e.addend);
+    cpu->misses++;
+    return cpu->mem + addr - GUEST_BASE;
+}
+
+// what the simulator does today: one helper call per guest access
+static u64 helper_load(void* data, u64 addr) {
+    u64 val;
+    memcpy(&val, translate((guest_cpu*)data, addr), sizeof(val));
+    return val;
+}
+
+static u64 helper_store(void* data, u64 addr, u64 val) {
+    memcpy(translate((guest_cpu*)data, addr), &val, sizeof(val));
+    return 0;
+}
+
+// slow path handlers for the inline lookup, only reached on a tlb miss
+static u64 miss_load(void* data, u64 addr, u64 size) {
+    guest_cpu* cpu = (guest_cpu*)data;
+    u64 val = 0;
+    cpu->misses++;
+    memcpy(&val, cpu->mem + addr - GUEST_BASE, size);
+    return val;
+}
+
+static void miss_store(void* data, u64 addr, u64 val, u64 size) {
+    guest_cpu* cpu = (guest_cpu*)data;
+    cpu->misses++;
+    memcpy(cpu->mem + addr - GUEST_BASE, &val, size);
+}
+
+// models a translated guest block that reads one word, accumulates it and
+// writes the running sum back to the following word
+static func gen_loop(guest_cpu& cpu, bool inline_tlb) {
+    func code(inline_tlb ? "inline" : "helper", 4 * KiB);
+    code.set_data_ptr(&cpu);
+
+    tlb_layout tlb;
+    tlb.base = (u64)cpu.tlb;
+    tlb.entries = FTL_ARRAY_SIZE(cpu.tlb);
+    tlb.entry_size = sizeof(tlb_entry);
+    tlb.page_bits = PAGE_BITS;
+    tlb.tag_read = offsetof(tlb_entry, tag_read);
+    tlb.tag_write = offsetof(tlb_entry, tag_write);
+    tlb.addend = offsetof(tlb_entry, addend);
+
+    value addr = code.gen_global_i64("addr", &cpu.addr);
+    value acc = code.gen_global_i64("acc", &cpu.acc);
+    value count = code.gen_global_i64("count", &cpu.count);
+
+    label loop = code.gen_label("loop");
+    loop.place();
+
+    value val = code.gen_scratch_i64("val");
+    value next = code.gen_scratch_i64("next");
+    if (inline_tlb) {
+        code.gen_tlb_load(val, addr, tlb, miss_load);
+    } else {
+        value ret = code.gen_call(helper_load, addr);
+        code.gen_mov(val, ret);
+    }
+
+    code.gen_add(acc, val);
+    code.gen_mov(next, addr);
+    code.gen_add(next, 8);
+
+    if (inline_tlb)
+        code.gen_tlb_store(acc, next, tlb, miss_store);
+    else
+        code.gen_call(helper_store, next, acc);
+
+    code.gen_sub(addr, GUEST_BASE - 16);
+    code.gen_and(addr, GUEST_MASK);
+    code.gen_add(addr, GUEST_BASE);
+
+    code.gen_dec(count);
+    code.gen_jnz(loop);
+
+    code.gen_ret();
+    code.finish();
+
+    return code;
+}
+
+static guest_cpu* setup() {
+    guest_cpu* cpu = new guest_cpu;
+    memset(cpu, 0, sizeof(*cpu));
+
+    for (tlb_entry& e : cpu->tlb)
+        e.tag_read = e.tag_write = ~0ull;
+
+    // leave the last page unmapped so that both paths see some misses
+    for (u64 page = 0; page < PAGES - 1; page++) {
+        u64 addr = GUEST_BASE + (page << PAGE_BITS);
+        tlb_entry& e = cpu->tlb[(addr >> PAGE_BITS) % FTL_ARRAY_SIZE(cpu->tlb)];
+        e.tag_read = e.tag_write = addr;
+        e.addend = (u64)cpu->mem - GUEST_BASE;
+    }
+
+    for (size_t i = 0; i < sizeof(cpu->mem); i++)
+        cpu->mem[i] = i;
+
+    cpu->addr = GUEST_BASE;
+    cpu->count = ITERATIONS;
+    return cpu;
+}
+
+static double run(bool inline_tlb, u64& acc) {
+    guest_cpu* cpu = setup();
+    func loop = gen_loop(*cpu, inline_tlb);
+
+    auto t0 = std::chrono::steady_clock::now();
+    loop();
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (cpu->count != 0 || cpu->misses == 0) {
+        std::cerr << "wrong guest state after " << loop.name() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    std::cout << loop.name() << ": " << loop.size() << " bytes, "
+              << ms << "ms, " << cpu->misses << " misses" << std::endl;
+
+    acc = cpu->acc;
+    delete cpu;
+    return ms;
+}
+
+int main() {
+    u64 acc_helper, acc_inline;
+    double helper = run(false, acc_helper);
+    double inlined = run(true, acc_inline);
+
+    if (acc_helper != acc_inline) {
+        std::cerr << "guest results differ" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "speedup: " << helper / inlined << "x" << std::endl;
+    return 0;
+}
@@ -23,11 +23,13 @@
 #include "ftl/error.h"
 #include "ftl/bitops.h"
 #include "ftl/utils.h"
+#include "ftl/cpuinfo.h"
 
 #include "ftl/reg.h"
 #include "ftl/call.h"
 #include "ftl/value.h"
 #include "ftl/scalar.h"
+#include "ftl/vec.h"
 #include "ftl/fixup.h"
 #include "ftl/cbuf.h"
 #include "ftl/emitter.h"
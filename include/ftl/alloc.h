@@ -27,6 +27,7 @@
 #include "ftl/reg.h"
 #include "ftl/value.h"
 #include "ftl/scalar.h"
+#include "ftl/vec.h"
 #include "ftl/emitter.h"
 #include "ftl/ralloc.h"
 
@@ -39,9 +40,16 @@ namespace ftl {
         ralloc<reg> m_regs;
         ralloc<xmm> m_xmms;
 
-        u64         m_locals;
+        i32         m_frame_top;
         u64         m_base;
 
+        array<vector<i32>, 6> m_frame_free;
+
+        set<const value*> m_pinned;
+
+        map<const value*, i32>  m_spills;
+        map<const scalar*, i32> m_xspills;
+
     public:
         alloc(emitter& e);
         alloc(alloc&&) = default;
@@ -73,6 +81,9 @@ namespace ftl {
         bool is_blocked(reg r) const { return m_regs.is_blocked(r); }
         bool is_blocked(xmm r) const { return m_xmms.is_blocked(r); }
 
+        bool is_pinned(reg r) const;
+        bool is_pinned(const value* val) const;
+
         reg  select()     const { return m_regs.select(); }
         xmm  select_xmm() const { return m_xmms.select(); }
 
@@ -91,6 +102,21 @@ namespace ftl {
         void flush(reg r);
         void flush(xmm r);
 
+        void discard(reg r);
+        void discard(xmm r);
+
+        bool is_spilled(const value* val) const;
+        bool is_spilled(const scalar* val) const;
+
+        i32  spill_slot(const value* val);
+        i32  spill_slot(const scalar* val);
+
+        void move_spill(const value* from, const value* to);
+        void move_spill(const scalar* from, const scalar* to);
+
+        void release_spill(const value* val);
+        void release_spill(const scalar* val);
+
         void register_value(value* val) { m_regs.register_value(val); }
         void register_value(scalar* val) { m_xmms.register_value(val); }
 
@@ -98,6 +124,13 @@ namespace ftl {
         void unregister_value(scalar* val) { m_xmms.unregister_value(val); }
 
 
+        i32  alloc_slot(int size);
+        void free_slot(i32 offset, int size);
+        size_t get_frame_size() const;
+
+        rm   literal(u64 val);
+        void load_const(int bits, reg r, i64 val);
+
         u64  get_base_addr() const { return m_base; }
         void set_base_addr(u64 addr);
 
@@ -113,9 +146,19 @@ namespace ftl {
         scalar new_scratch_scalar_noinit(const string& n, int w, xmm r = NXMM);
         scalar new_scratch_scalar(const string& n, int w, f64 f, xmm r = NXMM);
 
+        vec new_local_vec(const string& name, int w, xmm r = NXMM);
+        vec new_global_vec(const string& name, int w, u64 addr);
+        vec new_scratch_vec(const string& name, int w, xmm r = NXMM);
+
         void free_value(value& val);
         void free_scalar(scalar& val);
 
+        void kill_value(value& val);
+        void kill_scalar(scalar& val);
+
+        reg  pin_value(value& val, reg r = NREGS);
+        void unpin_value(value& val);
+
         size_t count_active_regs() const;
         size_t count_dirty_regs() const;
 
@@ -125,9 +168,39 @@ namespace ftl {
         void store_volatile_regs();
         void flush_volatile_regs();
 
+        void preserve_volatile_regs();
+        void store_global_regs();
+
+        void discard_local_regs();
+        void discard_scratch();
+
+        void store_pinned_regs();
+        void reload_pinned_regs();
+
         void reset();
     };
 
+    inline bool alloc::is_pinned(reg r) const {
+        const value* val = m_regs.lookup(r);
+        return val != nullptr && is_pinned(val);
+    }
+
+    inline bool alloc::is_pinned(const value* val) const {
+        return stl_contains(m_pinned, val);
+    }
+
+    inline bool alloc::is_spilled(const value* val) const {
+        return m_spills.count(val) > 0;
+    }
+
+    inline bool alloc::is_spilled(const scalar* val) const {
+        return m_xspills.count(val) > 0;
+    }
+
+    inline size_t alloc::get_frame_size() const {
+        return (m_frame_top + 15) & ~15;
+    }
+
     inline void alloc::set_base_addr(u64 addr) {
         FTL_ERROR_ON(m_base, "base address already set");
         m_base = addr;
@@ -76,10 +76,9 @@ namespace ftl {
     template <> struct arg_traits<i64> {
         typedef reg target_register_type;
         static void fetch(alloc& a, unsigned int n, i64 val) {
-            emitter& e = a.get_emitter();
             reg r = argreg(n + 1);
             a.flush(r);
-            e.movi(64, r, val);
+            a.load_const(64, r, val);
         }
     };
 
@@ -116,10 +115,9 @@ namespace ftl {
     template <> struct arg_traits<u64> {
         typedef reg target_register_type;
         static void fetch(alloc& a, unsigned int n, u64 val) {
-            emitter& e = a.get_emitter();
             reg r = argreg(n + 1);
             a.flush(r);
-            e.movi(64, r, (i64)val);
+            a.load_const(64, r, (i64)val);
         }
     };
 
@@ -129,9 +127,7 @@ namespace ftl {
             emitter& e = a.get_emitter();
             xmm r = argxmm(n);
             a.flush(r);
-            a.flush(RAX);
-            e.movi(32, RAX, f32_raw(val));
-            e.movs(32, r, RAX);
+            e.movs(32, r, a.literal(f32_raw(val)));
         }
     };
 
@@ -141,9 +137,7 @@ namespace ftl {
             emitter& e = a.get_emitter();
             xmm r = argxmm(n);
             a.flush(r);
-            a.flush(RAX);
-            e.movi(64, RAX, f64_raw(val));
-            e.movs(64, r, RAX);
+            e.movs(64, r, a.literal(f64_raw(val)));
         }
     };
 
@@ -151,10 +145,9 @@ namespace ftl {
     struct arg_traits<T*> {
         typedef reg target_register_type;
         static void fetch(alloc& a, unsigned int n, T* val) {
-            emitter& e = a.get_emitter();
             reg r = argreg(n + 1);
             a.flush(r);
-            e.movi(64, r, (uintptr_t)val);
+            a.load_const(64, r, (uintptr_t)val);
         }
     };
 
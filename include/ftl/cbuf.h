@@ -32,9 +32,27 @@ namespace ftl {
         virtual const char* what() const noexcept;
     };
 
+    class label;
+
     class cbuf
     {
     private:
+        // a pc relative displacement at code, relative to the end of the
+        // instruction at next
+        struct reloc {
+            u8* code;
+            u8* next;
+            const u8* target;
+            int size;
+        };
+
+        // a jump or macro-fused compare and jump that must not cross or end
+        // on a branch boundary
+        struct branch {
+            u8* start;
+            u8* end;
+        };
+
         size_t m_capacity;
 
         u8* m_code_head;
@@ -42,7 +60,17 @@ namespace ftl {
         u8* m_code_ptr;
         u8* m_code_end;
 
+        map<u64, const u8*> m_literals;
+
+        vector<reloc> m_relocs;
+        vector<label*> m_labels;
+        vector<branch> m_branches;
+
         size_t write(const void* ptr, size_t sz);
+        void move_code(u8* from, size_t n);
+        void grow_branch(u8* code);
+        void insert_padding(u8* at, size_t n);
+        void settle();
 
     public:
         const u8* get_code_entry() const { return m_code_head; }
@@ -58,10 +86,30 @@ namespace ftl {
         size_t capacity() const { return m_capacity; }
 
         bool is_empty() const { return m_code_ptr == m_code_head; }
+        bool is_rip_addressable(u64 addr) const;
+
+        size_t num_literals() const { return m_literals.size(); }
+        const u8* get_literal(u64 val);
         bool is_full() const { return m_code_ptr >= m_code_end; }
 
         u8* mark_exit();
-        u8* align(size_t alignment);
+        u8* align(size_t alignment, bool nops = false);
+
+        // branch relaxation: growing a short branch moves all code behind
+        // it, so labels and pc relative displacements emitted since the
+        // oldest pending short branch are tracked for adjustment
+        void track(label* l);
+        void untrack(label* l);
+        void add_reloc(u8* code, int size, u8* next, const u8* target);
+        void prune_relocs();
+        void relax(u8* code);
+        void relax_all(const label* except = nullptr);
+
+        // records a branch emitted at [start, end) and pads in front of it
+        // if it crosses or ends on a 32 byte boundary, which keeps it in the
+        // decoded icache on cores affected by the jcc erratum; returns how
+        // far the branch has moved
+        size_t add_branch(u8* start, u8* end);
 
         cbuf(size_t capacity);
         virtual ~cbuf();
@@ -70,6 +118,8 @@ namespace ftl {
         cbuf(const cbuf&) = delete;
 
         void skip(size_t count);
+        void pad(size_t count);
+        void nop(size_t len);
 
         void reset(u8* addr);
         void reset();
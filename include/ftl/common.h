@@ -29,6 +29,7 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
 #include <array>
 #include <sstream>
 #include <iostream>
@@ -67,6 +68,7 @@ namespace ftl {
     using std::string;
     using std::vector;
     using std::set;
+    using std::map;
     using std::array;
     using std::stringstream;
 
@@ -0,0 +1,60 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef FTL_CPUINFO_H
+#define FTL_CPUINFO_H
+
+#include "ftl/common.h"
+
+namespace ftl {
+
+    // Instruction set extensions beyond the x86-64 SSE2 baseline that the
+    // emitter knows how to use. The host description is queried via cpuid
+    // once and cached for the lifetime of the process. Code generation uses
+    // the active description instead, which defaults to the host but can be
+    // restricted, e.g. to exercise the fallback paths in tests.
+    struct cpuinfo {
+        bool sse3;
+        bool ssse3;
+        bool sse41;
+        bool sse42;
+        bool avx;  // also requires the OS to preserve ymm state
+        bool avx2;
+        bool bmi1; // also implies tzcnt
+        bool bmi2;
+        bool popcnt;
+        bool lzcnt;
+        bool movbe;
+        bool cx16;
+        bool erms; // fast rep movsb and rep stosb
+        bool aes;
+        bool pclmul;
+        bool sha;
+
+        static const cpuinfo& host();
+        static const cpuinfo& baseline();
+
+        // emitters pick up avx when they are created, all other features
+        // are checked whenever code is generated
+        static const cpuinfo& get();
+        static void set(const cpuinfo& info);
+    };
+
+}
+
+#endif
@@ -29,31 +29,98 @@
 
 namespace ftl {
 
+    struct peephole_stats {
+        size_t reload; // reloads of a slot that was just stored
+        size_t zero;   // mov reg, 0 turned into xor reg, reg
+        size_t cmp0;   // cmp reg, 0 turned into test reg, reg
+        size_t movzx;  // movzx after setcc on a zeroed register
+
+        size_t total() const { return reload + zero + cmp0 + movzx; }
+    };
+
     class emitter
     {
     private:
+        enum insn_kind {
+            INSN_NONE = 0,
+            INSN_STORE,
+            INSN_MOVI0,
+            INSN_ZERO,
+            INSN_CMP,
+            INSN_SETCC,
+        };
+
+        struct insn {
+            insn_kind kind;
+            int bits;
+            int r;
+            int base;
+            i64 offset;
+            u8* start;
+            u8* end;
+        };
+
         cbuf& m_buffer;
 
+        bool  m_peephole;
+        u8*   m_fence;
+        insn  m_history[3];
+        peephole_stats m_stats;
+
+        bool  m_avx;
+        bool  m_avx2;
+        bool  m_ymm_used;
+
+        bool  m_align_branches;
+        u8*   m_fused_start;
+        u8*   m_fused_end;
+
+        void record(insn_kind kind, int bits, int r, size_t len,
+                    const rm& mem = rm(NREGS));
+        void retire();
+        const insn* lookbehind(size_t n) const;
+        void zero_idiom();
+        void fusible(size_t len);
+
         inline void setup_fixup(fixup* fix, int size);
 
         size_t rex(bool is64, bool rexr, bool rexx, bool rexb);
+        size_t vex(int pfx, int op, bool w, bool l, int r, int v, const rm& rm);
         size_t modrm(int mod, int reg, int rm);
         size_t sib(int scale, int index, int base);
 
         size_t prefix(int dbits, int sbits, int r, const rm& rm);
         size_t prefix(int bits, int r, const rm& rm);
-        size_t modrm(int r, const rm& rm);
+        size_t modrm(int r, const rm& rm, int immlen = 0);
 
         size_t immop(int op, int bits, const rm& dest, i32 imm);
         size_t aluop(int op, int bits, const rm& dest, const rm& src);
         size_t shift(int op, int bits, const rm& dest, u8 imm);
         size_t branch(int op, i32 imm, fixup* fix);
+        size_t align_branch(u8* start, fixup* fix, bool fused = false);
         size_t setcc(int op, const rm& dest);
         size_t movcc(int op, int bits, const rm& dest, const rm& src);
+        size_t xmmop(int pfx, int op, bool w, bool l, int dest, int src1,
+                     const rm& src, int immlen = 0);
         size_t mmxop(int op, int bits, const rm& dest, const rm& src);
+        size_t mmxop(int op, int bits, const rm& dest, const rm& src1,
+                     const rm& src2);
         size_t mmxcmp(int op, int bits, const rm& op1, const rm& op2);
+        size_t sseop(int pfx, int op, const rm& dest, const rm& src,
+                     int immlen = 0);
+        size_t sseunop(int pfx, int op, const rm& dest, const rm& src,
+                       int immlen = 0);
+        size_t intop(int op, const rm& dest, const rm& src, int immlen = 0);
+        size_t bmiop(int pfx, int op, int bits, int r, int v, const rm& src,
+                     int immlen = 0);
+        size_t pshift(int op, int ext, const rm& dest, u8 imm);
         size_t bitop(int op, int bits, const rm& dest, u8 imm);
         size_t bitop(int op, int bits, const rm& dest, const rm& src);
+        size_t escop(int pfx, int op, int bits, int r, const rm& src);
+        size_t strop(u8 op, int bits);
+        size_t prefop(int op, int hint, const rm& src);
+        size_t cryptop(int op, const rm& dest, const rm& src, int immlen = 0);
+        size_t shaop(int op, const rm& dest, const rm& src, int immlen = 0);
 
     public:
         emitter(cbuf& buffer);
@@ -63,7 +130,33 @@ namespace ftl {
         emitter() = delete;
         emitter(const emitter&) = delete;
 
+        cbuf& get_buffer() const { return m_buffer; }
+
+        bool is_peephole() const { return m_peephole; }
+        void set_peephole(bool enable = true);
+        void barrier();
+
+        const peephole_stats& get_peephole_stats() const { return m_stats; }
+
+        // with avx enabled all xmm operations use the vex encoding, which
+        // allows non-destructive three operand forms and ymm operands
+        bool is_avx() const { return m_avx; }
+        bool is_avx2() const { return m_avx2; }
+        void set_avx(bool enable = true);
+
+        // whether ymm upper halves may be dirty and need to be cleared with
+        // vzeroupper before transferring control to legacy sse code
+        bool is_ymm_used() const { return m_ymm_used; }
+
+        // with branch alignment enabled, jumps, calls and returns as well as
+        // macro-fused compare and jump pairs get padded with nops so that
+        // they never cross or end on a 32 byte boundary; padding moves code
+        // that has been emitted since the last label was placed
+        bool is_align_branches() const { return m_align_branches; }
+        void set_align_branches(bool enable = true);
+
         size_t ret();
+        size_t nop(size_t len = 1);
 
         size_t lock();
 
@@ -99,6 +192,7 @@ namespace ftl {
 
         size_t lear(int bits, const rm& dest, const rm& src);
         size_t lear(int bits, const rm& dest, const rm& src, i32 val);
+        size_t lear(int bits, reg dest, reg base, reg index, int scale);
 
         size_t btr (int bits, const rm& dest, const rm& src);
         size_t btsr(int bits, const rm& dest, const rm& src);
@@ -135,15 +229,75 @@ namespace ftl {
         size_t shri(int bits, const rm& dest, u8 imm);
         size_t sari(int bits, const rm& dest, u8 imm);
 
+        // bmi1 and bmi2 operations, these leave the flags untouched except
+        // for andn, bzhi, blsr and blsi
+        size_t shlx(int bits, reg dest, const rm& src, reg count);
+        size_t shrx(int bits, reg dest, const rm& src, reg count);
+        size_t sarx(int bits, reg dest, const rm& src, reg count);
+        size_t rorx(int bits, reg dest, const rm& src, u8 imm);
+        size_t andn(int bits, reg dest, reg src1, const rm& src2);
+        size_t bzhi(int bits, reg dest, const rm& src, reg index);
+        size_t pdep(int bits, reg dest, reg src, const rm& mask);
+        size_t pext(int bits, reg dest, reg src, const rm& mask);
+        size_t blsr(int bits, reg dest, const rm& src);
+        size_t blsi(int bits, reg dest, const rm& src);
+        size_t mulx(int bits, reg hi, reg lo, const rm& src);
+
+        // popcnt, lzcnt and movbe need their own cpuid checks, tzcnt comes
+        // with bmi1; lzcnt and tzcnt decode as bsr and bsf on older cpus
+        size_t popcnt(int bits, reg dest, const rm& src);
+        size_t lzcnt(int bits, reg dest, const rm& src);
+        size_t tzcnt(int bits, reg dest, const rm& src);
+        size_t bsf(int bits, reg dest, const rm& src);
+        size_t bsr(int bits, reg dest, const rm& src);
+        size_t bswap(int bits, reg r);
+        size_t movbe(int bits, const rm& dest, const rm& src);
+
+        // crc-32c of a bits wide source accumulated into a 32 bit register,
+        // part of sse4.2
+        size_t crc32(int bits, reg dest, const rm& src);
+
         size_t movzx(int dbits, int sbits, const rm& dest, const rm& src);
         size_t movsx(int dbits, int sbits, const rm& dest, const rm& src);
 
+        // cmpxchg, cmpxchg16b and xadd get a lock prefix with a memory
+        // destination, xchg is always locked; other operations can be made
+        // atomic by emitting lock() right in front of them
         size_t cmpxchg(int bits, const rm& dest, const rm& src);
+        size_t cmpxchg16b(const rm& dest);
+        size_t xadd(int bits, const rm& dest, const rm& src);
+
+        // rep movs copies rcx elements from [rsi] to [rdi], rep stos fills
+        // rcx elements at [rdi] with rax; both step backwards while the
+        // direction flag is set, which must be cleared again afterwards
+        size_t rep_movs(int bits);
+        size_t rep_stos(int bits);
+        size_t cld();
+        size_t std();
 
         size_t lfence();
         size_t sfence();
         size_t mfence();
 
+        // lock or [rsp], 0: a full barrier for ordinary memory that does not
+        // serialize the pipeline like mfence, but also does not order
+        // non-temporal stores
+        size_t lock_fence();
+
+        // non-temporal stores bypass the caches and are weakly ordered, so
+        // they need an sfence before any later store that publishes them;
+        // movntdq requires an aligned destination
+        size_t movnti(int bits, const rm& dest, const rm& src);
+        size_t movntdq(const rm& dest, const rm& src);
+
+        // prefetches are hints and never fault; prefetchw executes as a nop
+        // on cpus that do not support it
+        size_t prefetcht0(const rm& src);
+        size_t prefetcht1(const rm& src);
+        size_t prefetcht2(const rm& src);
+        size_t prefetchnta(const rm& src);
+        size_t prefetchw(const rm& src);
+
         size_t call(u8* fn, fixup* fix = nullptr);
         size_t call(const rm& dest);
 
@@ -215,6 +369,13 @@ namespace ftl {
         size_t divs(int bits, const rm& dest, const rm& src);
         size_t mins(int bits, const rm& dest, const rm& src);
         size_t maxs(int bits, const rm& dest, const rm& src);
+
+        size_t adds(int bits, const rm& dest, const rm& src1, const rm& src2);
+        size_t subs(int bits, const rm& dest, const rm& src1, const rm& src2);
+        size_t muls(int bits, const rm& dest, const rm& src1, const rm& src2);
+        size_t divs(int bits, const rm& dest, const rm& src1, const rm& src2);
+        size_t mins(int bits, const rm& dest, const rm& src1, const rm& src2);
+        size_t maxs(int bits, const rm& dest, const rm& src1, const rm& src2);
         size_t sqrt(int bits, const rm& dest, const rm& src);
         size_t pxor(int bits, const rm& dest, const rm& src);
 
@@ -225,6 +386,67 @@ namespace ftl {
         size_t cvts2i(int dbits, int sbits, const rm& dest, const rm& src);
         size_t cvti2s(int dbits, int sbits, const rm& dest, const rm& src);
         size_t cvtts2i(int dbits, int sbits, const rm& dest, const rm& src);
+
+        size_t movdqu(const rm& dest, const rm& src);
+        size_t movdqa(const rm& dest, const rm& src);
+
+        size_t padd(int bits, const rm& dest, const rm& src);
+        size_t psub(int bits, const rm& dest, const rm& src);
+        size_t pmul(int bits, const rm& dest, const rm& src);
+        size_t pand(const rm& dest, const rm& src);
+        size_t pandn(const rm& dest, const rm& src);
+        size_t por(const rm& dest, const rm& src);
+        size_t pcmpeq(int bits, const rm& dest, const rm& src);
+        size_t pcmpgt(int bits, const rm& dest, const rm& src);
+        size_t pmins(int bits, const rm& dest, const rm& src);
+        size_t pmaxs(int bits, const rm& dest, const rm& src);
+        size_t pminu(int bits, const rm& dest, const rm& src);
+        size_t pmaxu(int bits, const rm& dest, const rm& src);
+
+        size_t psll(int bits, const rm& dest, u8 imm);
+        size_t psrl(int bits, const rm& dest, u8 imm);
+        size_t psra(int bits, const rm& dest, u8 imm);
+
+        size_t pshufd(const rm& dest, const rm& src, u8 imm);
+        size_t pshufb(const rm& dest, const rm& src);
+        size_t punpckl(int bits, const rm& dest, const rm& src);
+        size_t punpckh(int bits, const rm& dest, const rm& src);
+        size_t pblend(int bits, const rm& dest, const rm& src, u8 imm);
+        size_t pblendv(int bits, const rm& dest, const rm& src);
+
+        size_t addp(int bits, const rm& dest, const rm& src);
+        size_t subp(int bits, const rm& dest, const rm& src);
+        size_t mulp(int bits, const rm& dest, const rm& src);
+        size_t divp(int bits, const rm& dest, const rm& src);
+        size_t minp(int bits, const rm& dest, const rm& src);
+        size_t maxp(int bits, const rm& dest, const rm& src);
+        size_t sqrtp(int bits, const rm& dest, const rm& src);
+        size_t andp(int bits, const rm& dest, const rm& src);
+        size_t andnp(int bits, const rm& dest, const rm& src);
+        size_t orp(int bits, const rm& dest, const rm& src);
+        size_t xorp(int bits, const rm& dest, const rm& src);
+        size_t cmpp(int bits, const rm& dest, const rm& src, u8 pred);
+        size_t shufp(int bits, const rm& dest, const rm& src, u8 imm);
+
+        // aes, pclmulqdq and sha each have their own cpuid bit and only
+        // operate on 128 bit vectors; sha has no vex encoding and always
+        // uses the legacy form, sha256rnds2 implicitly reads xmm0
+        size_t aesenc(const rm& dest, const rm& src);
+        size_t aesenclast(const rm& dest, const rm& src);
+        size_t aesdec(const rm& dest, const rm& src);
+        size_t aesdeclast(const rm& dest, const rm& src);
+        size_t aesimc(const rm& dest, const rm& src);
+        size_t aeskeygenassist(const rm& dest, const rm& src, u8 imm);
+        size_t pclmulqdq(const rm& dest, const rm& src, u8 imm);
+        size_t sha1rnds4(const rm& dest, const rm& src, u8 imm);
+        size_t sha1nexte(const rm& dest, const rm& src);
+        size_t sha1msg1(const rm& dest, const rm& src);
+        size_t sha1msg2(const rm& dest, const rm& src);
+        size_t sha256rnds2(const rm& dest, const rm& src);
+        size_t sha256msg1(const rm& dest, const rm& src);
+        size_t sha256msg2(const rm& dest, const rm& src);
+
+        size_t vzeroupper();
     };
 
 }
@@ -34,6 +34,51 @@
 
 namespace ftl {
 
+    // orderings between earlier and later memory accesses requested by
+    // guest barriers; x86 only lets loads pass earlier stores, so all but
+    // store-load ordering come without any instruction
+    enum barrier_kind {
+        BARRIER_LOADLOAD   = 1 << 0,
+        BARRIER_LOADSTORE  = 1 << 1,
+        BARRIER_STORELOAD  = 1 << 2,
+        BARRIER_STORESTORE = 1 << 3,
+
+        BARRIER_ACQUIRE = BARRIER_LOADLOAD | BARRIER_LOADSTORE,
+        BARRIER_RELEASE = BARRIER_LOADSTORE | BARRIER_STORESTORE,
+        BARRIER_ACQ_REL = BARRIER_ACQUIRE | BARRIER_RELEASE,
+        BARRIER_SEQ_CST = BARRIER_ACQ_REL | BARRIER_STORELOAD,
+    };
+
+    // cache levels requested by gen_prefetch, PREFETCH_WRITE fetches the
+    // line for ownership ahead of a store
+    enum prefetch_hint {
+        PREFETCH_T0,
+        PREFETCH_T1,
+        PREFETCH_T2,
+        PREFETCH_NTA,
+        PREFETCH_WRITE,
+    };
+
+    // a direct-mapped software tlb as kept by softmmu guests: the entry for
+    // a guest address is selected by its page number modulo the number of
+    // entries and hits if its tag equals the page aligned address, then the
+    // host address is the guest address plus the addend of the entry. tags
+    // with any bit below the page size set never hit, e.g. -1 for unmapped
+    struct tlb_layout {
+        u64    base;       // address of the first entry
+        size_t entries;    // number of entries, a power of two
+        size_t entry_size; // size of an entry in bytes, a power of two
+        size_t page_bits;  // log2 of the guest page size
+        i32    tag_read;   // offset of the tag loads are checked against
+        i32    tag_write;  // offset of the tag stores are checked against
+        i32    addend;     // offset of the guest to host address addend
+    };
+
+    // tlb miss handlers, receiving the data pointer of the function, the
+    // guest address and the access size in bytes
+    typedef u64  (*tlb_load_fn)(void* data, u64 addr, u64 size);
+    typedef void (*tlb_store_fn)(void* data, u64 addr, u64 val, u64 size);
+
     class func
     {
     private:
@@ -49,16 +94,69 @@ namespace ftl {
         u8*     m_code;
         u8*     m_last;
 
+        size_t  m_frame;
+        bool    m_nt_stores;
+
         label   m_entry;
         label   m_exit;
+        label   m_ret;
+        label*  m_nt_point;
+
+        struct tlb_miss;
+        vector<tlb_miss*> m_tlb_misses;
 
         void gen_prologue_epilogue();
 
+        value gen_udiv_magic(const value& src, u64 val);
+        value gen_idiv_magic(const value& src, i64 val);
+        void  gen_mod_fixup(value& dest, value& quot, i64 val);
+        void  gen_mul_const(value& dest, i64 val);
+        reg   lock_reg(value& val, vector<reg>& locked);
+        rm    lock_address(value& base, value* index, int scale, i32 offset,
+                           vector<reg>& locked);
+        void  unlock_regs(const vector<reg>& locked);
+        rm    atomic_address(value& val, value& base, i32 offset);
+
+        void  gen_copy_const(value& dest, value& src, size_t size, bool move);
+        void  gen_fill_const(value& dest, value& pattern, size_t size);
+        void  gen_rep_movs();
+        void  gen_movs(value& dest, value& src, value& size, bool move);
+        void  gen_stos(value& dest, value& val, value& size);
+        void  swap_reg(int bits, reg r);
+        void  gen_memop(value& val, value& base, value* index, int scale,
+                        i32 offset, bool load, bool swap = false);
+        void  gen_memop(vec& val, value& base, value* index, int scale,
+                        i32 offset, bool load);
+        void  gen_memop_nt(value& val, value& base, value* index, int scale,
+                           i32 offset);
+        void  gen_memop_nt(vec& val, value& base, value* index, int scale,
+                           i32 offset);
+        void  gen_prefetch(value& base, value* index, int scale, i32 offset,
+                           int hint);
+        void  flush_nt_stores();
+        void  fence_nt_loop(const label& l);
+        void  gen_tlb_access(value& val, value& addr, const tlb_layout& tlb,
+                             u64 handler, bool store);
+        void  gen_tlb_misses();
+        void  gen_ret_fence();
+        void  fetch_vec(vec& dest, vec& src);
+        i32   branch_offset(const label& l, bool far) const;
+
+        typedef size_t (emitter::*shiftx)(int, reg, const rm&, reg);
+        void  gen_shiftx(shiftx op, value& dest, value& src);
+
+        typedef void (func::*fpop2)(scalar&, const scalar&);
+        typedef size_t (emitter::*fpop3)(int, const rm&, const rm&, const rm&);
+        void  gen_fpop(fpop2 op2, fpop3 op3, bool commutative, scalar& dest,
+                       const scalar& src1, const scalar& src2);
+
     public:
         const char* name() const { return m_name.c_str(); }
         u8* entry()        const { return m_code; }
         u8* final()        const { return m_last; }
 
+        size_t frame_size() const { return m_frame; }
+
         size_t size() const;
         u8* finish();
 
@@ -142,13 +240,28 @@ namespace ftl {
         scalar gen_scratch_f32(const string& nm, f32 val, xmm r = NXMM);
         scalar gen_scratch_f64(const string& nm, f64 val, xmm r = NXMM);
 
+        vec gen_local_vec(const string& name, xmm r = NXMM);
+        vec gen_global_vec(const string& name, void* addr);
+        vec gen_scratch_vec(const string& name, xmm r = NXMM);
+
+        vec gen_local_vec(const string& name, int bits, xmm r = NXMM);
+        vec gen_global_vec(const string& name, int bits, void* addr);
+        vec gen_scratch_vec(const string& name, int bits, xmm r = NXMM);
+
         void free_value(value& val);
+        void kill_value(value& val);
+        void kill_scalar(scalar& val);
+
+        reg  gen_pin(value& global, reg r = NREGS);
+        void gen_unpin(value& global);
 
         func gen_function(const string& name);
         void gen_ret();
         void gen_ret(i64 val);
         void gen_ret(value& val);
 
+        // branches use the shortest encoding that reaches their target,
+        // far forces a 32 bit displacement, e.g. for later patching
         void gen_jmp(label& l, bool far = false);
         void gen_jo(label& l, bool far = false);
         void gen_jno(label& l, bool far = false);
@@ -280,6 +393,25 @@ namespace ftl {
         void gen_rol(value& dest, u8 shift);
         void gen_ror(value& dest, u8 shift);
 
+        void gen_rol(value& dest, const value& src, u8 shift);
+        void gen_ror(value& dest, const value& src, u8 shift);
+
+        void gen_andn(value& dest, value& src1, const value& src2);
+        void gen_blsr(value& dest, const value& src);
+        void gen_blsi(value& dest, const value& src);
+        void gen_bzhi(value& dest, const value& src, value& index);
+        void gen_pdep(value& dest, value& src, const value& mask);
+        void gen_pext(value& dest, value& src, const value& mask);
+
+        void gen_popcnt(value& dest, const value& src);
+        void gen_clz(value& dest, const value& src);
+        void gen_ctz(value& dest, const value& src);
+        void gen_bswap(value& dest);
+
+        // accumulates the crc-32c (castagnoli) of src into crc, without
+        // any pre- or post-inversion
+        void gen_crc32(value& crc, const value& src);
+
         void gen_bt (value& dest, value& src);
         void gen_bts(value& dest, value& src);
         void gen_btr(value& dest, value& src);
@@ -295,9 +427,79 @@ namespace ftl {
         void gen_sxt(value& dest, value& src);
         void gen_sxt(value& dest, value& src, int dbits, int sbits);
 
+        void gen_load(value& dest, value& base, i32 offset = 0);
+        void gen_load(value& dest, value& base, value& index, int scale,
+                      i32 offset = 0);
+        void gen_store(value& src, value& base, i32 offset = 0);
+        void gen_store(value& src, value& base, value& index, int scale,
+                       i32 offset = 0);
+
+        // byte swapping loads and stores, e.g. for big endian guest memory
+        void gen_load_bswap(value& dest, value& base, i32 offset = 0);
+        void gen_load_bswap(value& dest, value& base, value& index, int scale,
+                            i32 offset = 0);
+        void gen_store_bswap(value& src, value& base, i32 offset = 0);
+        void gen_store_bswap(value& src, value& base, value& index, int scale,
+                             i32 offset = 0);
+
+        // non-temporal stores for data that is not read back soon; values
+        // narrower than 32 bits are stored normally, vectors must be aligned.
+        // once the function contains one, returns share an sfence in front of
+        // the epilogue, later releasing barriers and calls get their own and
+        // loops leading back to earlier ones fence on the back edge; other
+        // orderings need an explicit gen_fence
+        void gen_store_nt(value& src, value& base, i32 offset = 0);
+        void gen_store_nt(value& src, value& base, value& index, int scale,
+                          i32 offset = 0);
+        void gen_prefetch(value& base, i32 offset = 0,
+                          int hint = PREFETCH_T0);
+        void gen_prefetch(value& base, value& index, int scale,
+                          i32 offset = 0, int hint = PREFETCH_T0);
+
+        // guest memory accesses through a software tlb: the probe and the
+        // host access are emitted inline, misses and accesses that cross a
+        // page boundary take a slow path placed behind the function, which
+        // saves the live caller-saved registers and calls the handler
+        void gen_tlb_load(value& dest, value& addr, const tlb_layout& tlb,
+                          tlb_load_fn handler);
+        void gen_tlb_store(value& src, value& addr, const tlb_layout& tlb,
+                           tlb_store_fn handler);
+
+        // block operations on the memory addressed by dest and src; small
+        // constant sizes are unrolled into sse moves, anything else uses rep
+        // movsb or rep stosb, which rdi, rsi, rcx and rax get claimed for
+        void gen_memcpy(value& dest, value& src, value& size);
+        void gen_memcpy(value& dest, value& src, size_t size);
+        void gen_memmove(value& dest, value& src, value& size);
+        void gen_memmove(value& dest, value& src, size_t size);
+        void gen_memset(value& dest, value& val, value& size);
+        void gen_memset(value& dest, value& val, size_t size);
+        void gen_memset(value& dest, u8 val, size_t size);
+
+        // compares cmpv with dest and replaces it with src if equal, setting
+        // the zero flag on success; cmpv receives the previous value of dest
         void gen_cmpxchg(value& dest, value& src, value& cmpv);
         void gen_fence(bool sync_loads = true, bool sync_stores = true);
 
+        // kind is a combination of barrier_kind bits; orderings of earlier
+        // stores also fence non-temporal stores
+        void gen_barrier(int kind = BARRIER_SEQ_CST);
+
+        // single locked instructions on the memory at base + offset; xchg
+        // and xadd return the previous memory contents in val, the cmpxchg
+        // forms work like gen_cmpxchg and require 16 byte alignment for 128
+        // bit operands given as pairs of 64 bit values
+        void gen_atomic_add(value& src, value& base, i32 offset = 0);
+        void gen_atomic_and(value& src, value& base, i32 offset = 0);
+        void gen_atomic_or(value& src, value& base, i32 offset = 0);
+        void gen_atomic_xor(value& src, value& base, i32 offset = 0);
+        void gen_atomic_xchg(value& val, value& base, i32 offset = 0);
+        void gen_atomic_xadd(value& val, value& base, i32 offset = 0);
+        void gen_atomic_cmpxchg(value& src, value& cmpv, value& base,
+                                i32 offset = 0);
+        void gen_atomic_cmpxchg16b(value& lo, value& hi, value& cmplo,
+                                   value& cmphi, value& base, i32 offset = 0);
+
         void gen_mov(scalar& dest, const value& src);
         void gen_mov(value& dest, scalar& src);
 
@@ -309,11 +511,86 @@ namespace ftl {
         void gen_min(scalar& dest, const scalar& src);
         void gen_max(scalar& dest, const scalar& src);
         void gen_sqrt(scalar& dest, const scalar& src);
+
+        void gen_add(scalar& dest, const scalar& src1, const scalar& src2);
+        void gen_sub(scalar& dest, const scalar& src1, const scalar& src2);
+        void gen_mul(scalar& dest, const scalar& src1, const scalar& src2);
+        void gen_div(scalar& dest, const scalar& src1, const scalar& src2);
+        void gen_min(scalar& dest, const scalar& src1, const scalar& src2);
+        void gen_max(scalar& dest, const scalar& src1, const scalar& src2);
         void gen_pxor(scalar& dest, const scalar& src);
         void gen_cmp(scalar& op1, const scalar& op2, bool signal_qnan = false);
         void gen_cvt(scalar& dest, const value& src);
         void gen_cvt(value& dest, const scalar& src);
 
+        void gen_load(vec& dest, value& base, i32 offset = 0);
+        void gen_load(vec& dest, value& base, value& index, int scale,
+                      i32 offset = 0);
+        void gen_store(vec& src, value& base, i32 offset = 0);
+        void gen_store(vec& src, value& base, value& index, int scale,
+                       i32 offset = 0);
+        void gen_store_nt(vec& src, value& base, i32 offset = 0);
+        void gen_store_nt(vec& src, value& base, value& index, int scale,
+                          i32 offset = 0);
+
+        // lane-wise integer ops are sse2, except for 32 bit pmul, 8 and 32
+        // bit pmins/pmaxs, 16 and 32 bit pminu/pmaxu and 64 bit pcmpeq, which
+        // need sse4.1, and 64 bit pcmpgt, which needs sse4.2; these abort if
+        // the cpu lacks the extension
+        void gen_padd(int bits, vec& dest, vec& src);
+        void gen_psub(int bits, vec& dest, vec& src);
+        void gen_pmul(int bits, vec& dest, vec& src);
+        void gen_pand(vec& dest, vec& src);
+        void gen_pandn(vec& dest, vec& src);
+        void gen_por(vec& dest, vec& src);
+        void gen_pxor(vec& dest, vec& src);
+        void gen_pcmpeq(int bits, vec& dest, vec& src);
+        void gen_pcmpgt(int bits, vec& dest, vec& src);
+        void gen_pmins(int bits, vec& dest, vec& src);
+        void gen_pmaxs(int bits, vec& dest, vec& src);
+        void gen_pminu(int bits, vec& dest, vec& src);
+        void gen_pmaxu(int bits, vec& dest, vec& src);
+        void gen_psll(int bits, vec& dest, u8 imm);
+        void gen_psrl(int bits, vec& dest, u8 imm);
+        void gen_psra(int bits, vec& dest, u8 imm);
+
+        // pshufb needs ssse3, blend and blendv need sse4.1
+        void gen_pshufd(vec& dest, vec& src, u8 imm);
+        void gen_pshufb(vec& dest, vec& src);
+        void gen_punpckl(int bits, vec& dest, vec& src);
+        void gen_punpckh(int bits, vec& dest, vec& src);
+        void gen_blend(int bits, vec& dest, vec& src, u8 imm);
+        void gen_blendv(int bits, vec& dest, vec& src, vec& mask);
+
+        // single aes rounds, carry-less multiplication of the quadwords
+        // selected by imm and sha1 / sha256 rounds and message schedules on
+        // 128 bit vectors; these abort if the cpu lacks the extension, so
+        // check cpuinfo first
+        void gen_aesenc(vec& dest, vec& key);
+        void gen_aesenclast(vec& dest, vec& key);
+        void gen_aesdec(vec& dest, vec& key);
+        void gen_aesdeclast(vec& dest, vec& key);
+        void gen_aesimc(vec& dest, vec& src);
+        void gen_aeskeygenassist(vec& dest, vec& src, u8 rcon);
+        void gen_pclmul(vec& dest, vec& src, u8 imm);
+        void gen_sha1rnds4(vec& dest, vec& src, u8 imm);
+        void gen_sha1nexte(vec& dest, vec& src);
+        void gen_sha1msg1(vec& dest, vec& src);
+        void gen_sha1msg2(vec& dest, vec& src);
+        void gen_sha256rnds2(vec& dest, vec& src, vec& wk);
+        void gen_sha256msg1(vec& dest, vec& src);
+        void gen_sha256msg2(vec& dest, vec& src);
+
+        void gen_addp(int bits, vec& dest, vec& src);
+        void gen_subp(int bits, vec& dest, vec& src);
+        void gen_mulp(int bits, vec& dest, vec& src);
+        void gen_divp(int bits, vec& dest, vec& src);
+        void gen_minp(int bits, vec& dest, vec& src);
+        void gen_maxp(int bits, vec& dest, vec& src);
+        void gen_sqrtp(int bits, vec& dest, vec& src);
+        void gen_cmpp(int bits, vec& dest, vec& src, u8 pred);
+        void gen_shufp(int bits, vec& dest, vec& src, u8 imm);
+
         template <typename FUNC>
         value gen_call(FUNC* fn);
 
@@ -344,6 +621,10 @@ namespace ftl {
     }
 
     inline u8* func::finish() {
+        gen_ret_fence();
+        gen_tlb_misses();
+        m_emitter.barrier();
+        m_frame = m_alloc.get_frame_size();
         return m_last = m_buffer.get_code_ptr();
     }
 
@@ -517,21 +798,66 @@ namespace ftl {
         m_alloc.free_value(val);
     }
 
+    inline void func::kill_value(value& val) {
+        m_alloc.kill_value(val);
+    }
+
+    inline vec func::gen_local_vec(const string& name, xmm r) {
+        return m_alloc.new_local_vec(name, 128, r);
+    }
+
+    inline vec func::gen_global_vec(const string& name, void* addr) {
+        return m_alloc.new_global_vec(name, 128, (u64)addr);
+    }
+
+    inline vec func::gen_scratch_vec(const string& name, xmm r) {
+        return m_alloc.new_scratch_vec(name, 128, r);
+    }
+
+    inline vec func::gen_local_vec(const string& name, int bits, xmm r) {
+        return m_alloc.new_local_vec(name, bits, r);
+    }
+
+    inline vec func::gen_global_vec(const string& name, int bits, void* addr) {
+        return m_alloc.new_global_vec(name, bits, (u64)addr);
+    }
+
+    inline vec func::gen_scratch_vec(const string& name, int bits, xmm r) {
+        return m_alloc.new_scratch_vec(name, bits, r);
+    }
+
+    inline void func::kill_scalar(scalar& val) {
+        m_alloc.kill_scalar(val);
+    }
+
+    inline reg func::gen_pin(value& global, reg r) {
+        return m_alloc.pin_value(global, r);
+    }
+
+    inline void func::gen_unpin(value& global) {
+        m_alloc.unpin_value(global);
+    }
+
     template <typename FUNC>
     inline value func::gen_call(FUNC* fn) {
-        m_alloc.flush_volatile_regs();
-        m_alloc.store_all_regs();
+        flush_nt_stores();
+        m_alloc.preserve_volatile_regs();
+        m_alloc.store_global_regs();
         m_emitter.movr(64, argreg(0), BASE_POINTER);
+        if (m_emitter.is_ymm_used())
+            m_emitter.vzeroupper();
 
         if (can_call_directly(m_buffer.get_code_ptr(), fn)) {
             m_emitter.call((u8*)fn);
             value ret = gen_scratch_i64("retval", RAX);
             m_alloc.mark_dirty(RAX);
+            m_alloc.reload_pinned_regs();
             return ret;
         } else {
             value ret = gen_scratch_i64("retval", (i64)fn, RAX);
             m_emitter.call(RAX);
             m_alloc.mark_dirty(RAX);
+            m_alloc.reload_pinned_regs();
             return ret;
         }
     }
@@ -572,10 +898,11 @@ namespace ftl {
         return gen_call(fn, arg1, arg2, arg3, arg4);
     }
 
-    static inline i64 invoke(const cbuf& buffer, void* code, void* data) {
-        typedef i64 func_t (void* code, void* data);
+    static inline i64 invoke(const cbuf& buffer, void* code, void* data,
+                             size_t frame) {
+        typedef i64 func_t (void* code, void* data, size_t frame);
         func_t* fn = (func_t*)buffer.get_code_entry();
-        return fn(code, data);
+        return fn(code, data, frame);
     }
 
 }
@@ -39,6 +39,12 @@ namespace ftl {
         string m_name;
 
         void patch();
+        void relax(size_t alignment);
+        void relocate(u8* from, u8* to, size_t n);
+        void grow(const u8* code, u8* field);
+        bool has_short_fixups() const;
+
+        friend class cbuf;
 
     public:
         const char* name() const { return m_name.c_str(); }
@@ -57,7 +63,13 @@ namespace ftl {
         label& operator = (const label&) = delete;
 
         void add(const fixup& fix);
-        void place(bool flush = true);
+        // alignment is in bytes, loop heads benefit from being placed at
+        // the start of a 32 or 64 byte fetch block; execution falling into
+        // the label runs through nop padding. growing a branch later would
+        // move the label off its alignment, so placing an aligned label grows
+        // every pending short forward branch in the buffer to rel32, even if
+        // its target turns out to be close; place such targets first
+        void place(bool flush = true, size_t alignment = 0);
         void place(u8* location, bool flush);
     };
 
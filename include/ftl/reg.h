@@ -134,21 +134,71 @@ namespace ftl {
         return param_xmms[argno];
     }
 
+    // ymm registers are the 256-bit extension of the xmm registers, they are
+    // not allocated separately but name the full width of an xmm register
+    enum ymm {
+        YMM0  = XMM0,
+        YMM1  = XMM1,
+        YMM2  = XMM2,
+        YMM3  = XMM3,
+        YMM4  = XMM4,
+        YMM5  = XMM5,
+        YMM6  = XMM6,
+        YMM7  = XMM7,
+        YMM8  = XMM8,
+        YMM9  = XMM9,
+        YMM10 = XMM10,
+        YMM11 = XMM11,
+        YMM12 = XMM12,
+        YMM13 = XMM13,
+        YMM14 = XMM14,
+        YMM15 = XMM15,
+        NYMM  = NXMM,
+    };
+
+    static inline bool ymm_valid(int r) {
+        return r < NYMM;
+    }
+
+    static inline ymm to_ymm(xmm r) {
+        return (ymm)r;
+    }
+
     struct rm {
         const bool is_mem;
         const bool is_xmm;
+        const bool is_rip;
+        const bool is_ymm;
 
         const int  r;
         const i64  offset;
 
+        const int  index;
+        const int  scale;
+
         bool is_reg() const { return !is_mem && !is_xmm; }
-        bool is_addressable() const { return fits_i32(offset); }
+        bool is_addressable() const { return is_rip || fits_i32(offset); }
+        bool has_index() const { return is_mem && index < NREGS; }
 
-        rm(reg _r): is_mem(false), is_xmm(false), r(_r), offset(0) {}
-        rm(xmm _r): is_mem(false), is_xmm(true),  r((reg)_r), offset(0) {}
+        rm(reg _r): is_mem(false), is_xmm(false), is_rip(false),
+                is_ymm(false), r(_r), offset(0), index(NREGS), scale(1) {
+        }
+
+        rm(xmm _r): is_mem(false), is_xmm(true), is_rip(false),
+                is_ymm(false), r((reg)_r), offset(0), index(NREGS), scale(1) {
+        }
 
-        rm(reg base, i64 off): is_mem(true), is_xmm(false), r(base),
-                offset(off) {
+        rm(ymm _r): is_mem(false), is_xmm(true), is_rip(false),
+                is_ymm(true), r((reg)_r), offset(0), index(NREGS), scale(1) {
+        }
+
+        rm(reg base, i64 off): is_mem(true), is_xmm(false), is_rip(false),
+                is_ymm(false), r(base), offset(off), index(NREGS), scale(1) {
+        }
+
+        rm(reg base, reg idx, int sc, i64 off, bool rip = false):
+                is_mem(true), is_xmm(false), is_rip(rip), is_ymm(false),
+                r(base), offset(off), index(idx), scale(sc) {
         }
 
         bool operator == (const rm& other) const;
@@ -160,7 +210,8 @@ namespace ftl {
 
     inline bool rm::operator == (const rm& o) const {
         return is_mem == o.is_mem && r == o.r && offset == o.offset &&
-               is_xmm == o.is_xmm;
+               is_xmm == o.is_xmm && index == o.index && scale == o.scale &&
+               is_rip == o.is_rip && is_ymm == o.is_ymm;
     }
 
     inline bool rm::operator != (const rm& o) const {
@@ -177,10 +228,26 @@ namespace ftl {
         return rm(base, offset);
     }
 
+    static inline rm memop(reg base, reg index, int scale, i32 offset = 0) {
+        FTL_ERROR_ON(base >= NREGS, "invalid register id: %d", base);
+        FTL_ERROR_ON(index >= NREGS, "invalid register id: %d", index);
+        FTL_ERROR_ON(index == RSP, "rsp cannot be used as index register");
+        FTL_ERROR_ON(scale != 1 && scale != 2 && scale != 4 && scale != 8,
+                     "invalid scale: %d", scale);
+        return rm(base, index, scale, offset);
+    }
+
+    // rip relative operands keep the absolute target address in offset and
+    // use BASE_POINTER as a placeholder base to be treated like globals
+    static inline rm ripop(u64 addr) {
+        return rm(BASE_POINTER, NREGS, 1, (i64)addr, true);
+    }
+
 }
 
 std::ostream& operator << (std::ostream& os, const ftl::reg& r);
 std::ostream& operator << (std::ostream& os, const ftl::xmm& r);
+std::ostream& operator << (std::ostream& os, const ftl::ymm& r);
 std::ostream& operator << (std::ostream& os, const ftl::rm& rm);
 
 #endif
@@ -49,6 +49,8 @@ namespace ftl {
         bool is_dead() const;
         void mark_dead() { m_dead = true; }
 
+        bool is_spilled() const;
+
         bool is_dirty() const;
         void mark_dirty();
 
@@ -68,6 +70,8 @@ namespace ftl {
 
         scalar(alloc& al, const string& name, int bits, u64 addr, reg base,
                i64 offset);
+        scalar(alloc& al, const string& name, int bits, u64 addr,
+               const rm& mem);
         scalar(scalar&& other);
         ~scalar();
 
@@ -81,7 +85,7 @@ namespace ftl {
     };
 
     inline bool scalar::is_dead() const {
-        return m_dead || (is_scratch() && r() == NXMM);
+        return m_dead || (is_scratch() && r() == NXMM && !is_spilled());
     }
 
     inline bool scalar::is_directly_addressable() const {
@@ -50,6 +50,8 @@ namespace ftl {
         bool is_dead() const;
         void mark_dead() { m_dead = true; }
 
+        bool is_spilled() const;
+
         bool is_dirty() const;
         void mark_dirty();
 
@@ -69,6 +71,8 @@ namespace ftl {
 
         value(alloc& al, const string& name, int bits, bool sign, u64 addr,
               reg base, i64 offset);
+        value(alloc& al, const string& name, int bits, bool sign, u64 addr,
+              const rm& mem);
         value(value&& other);
         ~value();
 
@@ -82,7 +86,7 @@ namespace ftl {
     };
 
     inline bool value::is_dead() const {
-        return m_dead || (is_scratch() && r() == NREGS);
+        return m_dead || (is_scratch() && r() == NREGS && !is_spilled());
     }
 
     inline bool value::is_directly_addressable() const {
@@ -0,0 +1,66 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef FTL_VEC_H
+#define FTL_VEC_H
+
+#include "ftl/common.h"
+#include "ftl/error.h"
+#include "ftl/reg.h"
+#include "ftl/scalar.h"
+
+namespace ftl {
+
+    // A vec holds 128 bits of packed data in an xmm register, or 256 bits in
+    // the corresponding ymm register if avx is available. It is allocated,
+    // spilled and written back like a scalar; the lane layout is not part of
+    // the value but chosen by each operation performed on it.
+    class vec: public scalar
+    {
+    public:
+        vec(alloc& al, const string& name, int bits, u64 addr, reg base,
+            i64 offset);
+        vec(alloc& al, const string& name, int bits, u64 addr,
+            const rm& mem);
+        vec(vec&& other);
+
+        vec(const vec&) = delete;
+        vec& operator = (const vec&) = delete;
+    };
+
+    inline vec::vec(alloc& al, const string& name, int bits, u64 addr,
+                    reg base, i64 offset):
+        scalar(al, name, bits, addr, base, offset) {
+        FTL_ERROR_ON(bits != 128 && bits != 256, "invalid vector width %d",
+                     bits);
+    }
+
+    inline vec::vec(alloc& al, const string& name, int bits, u64 addr,
+                    const rm& mem):
+        scalar(al, name, bits, addr, mem) {
+        FTL_ERROR_ON(bits != 128 && bits != 256, "invalid vector width %d",
+                     bits);
+    }
+
+    inline vec::vec(vec&& other):
+        scalar(std::move(other)) {
+    }
+
+}
+
+#endif
@@ -24,8 +24,9 @@ namespace ftl {
         m_emitter(e),
         m_regs(e),
         m_xmms(e),
-        m_locals(~0ull),
-        m_base(0) {
+        m_frame_top(0),
+        m_base(0),
+        m_frame_free() {
         reset();
     }
 
@@ -42,13 +43,16 @@ namespace ftl {
             r = m_regs.select();
 
         FTL_ERROR_ON(!reg_valid(r), "invalid register selected: %d", r);
+
+        if (m_regs.lookup(r) == val)
+            return r;
+
         FTL_ERROR_ON(r == STACK_POINTER, "cannot assign to stack pointer");
         FTL_ERROR_ON(r == BASE_POINTER, "cannot assign to base pointer");
         FTL_ERROR_ON(is_blocked(r), "cannot assign to blocked register %s",
                      reg_names[r]);
-
-        if (m_regs.lookup(r) == val)
-            return r;
+        FTL_ERROR_ON(is_pinned(val), "cannot move pinned value %s",
+                     val->name());
 
         flush(r);
 
@@ -98,7 +102,7 @@ namespace ftl {
         if (curr < NREGS) {
             m_emitter.movr(val->bits, r, curr);
         } else {
-            FTL_ERROR_ON(val->is_scratch(), "attempt to fetch scratch value");
+            FTL_ERROR_ON(val->is_dead(), "attempt to fetch dead value");
             m_emitter.movr(val->bits, r, val->mem());
         }
 
@@ -117,7 +121,7 @@ namespace ftl {
         if (curr < NXMM) {
             m_emitter.movs(val->bits, r, curr);
         } else {
-            FTL_ERROR_ON(val->is_scratch(), "attempt to fetch scratch value");
+            FTL_ERROR_ON(val->is_dead(), "attempt to fetch dead scalar");
             m_emitter.movs(val->bits, r, val->mem());
         }
 
@@ -127,37 +131,43 @@ namespace ftl {
     void alloc::store(reg r) {
         FTL_ERROR_ON(!reg_valid(r), "invalid register specified");
 
-        if (!is_dirty(r))
-            return;
-
         const value* val = m_regs.lookup(r);
-        FTL_ERROR_ON(val == nullptr, "store operation on empty register");
 
-        if (val->is_scratch())
+        // scratch values have no memory copy until they are spilled once
+        bool unspilled = !is_empty(r) && val->is_scratch() && !is_spilled(val);
+        if (!is_dirty(r) && !unspilled)
             return;
 
+        FTL_ERROR_ON(val == nullptr, "store operation on empty register");
+
         m_emitter.movr(val->bits, val->mem(), r);
-        mark_clean(r);
+
+        // pinned values stay dirty, since we cannot track which control flow
+        // paths have modified them since the last write-back
+        if (!is_pinned(val))
+            mark_clean(r);
     }
 
     void alloc::store(xmm r) {
         FTL_ERROR_ON(!xmm_valid(r), "invalid register specified");
 
-        if (!is_dirty(r))
-            return;
-
         const scalar* val = m_xmms.lookup(r);
-        FTL_ERROR_ON(val == nullptr, "store operation on empty register");
 
-        if (val->is_scratch())
+        bool unspilled = !is_empty(r) && val->is_scratch() && !is_spilled(val);
+        if (!is_dirty(r) && !unspilled)
             return;
 
+        FTL_ERROR_ON(val == nullptr, "store operation on empty register");
+
         m_emitter.movs(val->bits, val->mem(), r);
         mark_clean(r);
     }
 
     void alloc::flush(reg r) {
         FTL_ERROR_ON(!reg_valid(r), "invalid register specified");
+        if (is_pinned(r))
+            return;
+
         store(r);
         m_regs.assign(r, nullptr);
     }
@@ -168,15 +178,105 @@ namespace ftl {
         m_xmms.assign(r, nullptr);
     }
 
+    void alloc::discard(reg r) {
+        FTL_ERROR_ON(!reg_valid(r), "invalid register specified");
+        FTL_ERROR_ON(is_pinned(r), "cannot discard pinned register %s",
+                     reg_names[r]);
+        m_regs.assign(r, nullptr);
+    }
+
+    void alloc::discard(xmm r) {
+        FTL_ERROR_ON(!xmm_valid(r), "invalid register specified");
+        m_xmms.assign(r, nullptr);
+    }
+
+    i32 alloc::alloc_slot(int size) {
+        FTL_ERROR_ON(!is_pow2(size) || size > 32, "invalid slot size %d", size);
+
+        // reuse a slot of the same size class if one has been freed before,
+        // otherwise grow the frame keeping the new slot naturally aligned
+        vector<i32>& slots = m_frame_free[log2i(size)];
+        if (!slots.empty()) {
+            i32 offset = slots.back();
+            slots.pop_back();
+            return offset;
+        }
+
+        i32 offset = (m_frame_top + size - 1) & ~(size - 1);
+        m_frame_top = offset + size;
+        return offset;
+    }
+
+    void alloc::free_slot(i32 offset, int size) {
+        FTL_ERROR_ON(!is_pow2(size) || size > 32, "invalid slot size %d", size);
+        FTL_ERROR_ON(offset < (i32)sizeof(u64) || offset >= m_frame_top,
+                     "corrupt stack offset %d", offset);
+        m_frame_free[log2i(size)].push_back(offset);
+    }
+
+    i32 alloc::spill_slot(const value* val) {
+        FTL_ERROR_ON(!val->is_scratch(), "cannot spill non-scratch value");
+
+        auto it = m_spills.find(val);
+        if (it != m_spills.end())
+            return it->second;
+
+        return m_spills[val] = alloc_slot(val->bits / 8);
+    }
+
+    i32 alloc::spill_slot(const scalar* val) {
+        FTL_ERROR_ON(!val->is_scratch(), "cannot spill non-scratch scalar");
+
+        auto it = m_xspills.find(val);
+        if (it != m_xspills.end())
+            return it->second;
+
+        return m_xspills[val] = alloc_slot(val->bits / 8);
+    }
+
+    void alloc::move_spill(const value* from, const value* to) {
+        auto it = m_spills.find(from);
+        if (it == m_spills.end())
+            return;
+
+        m_spills[to] = it->second;
+        m_spills.erase(it);
+    }
+
+    void alloc::move_spill(const scalar* from, const scalar* to) {
+        auto it = m_xspills.find(from);
+        if (it == m_xspills.end())
+            return;
+
+        m_xspills[to] = it->second;
+        m_xspills.erase(it);
+    }
+
+    void alloc::release_spill(const value* val) {
+        auto it = m_spills.find(val);
+        if (it == m_spills.end())
+            return;
+
+        free_slot(it->second, val->bits / 8);
+        m_spills.erase(it);
+    }
+
+    void alloc::release_spill(const scalar* val) {
+        auto it = m_xspills.find(val);
+        if (it == m_xspills.end())
+            return;
+
+        free_slot(it->second, val->bits / 8);
+        m_xspills.erase(it);
+    }
+
     value alloc::new_local_noinit(const string& name, int bits, reg r) {
-        int idx = ffs(m_locals) - 1;
-        FTL_ERROR_ON(idx < 0, "out of stack frame memory");
-        m_locals &= ~(1ull << idx);
+        i32 offset = alloc_slot(bits / 8);
 
         if (r == NREGS)
             r = select();
 
-        value v(*this, name, bits, true, 0, STACK_POINTER, idx * sizeof(u64));
+        value v(*this, name, bits, true, 0, STACK_POINTER, offset);
 
         flush(r);
         assign(&v, r);
@@ -184,15 +284,30 @@ namespace ftl {
         return v;
     }
 
+    rm alloc::literal(u64 val) {
+        return ripop((u64)m_emitter.get_buffer().get_literal(val));
+    }
+
+    void alloc::load_const(int bits, reg r, i64 val) {
+        // a rip relative load is three bytes shorter than movabs
+        if (bits == 64 && encode_size(val) == 64 && encode_size<u64>(val) == 64)
+            m_emitter.movr(64, r, literal(val));
+        else
+            m_emitter.movi(bits, r, val);
+    }
+
     value alloc::new_local(const string& name, int bits, i64 val, reg r) {
         value v = new_local_noinit(name, bits, r);
         r = v.r();
-        m_emitter.movi(bits, r, val);
+        load_const(bits, r, val);
         mark_dirty(r);
         return v;
     }
 
     value alloc::new_global(const string& name, int bits, u64 addr) {
+        if (m_emitter.get_buffer().is_rip_addressable(addr))
+            return value(*this, name, bits, true, addr, ripop(addr));
+
         if (m_base == 0) {
             m_base = FTL_PAGE_ROUND(addr + FTL_PAGE_SIZE);
             m_emitter.movi(64, BASE_POINTER, m_base);
@@ -216,20 +331,18 @@ namespace ftl {
     value alloc::new_scratch(const string& name, int bits, i64 val, reg r) {
         value v = new_scratch_noinit(name, bits, r);
         r = v.r();
-        m_emitter.movi(bits, r, val);
+        load_const(bits, r, val);
         mark_dirty(r);
         return v;
     }
 
     scalar alloc::new_local_scalar_noinit(const string& nm, int bits, xmm r) {
-        int idx = ffs(m_locals) - 1;
-        FTL_ERROR_ON(idx < 0, "out of stack frame memory");
-        m_locals &= ~(1ull << idx);
+        i32 offset = alloc_slot(bits / 8);
 
         if (r == NXMM)
             r = m_xmms.select();
 
-        scalar s(*this, nm, bits, 0, STACK_POINTER, idx * sizeof(u64));
+        scalar s(*this, nm, bits, 0, STACK_POINTER, offset);
 
         flush(r);
         assign(&s, r);
@@ -241,18 +354,20 @@ namespace ftl {
         scalar s = new_local_scalar_noinit(nm, bits, r);
         r = s.r();
 
-        reg dummy = m_regs.select();
-        flush(dummy);
-
         u64 raw = (bits == 32) ? f32_raw(f) : f64_raw(f);
-        m_emitter.movi(bits, dummy, raw);
-        m_emitter.movx(bits, r, dummy);
+        if (raw == 0)
+            m_emitter.pxor(bits, r, r);
+        else
+            m_emitter.movs(bits, r, literal(raw));
 
         mark_dirty(r);
         return s;
     }
 
     scalar alloc::new_global_scalar(const string& name, int bits, u64 addr) {
+        if (m_emitter.get_buffer().is_rip_addressable(addr))
+            return scalar(*this, name, bits, addr, ripop(addr));
+
         if (m_base == 0) {
             m_base = FTL_PAGE_ROUND(addr + FTL_PAGE_SIZE);
             m_emitter.movi(64, BASE_POINTER, m_base);
@@ -277,25 +392,71 @@ namespace ftl {
         scalar s = new_scratch_scalar_noinit(n, bits, r);
         r = s.r();
 
-        reg dummy = m_regs.select();
-        flush(dummy);
-
         u64 raw = (bits == 32) ? f32_raw(f) : f64_raw(f);
-        m_emitter.movi(bits, dummy, raw);
-        m_emitter.movx(bits, r, dummy);
+        if (raw == 0)
+            m_emitter.pxor(bits, r, r);
+        else
+            m_emitter.movs(bits, r, literal(raw));
 
         mark_dirty(r);
         return s;
     }
 
+    static void check_vec_width(const emitter& e, int w) {
+        FTL_ERROR_ON(w == 256 && !e.is_avx(), "256 bit vectors require avx");
+    }
+
+    vec alloc::new_local_vec(const string& name, int w, xmm r) {
+        check_vec_width(m_emitter, w);
+        i32 offset = alloc_slot(w / 8);
+
+        if (r == NXMM)
+            r = m_xmms.select();
+
+        vec v(*this, name, w, 0, STACK_POINTER, offset);
+
+        flush(r);
+        assign(&v, r);
+
+        return v;
+    }
+
+    vec alloc::new_global_vec(const string& name, int w, u64 addr) {
+        check_vec_width(m_emitter, w);
+        if (m_emitter.get_buffer().is_rip_addressable(addr))
+            return vec(*this, name, w, addr, ripop(addr));
+
+        if (m_base == 0) {
+            m_base = FTL_PAGE_ROUND(addr + FTL_PAGE_SIZE);
+            m_emitter.movi(64, BASE_POINTER, m_base);
+        }
+
+        i64 offset = addr - m_base;
+        vec v(*this, name, w, addr, BASE_POINTER, offset);
+        return v;
+    }
+
+    vec alloc::new_scratch_vec(const string& name, int w, xmm r) {
+        check_vec_width(m_emitter, w);
+        if (r == NXMM)
+            r = m_xmms.select();
+        flush(r);
+
+        vec v(*this, name, w, ~0ull, NREGS, 0);
+        assign(&v, r);
+        return v;
+    }
+
     void alloc::free_value(value& val) {
         FTL_ERROR_ON(val.is_dead(), "double free value %s", val.name());
 
-        if (val.is_local()) {
-            int idx = val.offset() / sizeof(u64);
-            FTL_ERROR_ON(idx < 0 || idx > 64, "corrupt stack offset");
-            m_locals |= (1 << idx);
-        }
+        if (is_pinned(&val))
+            unpin_value(val);
+
+        if (val.is_local())
+            free_slot(val.offset(), val.bits / 8);
+        if (val.is_scratch())
+            release_spill(&val);
 
         reg r = lookup(&val);
         if (r < NREGS)
@@ -307,11 +468,10 @@ namespace ftl {
     void alloc::free_scalar(scalar& val) {
         FTL_ERROR_ON(val.is_dead(), "double free scalar %s", val.name());
 
-        if (val.is_local()) {
-            int idx = val.offset() / sizeof(u64);
-            FTL_ERROR_ON(idx < 0 || idx > 64, "corrupt stack offset");
-            m_locals |= (1 << idx);
-        }
+        if (val.is_local())
+            free_slot(val.offset(), val.bits / 8);
+        if (val.is_scratch())
+            release_spill(&val);
 
         xmm r = lookup(&val);
         if (r < NXMM)
@@ -320,6 +480,74 @@ namespace ftl {
         val.mark_dead();
     }
 
+    void alloc::kill_value(value& val) {
+        FTL_ERROR_ON(val.is_dead(), "cannot kill dead value %s", val.name());
+
+        // the current content of val will be overwritten before it is read
+        // again, so there is no need to write back its register
+        if (is_pinned(&val))
+            unpin_value(val);
+
+        reg r = lookup(&val);
+        if (r < NREGS)
+            discard(r);
+        if (val.is_scratch())
+            release_spill(&val);
+    }
+
+    void alloc::kill_scalar(scalar& val) {
+        FTL_ERROR_ON(val.is_dead(), "cannot kill dead scalar %s", val.name());
+
+        xmm r = lookup(&val);
+        if (r < NXMM)
+            discard(r);
+        if (val.is_scratch())
+            release_spill(&val);
+    }
+
+    reg alloc::pin_value(value& val, reg r) {
+        FTL_ERROR_ON(!val.is_global(), "cannot pin non-global value %s",
+                     val.name());
+        FTL_ERROR_ON(is_pinned(&val), "value %s already pinned", val.name());
+
+        // only callee-saved registers survive helper calls and are not used
+        // for argument passing or as implicit operands of mul/div/shifts
+        static const reg pin_order[] = { R15, R14, R13, R12, RBX };
+
+        // keep a cached copy where it is if that is a pinnable register,
+        // otherwise fetch moves it over and drops the old mapping
+        if (r == NREGS) {
+            reg curr = lookup(&val);
+            for (size_t i = 0; i < FTL_ARRAY_SIZE(pin_order); i++)
+                if (pin_order[i] == curr)
+                    r = curr;
+        }
+
+        for (size_t i = 0; r == NREGS && i < FTL_ARRAY_SIZE(pin_order); i++)
+            if (!is_blocked(pin_order[i]))
+                r = pin_order[i];
+
+        FTL_ERROR_ON(r == NREGS, "out of registers to pin %s", val.name());
+        FTL_ERROR_ON(!stl_contains(callee_saved_regs, r),
+                     "cannot pin %s to volatile register %s", val.name(),
+                     reg_names[r]);
+
+        fetch(&val, r);
+        mark_dirty(r);
+        block(r);
+
+        m_pinned.insert(&val);
+        return r;
+    }
+
+    void alloc::unpin_value(value& val) {
+        FTL_ERROR_ON(!is_pinned(&val), "value %s not pinned", val.name());
+
+        reg r = lookup(&val);
+        m_pinned.erase(&val);
+        unblock(r);
+    }
+
     size_t alloc::count_active_regs() const {
         size_t count = 0;
         count += m_regs.count_active_regs();
@@ -342,6 +570,8 @@ namespace ftl {
     }
 
     void alloc::flush_all_regs() {
+        discard_scratch();
+
         for (reg r : all_regs)
             flush(r);
         for (xmm r : all_xmms)
@@ -362,8 +592,120 @@ namespace ftl {
             flush(r);
     }
 
+    void alloc::preserve_volatile_regs() {
+        static const reg preserve_order[] = { RBX, R12, R13, R14, R15 };
+
+        for (reg r : caller_saved_regs) {
+            const value* val = m_regs.lookup(r);
+            if (val == nullptr || val->is_dead() || val->is_global()) {
+                flush(r);
+                continue;
+            }
+
+            // locals and scratch values that are live across the call are
+            // moved into an empty callee-saved register instead of memory
+            reg dest = NREGS;
+            for (reg cand : preserve_order) {
+                if (!is_blocked(cand) && is_empty(cand)) {
+                    dest = cand;
+                    break;
+                }
+            }
+
+            if (dest == NREGS) {
+                flush(r);
+                continue;
+            }
+
+            bool dirty = is_dirty(r);
+            m_emitter.movr(64, dest, r);
+            m_regs.assign(r, nullptr);
+            m_regs.assign(dest, val);
+            if (dirty)
+                mark_dirty(dest);
+        }
+
+        for (xmm r : caller_saved_xmms)
+            flush(r);
+    }
+
+    void alloc::store_global_regs() {
+        // helpers may access globals through the data pointer, but locals
+        // and scratch values in callee-saved registers survive the call
+        for (reg r : all_regs) {
+            const value* val = m_regs.lookup(r);
+            if (val && !val->is_dead() && val->is_global())
+                store(r);
+        }
+
+        for (xmm r : all_xmms) {
+            const scalar* val = m_xmms.lookup(r);
+            if (val && !val->is_dead() && val->is_global())
+                store(r);
+        }
+    }
+
+    void alloc::discard_local_regs() {
+        // locals and scratch values do not outlive the stack frame, so their
+        // registers can be dropped without write-back when we return
+        for (reg r : all_regs) {
+            const value* val = m_regs.lookup(r);
+            if (val && !val->is_global())
+                discard(r);
+        }
+
+        for (xmm r : all_xmms) {
+            const scalar* val = m_xmms.lookup(r);
+            if (val && !val->is_global())
+                discard(r);
+        }
+    }
+
+    void alloc::discard_scratch() {
+        // scratch values do not survive control flow, whether they are held
+        // in registers or have been spilled to the stack frame
+        for (reg r : all_regs) {
+            const value* val = m_regs.lookup(r);
+            if (val && val->is_scratch())
+                discard(r);
+        }
+
+        for (xmm r : all_xmms) {
+            const scalar* val = m_xmms.lookup(r);
+            if (val && val->is_scratch())
+                discard(r);
+        }
+
+        for (auto spill : m_spills)
+            free_slot(spill.second, spill.first->bits / 8);
+        for (auto spill : m_xspills)
+            free_slot(spill.second, spill.first->bits / 8);
+
+        m_spills.clear();
+        m_xspills.clear();
+    }
+
+    void alloc::store_pinned_regs() {
+        for (const value* val : m_pinned)
+            store(lookup(val));
+    }
+
+    void alloc::reload_pinned_regs() {
+        for (const value* val : m_pinned)
+            m_emitter.movr(val->bits, lookup(val), val->mem());
+    }
+
     void alloc::reset() {
-        m_locals = ~0ull;
+        for (const value* val : m_pinned)
+            unblock(lookup(val));
+
+        m_pinned.clear();
+        m_spills.clear();
+        m_xspills.clear();
+        // the first slot of each frame holds the frame size for the epilogue
+        m_frame_top = sizeof(u64);
+        for (auto& slots : m_frame_free)
+            slots.clear();
 
         m_regs.reset();
         m_xmms.reset();
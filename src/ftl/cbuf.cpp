@@ -17,6 +17,9 @@
  ******************************************************************************/
 
 #include "ftl/cbuf.h"
+#include "ftl/bitops.h"
+#include "ftl/utils.h"
+#include "ftl/label.h"
 
 namespace ftl {
 
@@ -24,16 +27,66 @@ namespace ftl {
         return "ftl::out_of_memory";
     }
 
-    //static const u8 NOP = 0x90;
     static const u8 ILL = 0x06;
 
+    // recommended nop sequences of one to nine bytes, longer ones are made
+    // from the eight byte form with additional operand size prefixes
+    static const u8 NOPS[9][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0f, 0x1f, 0x00 },
+        { 0x0f, 0x1f, 0x40, 0x00 },
+        { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+        { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    };
+
+    static const u8 NOP_PREFIX = 0x66;
+    static const size_t NOP_MAXLEN = 15;
+
+    // padding uses nops of at most eleven bytes, i.e. no more than three
+    // prefixes, which all current decoders handle without penalty
+    static const size_t NOP_PADLEN = 11;
+
+    static void write_nop(u8* code, size_t len) {
+        if (len <= 9) {
+            memcpy(code, NOPS[len - 1], len);
+        } else {
+            memset(code, NOP_PREFIX, len - 8);
+            memcpy(code + len - 8, NOPS[7], 8);
+        }
+    }
+
+    static void fill_nops(u8* code, size_t count) {
+        for (; count > NOP_PADLEN; count -= NOP_PADLEN, code += NOP_PADLEN)
+            write_nop(code, NOP_PADLEN);
+        if (count > 0)
+            write_nop(code, count);
+    }
+
+    // jumps crossing or ending on this boundary miss the decoded icache on
+    // cores with the jcc erratum microcode update
+    static const u64 BRANCH_BOUNDARY = 32;
+
+    static bool crosses_boundary(const u8* start, const u8* end) {
+        return (u64)start / BRANCH_BOUNDARY != (u64)end / BRANCH_BOUNDARY;
+    }
+
+    static const u8 ESCAPE = 0x0f;
+    static const u8 JMP8   = 0xeb;
+    static const u8 JMP32  = 0xe9;
+    static const u8 JCC8   = 0x70;
+    static const u8 JCC32  = 0x80; // follows the escape byte
+
     u8* cbuf::mark_exit() {
         FTL_ERROR_ON(m_code_exit, "code exit already marked");
         m_code_exit = m_code_ptr;
         return m_code_exit;
     }
 
-    u8* cbuf::align(size_t alignment) {
+    u8* cbuf::align(size_t alignment, bool nops) {
         if (alignment == 0)
             return m_code_ptr;
 
@@ -41,12 +94,113 @@ namespace ftl {
         const u8* ptr = (u8*)((u64)(m_code_ptr + mask) & ~mask);
         const size_t count = ptr - m_code_ptr;
 
-        skip(count);
+        if (nops)
+            pad(count);
+        else
+            skip(count);
 
         FTL_ERROR_ON(m_code_ptr != ptr, "failed to fill alignment");
         return m_code_ptr;
     }
 
+    void cbuf::move_code(u8* from, size_t n) {
+        if (size_remaining() < n)
+            throw out_of_memory();
+
+        u8* to = m_code_ptr;
+        memmove(from + n, from, to - from);
+        m_code_ptr += n;
+
+        auto move = [from, to, n](const u8* p) -> const u8* {
+            return p >= from && p <= to ? p + n : p;
+        };
+
+        // short displacements that overflow here are fixed up by growing
+        // them in turn
+        for (reloc& r : m_relocs) {
+            r.code = (u8*)move(r.code);
+            r.next = (u8*)move(r.next);
+            r.target = move(r.target);
+            i64 disp = r.target - r.next;
+            memcpy(r.code, &disp, r.size);
+        }
+
+        for (branch& b : m_branches) {
+            b.start = (u8*)move(b.start);
+            b.end = (u8*)move(b.end);
+        }
+
+        if (m_code_exit)
+            m_code_exit = (u8*)move(m_code_exit);
+
+        for (label* l : m_labels)
+            l->relocate(from, to, n);
+    }
+
+    void cbuf::grow_branch(u8* code) {
+        u8* op = code - 1;
+        bool jmp = *op == JMP8;
+        FTL_ERROR_ON(!jmp && (*op & 0xf0) != JCC8, "no short branch at %p", op);
+
+        move_code(code + 1, jmp ? 3 : 4);
+
+        u8* field = op + 1;
+        if (!jmp) {
+            op[1] = JCC32 + (op[0] & 0xf);
+            op[0] = ESCAPE;
+            field = op + 2;
+        } else {
+            op[0] = JMP32;
+        }
+
+        for (reloc& r : m_relocs) {
+            if (r.code == code) {
+                r.code = field;
+                r.next = field + 4;
+                r.size = 4;
+                i64 disp = r.target - r.next;
+                memcpy(r.code, &disp, r.size);
+            }
+        }
+
+        for (label* l : m_labels)
+            l->grow(code, field);
+    }
+
+    void cbuf::insert_padding(u8* at, size_t n) {
+        move_code(at, n);
+        fill_nops(at, n);
+    }
+
+    void cbuf::settle() {
+        // padding a branch may push short branches out of reach and growing
+        // them may move other branches onto a boundary, so repeat until
+        // neither happens anymore
+        bool moved;
+        do {
+            moved = false;
+            for (const reloc& r : m_relocs) {
+                if (r.size == 1 && !fits_i8(r.target - r.next)) {
+                    grow_branch(r.code);
+                    moved = true;
+                    break;
+                }
+            }
+
+            if (moved)
+                continue;
+
+            for (const branch& b : m_branches) {
+                if (crosses_boundary(b.start, b.end)) {
+                    u64 offset = (u64)b.start % BRANCH_BOUNDARY;
+                    insert_padding(b.start, BRANCH_BOUNDARY - offset);
+                    moved = true;
+                    break;
+                }
+            }
+        } while (moved);
+    }
+
     cbuf::cbuf(size_t cap):
         m_capacity(cap),
         m_code_head(nullptr),
@@ -70,9 +224,110 @@ namespace ftl {
         }
     }
 
+    void cbuf::track(label* l) {
+        m_labels.push_back(l);
+    }
+
+    void cbuf::untrack(label* l) {
+        stl_remove_erase(m_labels, l);
+    }
+
+    void cbuf::add_reloc(u8* code, int size, u8* next, const u8* target) {
+        m_relocs.push_back({ code, next, target, size });
+    }
+
+    void cbuf::prune_relocs() {
+        // code only moves when a pending short branch needs to grow or when
+        // a branch needs padding; the latter can also move the code at the
+        // current location, so displacements targeting it are kept
+        for (const label* l : m_labels)
+            if (l->has_short_fixups())
+                return;
+
+        const u8* here = m_code_ptr;
+        m_relocs.erase(std::remove_if(m_relocs.begin(), m_relocs.end(),
+                       [here](const reloc& r) { return r.target != here; }),
+                       m_relocs.end());
+        m_branches.clear();
+    }
+
+    void cbuf::relax_all(const label* except) {
+        for (label* l : m_labels) {
+            if (l == except)
+                continue;
+
+            // growing a branch only changes the fixup itself
+            for (const fixup& fix : l->m_fixups)
+                if (fix.size == 1)
+                    relax(fix.code);
+        }
+    }
+
+    void cbuf::relax(u8* code) {
+        grow_branch(code);
+
+        // the moved code may have pushed other short branches out of reach
+        // or branches onto a boundary
+        settle();
+    }
+
+    size_t cbuf::add_branch(u8* start, u8* end) {
+        FTL_ERROR_ON(end - start >= (ptrdiff_t)BRANCH_BOUNDARY,
+                     "branch too long to align: %td bytes", end - start);
+
+        m_branches.push_back({ start, end });
+        settle();
+
+        // settling only moves records, so ours is still the last one
+        return m_branches.back().end - end;
+    }
+
     void cbuf::skip(size_t count) {
-        for (size_t i = 0; i < count; i++)
-            write(ILL);
+        if (size_remaining() < count)
+            throw out_of_memory();
+
+        memset(m_code_ptr, ILL, count);
+        m_code_ptr += count;
+    }
+
+    void cbuf::pad(size_t count) {
+        if (size_remaining() < count)
+            throw out_of_memory();
+
+        fill_nops(m_code_ptr, count);
+        m_code_ptr += count;
+    }
+
+    void cbuf::nop(size_t len) {
+        FTL_ERROR_ON(len == 0 || len > NOP_MAXLEN, "invalid nop length %zu", len);
+        if (size_remaining() < len)
+            throw out_of_memory();
+
+        write_nop(m_code_ptr, len);
+        m_code_ptr += len;
+    }
+
+    bool cbuf::is_rip_addressable(u64 addr) const {
+        // the displacement must fit from anywhere inside the buffer, allow for
+        // some trailing bytes after the displacement itself
+        i64 lo = addr - (u64)m_code_head;
+        i64 hi = addr - (u64)m_code_end - 16;
+        return fits_i32(lo) && fits_i32(hi);
+    }
+
+    const u8* cbuf::get_literal(u64 val) {
+        auto it = m_literals.find(val);
+        if (it != m_literals.end())
+            return it->second;
+
+        // literals grow down from the end of the buffer, so they stay within
+        // rip range of all code and cannot be overwritten by it
+        if (size_remaining() < sizeof(val))
+            throw out_of_memory();
+
+        m_code_end -= sizeof(val);
+        memcpy(m_code_end, &val, sizeof(val));
+        return m_literals[val] = m_code_end;
     }
 
     void cbuf::reset(u8* addr) {
@@ -89,6 +344,14 @@ namespace ftl {
 
         if (m_code_ptr < m_code_exit)
             m_code_exit = nullptr;
+
+        // drop displacements of code that got discarded
+        m_relocs.erase(std::remove_if(m_relocs.begin(), m_relocs.end(),
+                       [addr](const reloc& r) { return r.code >= addr; }),
+                       m_relocs.end());
+        m_branches.erase(std::remove_if(m_branches.begin(), m_branches.end(),
+                         [addr](const branch& b) { return b.end > addr; }),
+                         m_branches.end());
     }
 
     void cbuf::reset() {
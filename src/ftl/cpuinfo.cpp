@@ -0,0 +1,142 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "ftl/cpuinfo.h"
+#include "ftl/error.h"
+
+#include <cpuid.h>
+
+namespace ftl {
+
+    enum cpuid_bits {
+        CPUID1_ECX_SSE3    = 1u << 0,
+        CPUID1_ECX_PCLMUL  = 1u << 1,
+        CPUID1_ECX_SSSE3   = 1u << 9,
+        CPUID1_ECX_CX16    = 1u << 13,
+        CPUID1_ECX_SSE41   = 1u << 19,
+        CPUID1_ECX_SSE42   = 1u << 20,
+        CPUID1_ECX_MOVBE   = 1u << 22,
+        CPUID1_ECX_POPCNT  = 1u << 23,
+        CPUID1_ECX_AES     = 1u << 25,
+        CPUID1_ECX_OSXSAVE = 1u << 27,
+        CPUID1_ECX_AVX     = 1u << 28,
+
+        CPUID7_EBX_BMI1    = 1u << 3,
+        CPUID7_EBX_AVX2    = 1u << 5,
+        CPUID7_EBX_BMI2    = 1u << 8,
+        CPUID7_EBX_ERMS    = 1u << 9,
+        CPUID7_EBX_SHA     = 1u << 29,
+
+        CPUIDX1_ECX_LZCNT  = 1u << 5,
+
+        XCR0_SSE_YMM       = (1u << 1) | (1u << 2),
+    };
+
+    static u64 xgetbv(u32 idx) {
+        u32 lo, hi;
+        asm volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(idx));
+        return (u64)hi << 32 | lo;
+    }
+
+    static cpuinfo detect() {
+        cpuinfo info = {};
+        unsigned int eax, ebx, ecx, edx;
+
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return info;
+
+        info.sse3  = ecx & CPUID1_ECX_SSE3;
+        info.ssse3 = ecx & CPUID1_ECX_SSSE3;
+        info.sse41 = ecx & CPUID1_ECX_SSE41;
+        info.sse42 = ecx & CPUID1_ECX_SSE42;
+        info.movbe = ecx & CPUID1_ECX_MOVBE;
+        info.popcnt = ecx & CPUID1_ECX_POPCNT;
+        info.cx16 = ecx & CPUID1_ECX_CX16;
+        info.aes = ecx & CPUID1_ECX_AES;
+        info.pclmul = ecx & CPUID1_ECX_PCLMUL;
+
+        // avx is only usable if the os saves and restores the ymm registers
+        if ((ecx & CPUID1_ECX_OSXSAVE) && (ecx & CPUID1_ECX_AVX))
+            info.avx = (xgetbv(0) & XCR0_SSE_YMM) == XCR0_SSE_YMM;
+
+        if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+            info.lzcnt = ecx & CPUIDX1_ECX_LZCNT;
+
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return info;
+
+        info.avx2 = info.avx && (ebx & CPUID7_EBX_AVX2);
+        info.bmi1 = ebx & CPUID7_EBX_BMI1;
+        info.bmi2 = ebx & CPUID7_EBX_BMI2;
+        info.erms = ebx & CPUID7_EBX_ERMS;
+        info.sha = ebx & CPUID7_EBX_SHA;
+
+        return info;
+    }
+
+    static const struct {
+        bool cpuinfo::*feature;
+        const char* name;
+    } features[] = {
+        { &cpuinfo::sse3,   "sse3"   },
+        { &cpuinfo::ssse3,  "ssse3"  },
+        { &cpuinfo::sse41,  "sse4.1" },
+        { &cpuinfo::sse42,  "sse4.2" },
+        { &cpuinfo::avx,    "avx"    },
+        { &cpuinfo::avx2,   "avx2"   },
+        { &cpuinfo::bmi1,   "bmi1"   },
+        { &cpuinfo::bmi2,   "bmi2"   },
+        { &cpuinfo::popcnt, "popcnt" },
+        { &cpuinfo::lzcnt,  "lzcnt"  },
+        { &cpuinfo::movbe,  "movbe"  },
+        { &cpuinfo::cx16,   "cx16"   },
+        { &cpuinfo::erms,   "erms"   },
+        { &cpuinfo::aes,    "aes"    },
+        { &cpuinfo::pclmul, "pclmul" },
+        { &cpuinfo::sha,    "sha"    },
+    };
+
+    static cpuinfo& active() {
+        static cpuinfo info = cpuinfo::host();
+        return info;
+    }
+
+    const cpuinfo& cpuinfo::host() {
+        static const cpuinfo info = detect();
+        return info;
+    }
+
+    const cpuinfo& cpuinfo::baseline() {
+        static const cpuinfo info = {};
+        return info;
+    }
+
+    const cpuinfo& cpuinfo::get() {
+        return active();
+    }
+
+    void cpuinfo::set(const cpuinfo& info) {
+        for (const auto& f : features) {
+            FTL_ERROR_ON(info.*f.feature && !(host().*f.feature),
+                         "host cpu does not support %s", f.name);
+        }
+
+        active() = info;
+    }
+
+}
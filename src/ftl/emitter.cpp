@@ -17,6 +17,7 @@
  ******************************************************************************/
 
 #include "ftl/emitter.h"
+#include "ftl/cpuinfo.h"
 
 namespace ftl {
 
@@ -65,6 +66,11 @@ namespace ftl {
 
         OPCODE_CWD    = 0x99,
 
+        OPCODE_MOVS   = 0xa4,
+        OPCODE_STOS   = 0xaa,
+        OPCODE_CLD    = 0xfc,
+        OPCODE_STD    = 0xfd,
+
         OPCODE_CALL   = 0xe8,
         OPCODE_JMPI   = 0xeb,
         OPCODE_JMPR   = 0xff,
@@ -82,6 +88,8 @@ namespace ftl {
         OPCODE2_SET     = 0x90,
         OPCODE2_IMUL    = 0xaf,
         OPCODE2_CMPXCHG = 0xb0,
+        OPCODE2_XADD    = 0xc0,
+        OPCODE2_CMPX16  = 0xc7,
         OPCODE2_MOVZX   = 0xb6,
         OPCODE2_MOVSX   = 0xbe,
         OPCODE2_BITIMM  = 0xba,
@@ -113,6 +121,129 @@ namespace ftl {
         OPCODE2_PXOR    = 0xef,
     };
 
+    enum opcode_packed {
+        // values above 0xff select the 0f38 or 0f3a opcode maps
+        OPCODE2_MOVDQ   = 0x6f,
+        OPCODE2_PSHUFD  = 0x70,
+        OPCODE2_PSHIFTW = 0x71,
+        OPCODE2_PSHIFTD = 0x72,
+        OPCODE2_PSHIFTQ = 0x73,
+        OPCODE2_CMPPS   = 0xc2,
+        OPCODE2_SHUFPS  = 0xc6,
+        OPCODE2_ANDPS   = 0x54,
+        OPCODE2_ANDNPS  = 0x55,
+        OPCODE2_ORPS    = 0x56,
+        OPCODE2_XORPS   = 0x57,
+        OPCODE2_PAND    = 0xdb,
+        OPCODE2_PANDN   = 0xdf,
+        OPCODE2_POR     = 0xeb,
+
+        OPCODE3_PSHUFB  = 0x3800,
+        OPCODE3_BLENDVB = 0x3810,
+        OPCODE3_BLENDVS = 0x3814,
+        OPCODE3_BLENDVD = 0x3815,
+        OPCODE3_BLENDPS = 0x3a0c,
+        OPCODE3_BLENDPD = 0x3a0d,
+        OPCODE3_PBLENDW = 0x3a0e,
+
+        // four operand vex forms taking the mask register in an immediate
+        OPCODE3_VBLENDVS = 0x3a4a,
+        OPCODE3_VBLENDVD = 0x3a4b,
+        OPCODE3_VBLENDVB = 0x3a4c,
+
+        OPCODE2_VZEROUPPER = 0x77,
+    };
+
+    enum opcode_bmi {
+        OPCODE3_ANDN = 0x38f2,
+        OPCODE3_BLS  = 0x38f3, // blsr, blsi
+        OPCODE3_BZHI = 0x38f5, // also pdep, pext
+        OPCODE3_MULX = 0x38f6,
+        OPCODE3_SHX  = 0x38f7, // shlx, shrx, sarx
+        OPCODE3_RORX = 0x3af0,
+    };
+
+    enum opcode_bitcount {
+        OPCODE2_POPCNT = 0xb8, // f3 prefix
+        OPCODE2_BSF    = 0xbc, // tzcnt with f3 prefix
+        OPCODE2_BSR    = 0xbd, // lzcnt with f3 prefix
+        OPCODE2_BSWAP  = 0xc8, // +r
+        OPCODE3_MOVBE  = 0x38f0, // reg <- r/m, +1 for r/m <- reg
+    };
+
+    enum opcode_bls {
+        OPCODE_BLS_BLSR = 1,
+        OPCODE_BLS_BLSI = 3,
+    };
+
+    enum opcode_pshift {
+        OPCODE_PSHIFT_SRL = 2,
+        OPCODE_PSHIFT_SRA = 4,
+        OPCODE_PSHIFT_SLL = 6,
+    };
+
+    enum opcode_crypto {
+        OPCODE3_CRC32      = 0x38f0, // f2 prefix, +1 for wider sources
+        OPCODE3_AESIMC     = 0x38db,
+        OPCODE3_AESENC     = 0x38dc,
+        OPCODE3_AESENCLAST = 0x38dd,
+        OPCODE3_AESDEC     = 0x38de,
+        OPCODE3_AESDECLAST = 0x38df,
+        OPCODE3_AESKEYGEN  = 0x3adf,
+        OPCODE3_PCLMULQDQ  = 0x3a44,
+        OPCODE3_SHA1NEXTE  = 0x38c8,
+        OPCODE3_SHA1MSG1   = 0x38c9,
+        OPCODE3_SHA1MSG2   = 0x38ca,
+        OPCODE3_SHA256RNDS = 0x38cb,
+        OPCODE3_SHA256MSG1 = 0x38cc,
+        OPCODE3_SHA256MSG2 = 0x38cd,
+        OPCODE3_SHA1RNDS4  = 0x3acc,
+    };
+
+    enum opcode_cache {
+        OPCODE2_MOVNTI    = 0xc3,
+        OPCODE2_MOVNTDQ   = 0xe7, // 66 prefix
+        OPCODE2_PREFETCH  = 0x18, // hint in modrm.reg
+        OPCODE2_PREFETCHW = 0x0d,
+    };
+
+    enum opcode_prefetch {
+        OPCODE_PREFETCH_NTA = 0,
+        OPCODE_PREFETCH_T0  = 1,
+        OPCODE_PREFETCH_T1  = 2,
+        OPCODE_PREFETCH_T2  = 3,
+        OPCODE_PREFETCH_W   = 1,
+    };
+
+    // packed integer opcodes indexed by lane width 8, 16, 32 and 64 bits,
+    // zero marks combinations without an instruction
+    static const int OPS_PADD[]   = { 0xfc, 0xfd, 0xfe, 0xd4 };
+    static const int OPS_PSUB[]   = { 0xf8, 0xf9, 0xfa, 0xfb };
+    static const int OPS_PMUL[]   = { 0, 0xd5, 0x3840, 0 };
+    static const int OPS_PCMPEQ[] = { 0x74, 0x75, 0x76, 0x3829 };
+    static const int OPS_PCMPGT[] = { 0x64, 0x65, 0x66, 0x3837 };
+    static const int OPS_PMINS[]  = { 0x3838, 0xea, 0x3839, 0 };
+    static const int OPS_PMAXS[]  = { 0x383c, 0xee, 0x383d, 0 };
+    static const int OPS_PMINU[]  = { 0xda, 0x383a, 0x383b, 0 };
+    static const int OPS_PMAXU[]  = { 0xde, 0x383e, 0x383f, 0 };
+    static const int OPS_PUNPCKL[] = { 0x60, 0x61, 0x62, 0x6c };
+    static const int OPS_PUNPCKH[] = { 0x68, 0x69, 0x6a, 0x6d };
+
+    static int lane_op(const int ops[4], int bits) {
+        int op = 0;
+        switch (bits) {
+        case  8: op = ops[0]; break;
+        case 16: op = ops[1]; break;
+        case 32: op = ops[2]; break;
+        case 64: op = ops[3]; break;
+        default:
+            FTL_ERROR("unsupported lane width: %d", bits);
+        }
+
+        FTL_ERROR_ON(op == 0, "operation not supported for %d bit lanes", bits);
+        return op;
+    }
+
     enum opcode_imm {
         OPCODE_IMM_ADD = 0,
         OPCODE_IMM_OR  = 1,
@@ -178,6 +309,53 @@ namespace ftl {
         REX_B    = 1 << 0, // whether the ModR/M RM or SIB refers to r8-r15
     };
 
+    enum vex_bits {
+        VEX_2BYTE = 0xc5,
+        VEX_3BYTE = 0xc4,
+        VEX_R     = 1 << 7, // inverted REX.R
+        VEX_X     = 1 << 6, // inverted REX.X
+        VEX_B     = 1 << 5, // inverted REX.B
+        VEX_W     = 1 << 7, // whether operation is 64bit
+        VEX_L     = 1 << 2, // whether operation is 256bit
+    };
+
+    enum vex_map {
+        VEX_MAP_0F   = 1,
+        VEX_MAP_0F38 = 2,
+        VEX_MAP_0F3A = 3,
+    };
+
+    static int vex_pp(int pfx) {
+        switch (pfx) {
+        case 0:             return 0;
+        case PREFIX_16BIT:  return 1;
+        case PREFIX_SINGLE: return 2;
+        case PREFIX_DOUBLE: return 3;
+        default:
+            FTL_ERROR("cannot encode prefix 0x%02x in vex", pfx);
+        }
+    }
+
+    static int vex_map(int op) {
+        switch (op >> 8) {
+        case 0x00: return VEX_MAP_0F;
+        case 0x38: return VEX_MAP_0F38;
+        case 0x3a: return VEX_MAP_0F3A;
+        default:
+            FTL_ERROR("cannot encode opcode 0x%x in vex", op);
+        }
+    }
+
+    static rm widen(const rm& op) {
+        if (op.is_xmm && !op.is_mem)
+            return to_ymm((xmm)op.r);
+        return op;
+    }
+
+    static bool is_wide(const rm& a, const rm& b) {
+        return a.is_ymm || b.is_ymm;
+    }
+
     enum modrm_bits {
         MODRM_INDIRECT = 0,
         MODRM_DISP8  = 1,
@@ -192,6 +370,101 @@ namespace ftl {
         SCALE8 = 3,
     };
 
+    static bool kills_flags(int op) {
+        switch (op) {
+        case OPCODE_ADD:
+        case OPCODE_OR:
+        case OPCODE_AND:
+        case OPCODE_SUB:
+        case OPCODE_XOR:
+        case OPCODE_CMP:
+        case OPCODE_TST:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool kills_flags_imm(int op) {
+        return op != OPCODE_IMM_ADC && op != OPCODE_IMM_SBB;
+    }
+
+    // instructions that macro-fuse with a following conditional jump
+    static bool fuses(int op) {
+        switch (op) {
+        case OPCODE_ADD:
+        case OPCODE_AND:
+        case OPCODE_SUB:
+        case OPCODE_CMP:
+        case OPCODE_TST:
+        case OPCODE_INC:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool fuses_imm(int op) {
+        return op == OPCODE_IMM_ADD || op == OPCODE_IMM_AND ||
+               op == OPCODE_IMM_SUB || op == OPCODE_IMM_CMP;
+    }
+
+    void emitter::record(insn_kind kind, int bits, int r, size_t len,
+                         const rm& mem) {
+        if (!m_peephole || len == 0)
+            return;
+
+        m_history[2] = m_history[1];
+        m_history[1] = m_history[0];
+
+        insn& in = m_history[0];
+        in.kind = kind;
+        in.bits = bits;
+        in.r = r;
+        in.base = !mem.is_mem ? -1 : mem.is_rip ? -2 : mem.r;
+        in.offset = mem.is_mem ? mem.offset : 0;
+        in.end = m_buffer.get_code_ptr();
+        in.start = in.end - len;
+    }
+
+    void emitter::retire() {
+        m_history[0] = m_history[1];
+        m_history[1] = m_history[2];
+        m_history[2] = insn();
+    }
+
+    const emitter::insn* emitter::lookbehind(size_t n) const {
+        // only consider instructions that directly precede the current code
+        // pointer, anything emitted without being recorded breaks the chain
+        const u8* next = m_buffer.get_code_ptr();
+        for (size_t i = 0; i < n; i++) {
+            const insn& in = m_history[i];
+            if (in.kind == INSN_NONE || in.end != next || in.start < m_fence)
+                return nullptr;
+            next = in.start;
+        }
+
+        return &m_history[n - 1];
+    }
+
+    void emitter::zero_idiom() {
+        // mov reg, 0 can only become xor reg, reg once we know the flags are
+        // dead, i.e. when the next instruction overwrites them all
+        const insn* prev = lookbehind(1);
+        if (prev == nullptr || prev->kind != INSN_MOVI0)
+            return;
+
+        reg r = (reg)prev->r;
+        u8* start = prev->start;
+
+        retire();
+        m_buffer.reset(start);
+
+        size_t len = aluop(OPCODE_XOR, 32, r, r);
+        record(INSN_ZERO, 32, r, len);
+        m_stats.zero++;
+    }
+
     void emitter::setup_fixup(fixup* fix, int size) {
         if (fix) {
             fix->code = m_buffer.get_code_ptr();
@@ -199,6 +472,30 @@ namespace ftl {
         }
     }
 
+    void emitter::fusible(size_t len) {
+        m_fused_end = m_buffer.get_code_ptr();
+        m_fused_start = m_fused_end - len;
+    }
+
+    size_t emitter::align_branch(u8* start, fixup* fix, bool fused) {
+        if (!m_align_branches)
+            return 0;
+
+        // a conditional jump directly following a fusible instruction gets
+        // decoded together with it, so both must be kept in one chunk
+        if (fused && m_fused_end == start)
+            start = m_fused_start;
+
+        size_t delta = m_buffer.add_branch(start, m_buffer.get_code_ptr());
+        if (delta > 0) {
+            if (fix)
+                fix->code += delta;
+            barrier();
+        }
+
+        return delta;
+    }
+
     size_t emitter::rex(bool is64, bool rexr, bool rexx, bool rexb) {
         u8 rex = REX_BASE;
         if (is64) rex |= REX_W;
@@ -208,6 +505,38 @@ namespace ftl {
         return m_buffer.write(rex);
     }
 
+    size_t emitter::vex(int pfx, int op, bool w, bool l, int r, int v,
+                        const rm& rm) {
+        FTL_ERROR_ON(r >= NREGS, "invalid value for modrm.reg: %d", r);
+        FTL_ERROR_ON(rm.r >= NREGS, "invalid value for modrm.rm: %d", rm.r);
+
+        bool rexx = rm.has_index() && rm.index >= R8;
+        bool rexb = rm.r >= R8 && !rm.is_rip;
+        int map = vex_map(op);
+
+        // vvvv is stored inverted, 1111 encodes that it is unused
+        u8 tail = (~(xmm_valid(v) ? v : 0) & 0xf) << 3 | vex_pp(pfx);
+        if (l)
+            tail |= VEX_L;
+
+        size_t len = 0;
+        if (map == VEX_MAP_0F && !w && !rexx && !rexb) {
+            len += m_buffer.write<u8>(VEX_2BYTE);
+            len += m_buffer.write<u8>((r < R8 ? VEX_R : 0) | tail);
+        } else {
+            len += m_buffer.write<u8>(VEX_3BYTE);
+            len += m_buffer.write<u8>((r < R8 ? VEX_R : 0) |
+                                      (rexx ? 0 : VEX_X) |
+                                      (rexb ? 0 : VEX_B) | map);
+            len += m_buffer.write<u8>((w ? VEX_W : 0) | tail);
+        }
+
+        if (l)
+            m_ymm_used = true;
+
+        return len;
+    }
+
     size_t emitter::modrm(int mod, int reg, int rm) {
         FTL_ERROR_ON(reg >= NREGS, "invalid value for modrm.r: %d", reg);
         FTL_ERROR_ON(rm >= NREGS, "invalid value for modrm.rm: %d", rm);
@@ -236,16 +565,31 @@ namespace ftl {
         size_t len = 0;
         if (dbits == 16)
             len += m_buffer.write<u8>(PREFIX_16BIT);
-        if (dbits == 8 || dbits == 64 || sbits == 8 || reg >= R8 || rm.r >= R8)
-            len += rex(dbits == 64, reg >= R8, false, rm.r >= R8);
+        bool rexx = rm.has_index() && rm.index >= R8;
+        if (dbits == 8 || dbits == 64 || sbits == 8 || reg >= R8 ||
+            rm.r >= R8 || rexx)
+            len += rex(dbits == 64, reg >= R8, rexx, rm.r >= R8);
         return len;
     }
 
-    size_t emitter::modrm(int r, const rm& rm) {
+    size_t emitter::modrm(int r, const rm& rm, int immlen) {
         if (!rm.is_mem)
             return modrm(MODRM_DIRECT, r & 7, rm.r & 7);
 
         size_t len = 0;
+        if (rm.is_rip) {
+            // displacement is relative to the end of the instruction, which
+            // includes any immediate operand following it
+            u8* next = m_buffer.get_code_ptr() + 1 + sizeof(i32) + immlen;
+            i64 disp = rm.offset - (i64)next;
+            FTL_ERROR_ON(!fits_i32(disp), "rip operand out of reach: %ld", disp);
+            len += modrm(MODRM_INDIRECT, r & 7, 5);
+            m_buffer.add_reloc(m_buffer.get_code_ptr(), 4, next,
+                               (const u8*)rm.offset);
+            len += m_buffer.write<i32>(disp);
+            return len;
+        }
+
         modrm_bits mode;
 
         if (rm.offset == 0 && ((rm.r & 7) != 5)) // rbp and r13 become rip
@@ -257,10 +601,14 @@ namespace ftl {
         else
             FTL_ERROR("operand offset too big to encode: %ld", rm.offset);
 
-        len += modrm(mode, r & 7, rm.r & 7);
-
-        if ((rm.r & 7) == 4) // special case: rsp and r12 need extra sib
-            len += sib(SCALE1, rm.r & 7, rm.r & 7);
+        if (rm.has_index()) {
+            len += modrm(mode, r & 7, 4);
+            len += sib(log2i(rm.scale), rm.index & 7, rm.r & 7);
+        } else {
+            len += modrm(mode, r & 7, rm.r & 7);
+            if ((rm.r & 7) == 4) // special case: rsp and r12 need extra sib
+                len += sib(SCALE1, rm.r & 7, rm.r & 7);
+        }
 
         if (mode == MODRM_DISP32)
             len += m_buffer.write<i32>(rm.offset);
@@ -273,6 +621,9 @@ namespace ftl {
     size_t emitter::immop(int op, int bits, const rm& dest, i32 imm) {
         int immlen = encode_size(imm); // 8, 16 or 32bits
         FTL_ERROR_ON(immlen > bits, "immediate operand too big");
+
+        if (m_peephole && kills_flags_imm(op))
+            zero_idiom();
         FTL_ERROR_ON(bits > 64, "requested operation too wide");
 
         u8 opcode = bits == 8 ? OPCODE_IMM8 : OPCODE_IMM32;
@@ -284,7 +635,7 @@ namespace ftl {
         size_t len = 0;
         len += prefix(bits, (reg)0, dest);
         len += m_buffer.write(opcode);
-        len += modrm((reg)op, dest);
+        len += modrm((reg)op, dest, immlen / 8);
 
         switch (immlen) {
         case  8: len += m_buffer.write<i8>(imm);  break;
@@ -294,6 +645,9 @@ namespace ftl {
             FTL_ERROR("cannot encode immediate with %d bits", immlen);
         }
 
+        if (!dest.is_mem && fuses_imm(op))
+            fusible(len);
+
         return len;
     }
 
@@ -302,6 +656,9 @@ namespace ftl {
             FTL_ERROR("source and destination cannot both be in memory");
         FTL_ERROR_ON(bits > 64, "requested operation too wide");
 
+        if (m_peephole && kills_flags(op))
+            zero_idiom();
+
         rm oprm(src.is_mem ? src : dest); // operand used for modrm.rm
         rm op_r(src.is_mem ? dest : src); // operand used for modrm.reg
 
@@ -316,6 +673,12 @@ namespace ftl {
         len += m_buffer.write(opcode);
         len += modrm(op_r.r, oprm);
 
+        // read-modify-write memory operands do not fuse, and may also carry a
+        // lock prefix that must stay in front of them
+        bool rmw = dest.is_mem && op != OPCODE_CMP && op != OPCODE_TST;
+        if (!oprm.is_rip && !rmw && fuses(op))
+            fusible(len);
+
         return len;
     }
 
@@ -333,7 +696,7 @@ namespace ftl {
         size_t len = 0;
         len += prefix(bits, (reg)0, dest);
         len += m_buffer.write(opcode);
-        len += modrm((reg)op, dest);
+        len += modrm((reg)op, dest, imm != 1 ? 1 : 0);
 
         if (imm != 1)
             len += m_buffer.write(imm);
@@ -342,6 +705,7 @@ namespace ftl {
     }
 
     size_t emitter::branch(int op, i32 imm, fixup* fix) {
+        u8* start = m_buffer.get_code_ptr();
         size_t len = 0;
 
         if (fits_i8(imm)) {
@@ -355,7 +719,7 @@ namespace ftl {
             len += m_buffer.write<i32>(imm);
         }
 
-        return len;
+        return len + align_branch(start, fix, true);
     }
 
     size_t emitter::setcc(int op, const rm& dest) {
@@ -366,6 +730,9 @@ namespace ftl {
         len += m_buffer.write<u8>(OPCODE2_SET + op);
         len += modrm((reg)0, dest);
 
+        if (dest.is_reg())
+            record(INSN_SETCC, 8, dest.r, len);
+
         return len;
     }
 
@@ -384,20 +751,91 @@ namespace ftl {
         return len;
     }
 
+    size_t emitter::xmmop(int pfx, int op, bool w, bool l, int dest,
+                          int src1, const rm& src, int immlen) {
+        if (m_avx) {
+            size_t len = vex(pfx, op, w, l, dest, src1, src);
+            len += m_buffer.write<u8>(op);
+            len += modrm(dest, src, immlen);
+            return len;
+        }
+
+        FTL_ERROR_ON(l, "256 bit operations require avx");
+        FTL_ERROR_ON(xmm_valid(src1) && src1 != dest,
+                     "three operand forms require avx");
+
+        size_t len = 0;
+        if (pfx)
+            len += m_buffer.write<u8>(pfx);
+        len += prefix(w ? 64 : 32, dest, src);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        if (op > 0xff)
+            len += m_buffer.write<u8>(op >> 8);
+        len += m_buffer.write<u8>(op);
+        len += modrm(dest, src, immlen);
+
+        return len;
+    }
+
+    size_t emitter::bmiop(int pfx, int op, int bits, int r, int v,
+                          const rm& src, int immlen) {
+        FTL_ERROR_ON(bits != 32 && bits != 64, "unsupported width: %d", bits);
+        FTL_ERROR_ON(src.is_xmm, "operand cannot be an xmm register");
+
+        size_t len = vex(pfx, op, bits == 64, false, r, v, src);
+        len += m_buffer.write<u8>(op);
+        len += modrm(r, src, immlen);
+        return len;
+    }
+
     size_t emitter::mmxop(int op, int bits, const rm& dest, const rm& src) {
+        return mmxop(op, bits, dest, dest, src);
+    }
+
+    size_t emitter::mmxop(int op, int bits, const rm& dest, const rm& src1,
+                          const rm& src2) {
         FTL_ERROR_ON(bits < 32, "unsupported floating point width: %d", bits);
         FTL_ERROR_ON(bits > 64, "unsupported floating point width: %d", bits);
         FTL_ERROR_ON(!dest.is_xmm, "destination must be a FP-register");
+        FTL_ERROR_ON(!src1.is_xmm, "first source must be a FP-register");
+        FTL_ERROR_ON(src2.is_reg(), "source cannot be integer register");
 
-        size_t len = 0;
         int pfx = (bits == 32) ? PREFIX_SINGLE : PREFIX_DOUBLE;
+        return xmmop(pfx, op, false, false, dest.r, src1.r, src2);
+    }
 
-        len += m_buffer.write<u8>(pfx);
-        len += prefix(32, dest.r, src);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(op);
-        len += modrm(dest.r, src);
+    size_t emitter::sseop(int pfx, int op, const rm& dest, const rm& src,
+                          int immlen) {
+        FTL_ERROR_ON(!dest.is_xmm, "destination must be a FP-register");
+        FTL_ERROR_ON(src.is_reg(), "source cannot be integer register");
+        return xmmop(pfx, op, false, is_wide(dest, src), dest.r, dest.r, src,
+                     immlen);
+    }
+
+    size_t emitter::sseunop(int pfx, int op, const rm& dest, const rm& src,
+                            int immlen) {
+        FTL_ERROR_ON(!dest.is_xmm, "destination must be a FP-register");
+        FTL_ERROR_ON(src.is_reg(), "source cannot be integer register");
+        return xmmop(pfx, op, false, is_wide(dest, src), dest.r, NXMM, src,
+                     immlen);
+    }
 
+    size_t emitter::intop(int op, const rm& dest, const rm& src, int immlen) {
+        FTL_ERROR_ON(is_wide(dest, src) && !m_avx2,
+                     "256 bit integer operations require avx2");
+        return sseop(PREFIX_16BIT, op, dest, src, immlen);
+    }
+
+    size_t emitter::pshift(int op, int ext, const rm& dest, u8 imm) {
+        FTL_ERROR_ON(!dest.is_xmm || dest.is_mem, "operand must be FP-register");
+        FTL_ERROR_ON(dest.is_ymm && !m_avx2,
+                     "256 bit integer operations require avx2");
+
+        // the vex form names the destination in vvvv, modrm.reg holds the
+        // opcode extension and modrm.rm the source
+        size_t len = xmmop(PREFIX_16BIT, op, false, dest.is_ymm, ext, dest.r,
+                           dest, 1);
+        len += m_buffer.write<u8>(imm);
         return len;
     }
 
@@ -407,17 +845,8 @@ namespace ftl {
         FTL_ERROR_ON(!op1.is_xmm, "first operand must be a FP-register");
         FTL_ERROR_ON(op2.is_reg(), "second operand cannot be normal register");
 
-        size_t len = 0;
-
-        if (bits == 64)
-            len += m_buffer.write<u8>(PREFIX_16BIT);
-
-        len += prefix(32, op1.r, op2);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(op);
-        len += modrm(op1.r, op2);
-
-        return len;
+        int pfx = (bits == 64) ? PREFIX_16BIT : 0;
+        return xmmop(pfx, op, false, false, op1.r, NXMM, op2);
     }
 
     size_t emitter::bitop(int op, int bits, const rm& dest, u8 imm) {
@@ -428,7 +857,7 @@ namespace ftl {
         len += prefix(bits, 0, dest);
         len += m_buffer.write<u8>(OPCODE_ESCAPE);
         len += m_buffer.write<u8>(OPCODE2_BITIMM);
-        len += modrm(op, dest);
+        len += modrm(op, dest, 1);
         len += m_buffer.write(imm);
 
         return len;
@@ -447,8 +876,35 @@ namespace ftl {
         return len;
     }
 
+    size_t emitter::escop(int pfx, int op, int bits, int r, const rm& src) {
+        FTL_ERROR_ON(bits < 16, "8bit operation not supported");
+        FTL_ERROR_ON(src.is_xmm, "operand cannot be an xmm register");
+
+        size_t len = 0;
+        if (pfx)
+            len += m_buffer.write<u8>(pfx);
+        len += prefix(bits, r, src);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        if (op > 0xff)
+            len += m_buffer.write<u8>(op >> 8);
+        len += m_buffer.write<u8>(op);
+        len += modrm(r, src);
+
+        return len;
+    }
+
     emitter::emitter(cbuf& code):
-        m_buffer(code) {
+        m_buffer(code),
+        m_peephole(false),
+        m_fence(code.get_code_ptr()),
+        m_history(),
+        m_stats(),
+        m_avx(cpuinfo::get().avx),
+        m_avx2(cpuinfo::get().avx2),
+        m_ymm_used(false),
+        m_align_branches(false),
+        m_fused_start(nullptr),
+        m_fused_end(nullptr) {
 #ifndef __x86_64__
 #error Unsupported target architecture
 #endif
@@ -458,8 +914,42 @@ namespace ftl {
         // nothing to do
     }
 
+    void emitter::set_peephole(bool enable) {
+        barrier();
+        m_peephole = enable;
+    }
+
+    void emitter::barrier() {
+        // code before the fence may be the target of a jump, so it must not
+        // be rewritten or used to elide what follows
+        m_fence = m_buffer.get_code_ptr();
+        for (insn& in : m_history)
+            in = insn();
+
+        m_fused_start = m_fused_end = nullptr;
+    }
+
+    void emitter::set_align_branches(bool enable) {
+        barrier();
+        m_align_branches = enable;
+    }
+
+    void emitter::set_avx(bool enable) {
+        const cpuinfo& host = cpuinfo::host();
+        FTL_ERROR_ON(enable && !host.avx, "host cpu does not support avx");
+        m_avx = enable;
+        m_avx2 = enable && host.avx2;
+    }
+
     size_t emitter::ret() {
-        return m_buffer.write<u8>(OPCODE_RET);
+        u8* start = m_buffer.get_code_ptr();
+        size_t len = m_buffer.write<u8>(OPCODE_RET);
+        return len + align_branch(start, nullptr);
+    }
+
+    size_t emitter::nop(size_t len) {
+        m_buffer.nop(len);
+        return len;
     }
 
     size_t emitter::lock() {
@@ -485,6 +975,7 @@ namespace ftl {
     size_t emitter::movi(int bits, const rm& dest, i64 imm) {
         size_t len = 0;
         int immlen = 0;
+        int width = bits;
 
         if (dest.is_reg() && bits == 64 && encode_size(imm) < 64) {
             immlen = 32;
@@ -507,8 +998,9 @@ namespace ftl {
                 immlen = 32;
             FTL_ERROR_ON(immlen > 32, "immediate too big to move to memory");
             u8 opcode = (bits == 8) ? OPCODE_MOVIRM : (OPCODE_MOVIRM + 1);
+            len += prefix(bits, (reg)0, dest);
             len += m_buffer.write<u8>(opcode);
-            len += modrm((reg)0, dest);
+            len += modrm((reg)0, dest, immlen / 8);
         }
 
         switch (immlen) {
@@ -520,6 +1012,11 @@ namespace ftl {
             FTL_ERROR("cannot encode immediate with %d bits", immlen);
         }
 
+        // xor r32, r32 clears the whole register, so only rewrite moves that
+        // were requested as 32 or 64 bit wide
+        if (dest.is_reg() && imm == 0 && width >= 32)
+            record(INSN_MOVI0, width, dest.r, len);
+
         return len;
     }
 
@@ -573,7 +1070,14 @@ namespace ftl {
     }
 
     size_t emitter::cmpi(int bits, const rm& dest, i32 imm) {
-        return immop(OPCODE_IMM_CMP, bits, dest, imm);
+        if (m_peephole && imm == 0 && dest.is_reg()) {
+            m_stats.cmp0++;
+            return tstr(bits, dest, dest);
+        }
+
+        size_t len = immop(OPCODE_IMM_CMP, bits, dest, imm);
+        record(INSN_CMP, bits, -1, len);
+        return len;
     }
 
     size_t emitter::tsti(int bits, const rm& dest, i32 imm) {
@@ -582,6 +1086,9 @@ namespace ftl {
         FTL_ERROR_ON(immlen > bits, "immediate operand too big");
         FTL_ERROR_ON(immlen > 32, "immediate operand too big");
 
+        if (m_peephole)
+            zero_idiom();
+
         u8 opcode = OPCODE_UNARY;
         if (bits > 8)
             opcode++;
@@ -590,7 +1097,7 @@ namespace ftl {
         reg r = (reg)OPCODE_UNARY_TEST;
         len += prefix(bits, r, dest);
         len += m_buffer.write(opcode);
-        len += modrm(r, dest);
+        len += modrm(r, dest, bits == 64 ? 4 : bits / 8);
 
         switch (bits) {
         case  8: len += m_buffer.write<i8>(imm);  break;
@@ -601,6 +1108,10 @@ namespace ftl {
             FTL_ERROR("cannot encode immediate with %d bits", immlen);
         }
 
+        if (!dest.is_mem)
+            fusible(len);
+
+        record(INSN_CMP, bits, -1, len);
         return len;
     }
 
@@ -625,7 +1136,26 @@ namespace ftl {
             return 0;
         if (dest.is_mem && src.is_mem && dest.offset == src.offset)
             return 0;
-        return aluop(OPCODE_MOV, bits, dest, src);
+
+        if (m_peephole && dest.is_reg() && src.is_mem && !src.has_index()) {
+            const insn* prev = lookbehind(1);
+            int base = src.is_rip ? -2 : src.r;
+            if (prev && prev->kind == INSN_STORE && prev->bits == bits &&
+                prev->base == base && prev->offset == src.offset) {
+                m_stats.reload++;
+                if (prev->r != dest.r)
+                    return movr(bits, dest, (reg)prev->r);
+                if (bits == 32) // keep the zero extension of the load
+                    return aluop(OPCODE_MOV, bits, dest, dest);
+                return 0;
+            }
+        }
+
+        size_t len = aluop(OPCODE_MOV, bits, dest, src);
+        if (dest.is_mem && src.is_reg() && !dest.has_index())
+            record(INSN_STORE, bits, src.r, len, dest);
+
+        return len;
     }
 
     size_t emitter::addr(int bits, const rm& dest, const rm& src) {
@@ -653,11 +1183,16 @@ namespace ftl {
     }
 
     size_t emitter::xorr(int bits, const rm& dest, const rm& src) {
-        return aluop(OPCODE_XOR, bits, dest, src);
+        size_t len = aluop(OPCODE_XOR, bits, dest, src);
+        if (dest.is_reg() && dest == src && bits >= 32)
+            record(INSN_ZERO, bits, dest.r, len);
+        return len;
     }
 
     size_t emitter::cmpr(int bits, const rm& dest, const rm& src) {
-        return aluop(OPCODE_CMP, bits, dest, src);
+        size_t len = aluop(OPCODE_CMP, bits, dest, src);
+        record(INSN_CMP, bits, -1, len);
+        return len;
     }
 
     size_t emitter::tstr(int bits, const rm& dest, const rm& src) {
@@ -665,7 +1200,9 @@ namespace ftl {
         // compute an invalid opcode
         const rm& op1(dest.is_mem ? dest : src);
         const rm& op2(dest.is_mem ? src : dest);
-        return aluop(OPCODE_TST, bits, op1, op2);
+        size_t len = aluop(OPCODE_TST, bits, op1, op2);
+        record(INSN_CMP, bits, -1, len);
+        return len;
     }
 
     size_t emitter::xchg(int bits, const rm& dest, const rm& src) {
@@ -679,7 +1216,7 @@ namespace ftl {
         FTL_ERROR_ON(!src.is_mem, "source must be a memory operand");
         FTL_ERROR_ON(bits <= 16, "8bit lea not supported");
 
-        if (src.offset == 0)
+        if (src.offset == 0 && !src.has_index())
             return movr(bits, dest, (reg)src.r);
 
         size_t len = 0;
@@ -695,6 +1232,10 @@ namespace ftl {
         return lear(bits, dest, memop((reg)src.r, val));
     }
 
+    size_t emitter::lear(int bits, reg dest, reg base, reg index, int scale) {
+        return lear(bits, dest, memop(base, index, scale));
+    }
+
     size_t emitter::btr(int bits, const rm& dest, const rm& src) {
         return bitop(OPCODE2_BT, bits, dest, src);
     }
@@ -753,7 +1294,7 @@ namespace ftl {
 
         u8 opcode = (immlen == 8) ? OPCODE_IMUL8 : OPCODE_IMUL32;
         len += m_buffer.write(opcode);
-        len += modrm(dest, src);
+        len += modrm(dest, src, immlen == 8 ? 1 : 4);
 
         if (immlen == 8)
             len += m_buffer.write<i8>(imm);
@@ -786,6 +1327,59 @@ namespace ftl {
         return len;
     }
 
+    size_t emitter::cryptop(int op, const rm& dest, const rm& src,
+                            int immlen) {
+        FTL_ERROR_ON(is_wide(dest, src), "only 128 bit operands supported");
+        if (op == OPCODE3_AESIMC || op == OPCODE3_AESKEYGEN)
+            return sseunop(PREFIX_16BIT, op, dest, src, immlen);
+        return sseop(PREFIX_16BIT, op, dest, src, immlen);
+    }
+
+    size_t emitter::shaop(int op, const rm& dest, const rm& src, int immlen) {
+        FTL_ERROR_ON(!dest.is_xmm || dest.is_mem, "destination must be xmm");
+        FTL_ERROR_ON(src.is_reg(), "source cannot be integer register");
+        FTL_ERROR_ON(is_wide(dest, src), "only 128 bit operands supported");
+
+        size_t len = 0;
+        len += prefix(32, dest.r, src);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        len += m_buffer.write<u8>(op >> 8);
+        len += m_buffer.write<u8>(op);
+        len += modrm(dest.r, src, immlen);
+        return len;
+    }
+
+    size_t emitter::strop(u8 op, int bits) {
+        FTL_ERROR_ON(bits > 64, "requested operation too wide");
+
+        // the rep prefix shares its encoding with the scalar single prefix
+        size_t len = 0;
+        len += m_buffer.write<u8>(PREFIX_SINGLE);
+        if (bits == 16)
+            len += m_buffer.write<u8>(PREFIX_16BIT);
+        if (bits == 64)
+            len += rex(true, false, false, false);
+
+        len += m_buffer.write<u8>(bits > 8 ? op + 1 : op);
+        return len;
+    }
+
+    size_t emitter::rep_movs(int bits) {
+        return strop(OPCODE_MOVS, bits);
+    }
+
+    size_t emitter::rep_stos(int bits) {
+        return strop(OPCODE_STOS, bits);
+    }
+
+    size_t emitter::cld() {
+        return m_buffer.write<u8>(OPCODE_CLD);
+    }
+
+    size_t emitter::std() {
+        return m_buffer.write<u8>(OPCODE_STD);
+    }
+
     size_t emitter::rolr(int bits, const rm& dest) {
         return aluop(OPCODE_SHIFTR, bits, dest, (reg)OPCODE_SHIFT_ROL);
     }
@@ -850,6 +1444,18 @@ namespace ftl {
         if (sbits == dbits || sbits == 32)
             return movr(sbits, dest, src);
 
+        // setcc into a register that was cleared before the compare already
+        // produces a zero extended result
+        if (m_peephole && sbits == 8 && dest == src) {
+            const insn* prev = lookbehind(3);
+            if (prev && prev->kind == INSN_ZERO && prev->r == dest.r &&
+                m_history[1].kind == INSN_CMP &&
+                m_history[0].kind == INSN_SETCC && m_history[0].r == dest.r) {
+                m_stats.movzx++;
+                return 0;
+            }
+        }
+
         size_t len = 0;
         len += prefix(dbits, sbits, dest.r, src);
 
@@ -920,6 +1526,39 @@ namespace ftl {
         return len;
     }
 
+    size_t emitter::cmpxchg16b(const rm& dest) {
+        FTL_ERROR_ON(!dest.is_mem, "destination operand must be in memory");
+
+        size_t len = 0;
+        len += lock();
+        len += prefix(64, (reg)1, dest);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        len += m_buffer.write<u8>(OPCODE2_CMPX16);
+        len += modrm((reg)1, dest);
+        return len;
+    }
+
+    size_t emitter::xadd(int bits, const rm& dest, const rm& src) {
+        if (src.is_mem)
+            FTL_ERROR("source operand must not be in memory");
+        FTL_ERROR_ON(bits > 64, "requested operation too wide");
+
+        u8 opcode = OPCODE2_XADD;
+        if (bits > 8)
+            opcode += 1;
+
+        size_t len = 0;
+        if (dest.is_mem)
+            len += lock();
+
+        len += prefix(bits, src.r, dest);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        len += m_buffer.write<u8>(opcode);
+        len += modrm(src.r, dest);
+
+        return len;
+    }
+
     size_t emitter::lfence() {
         size_t len = 0;
         len += m_buffer.write<u8>(OPCODE_ESCAPE);
@@ -944,6 +1583,50 @@ namespace ftl {
         return len;
     }
 
+    size_t emitter::lock_fence() {
+        size_t len = 0;
+        len += lock();
+        len += immop(OPCODE_IMM_OR, 32, memop(STACK_POINTER, 0), 0);
+        return len;
+    }
+
+    size_t emitter::movnti(int bits, const rm& dest, const rm& src) {
+        FTL_ERROR_ON(bits < 32, "movnti requires 32 or 64 bit operands");
+        FTL_ERROR_ON(!dest.is_mem, "destination must be memory");
+        FTL_ERROR_ON(!src.is_reg(), "source must be an integer register");
+        return escop(0, OPCODE2_MOVNTI, bits, src.r, dest);
+    }
+
+    size_t emitter::movntdq(const rm& dest, const rm& src) {
+        FTL_ERROR_ON(!dest.is_mem, "destination must be memory");
+        return sseunop(PREFIX_16BIT, OPCODE2_MOVNTDQ, src, dest);
+    }
+
+    size_t emitter::prefop(int op, int hint, const rm& src) {
+        FTL_ERROR_ON(!src.is_mem, "prefetch requires a memory operand");
+        return escop(0, op, 32, hint, src);
+    }
+
+    size_t emitter::prefetcht0(const rm& src) {
+        return prefop(OPCODE2_PREFETCH, OPCODE_PREFETCH_T0, src);
+    }
+
+    size_t emitter::prefetcht1(const rm& src) {
+        return prefop(OPCODE2_PREFETCH, OPCODE_PREFETCH_T1, src);
+    }
+
+    size_t emitter::prefetcht2(const rm& src) {
+        return prefop(OPCODE2_PREFETCH, OPCODE_PREFETCH_T2, src);
+    }
+
+    size_t emitter::prefetchnta(const rm& src) {
+        return prefop(OPCODE2_PREFETCH, OPCODE_PREFETCH_NTA, src);
+    }
+
+    size_t emitter::prefetchw(const rm& src) {
+        return prefop(OPCODE2_PREFETCHW, OPCODE_PREFETCH_W, src);
+    }
+
     size_t emitter::call(u8* fn, fixup* fix) {
         if (fn == nullptr && fix != nullptr)
             fn = m_buffer.get_code_ptr();
@@ -952,22 +1635,30 @@ namespace ftl {
         if (!fits_i32(offset))
             FTL_ERROR("cannot call %p, out of reach", fn);
 
+        u8* start = m_buffer.get_code_ptr();
         size_t len = 0;
         len += m_buffer.write<u8>(OPCODE_CALL);
         setup_fixup(fix, 4);
+        if (fix == nullptr) {
+            u8* code = m_buffer.get_code_ptr();
+            m_buffer.add_reloc(code, 4, code + 4, fn);
+        }
+
         len += m_buffer.write<i32>(offset);
-        return len;
+        return len + align_branch(start, fix);
     }
 
     size_t emitter::call(const rm& dest) {
+        u8* start = m_buffer.get_code_ptr();
         size_t len = 0;
         len += prefix(32, (reg)0, dest);
         len += m_buffer.write<u8>(OPCODE_JMPR);
         len += modrm((reg)2, dest);
-        return len;
+        return len + align_branch(start, nullptr);
     }
 
     size_t emitter::jmpi(i32 offset, fixup* fix) {
+        u8* start = m_buffer.get_code_ptr();
         size_t len = 0;
 
         if (fits_i8(offset)) {
@@ -980,15 +1671,16 @@ namespace ftl {
             len += m_buffer.write<i32>(offset);
         }
 
-        return len;
+        return len + align_branch(start, fix);
     }
 
     size_t emitter::jmpr(const rm& dest) {
+        u8* start = m_buffer.get_code_ptr();
         size_t len = 0;
         len += prefix(32, (reg)0, dest);
         len += m_buffer.write<u8>(OPCODE_JMPR);
         len += modrm((reg)4, dest);
-        return len;
+        return len + align_branch(start, nullptr);
     }
 
     size_t emitter::jo(i32 offset, fixup* fix) {
@@ -1208,6 +1900,11 @@ namespace ftl {
     }
 
     size_t emitter::movs(int bits, const rm& dest, const rm& src) {
+        if (bits == 128)
+            return movdqu(dest, src);
+        if (bits == 256)
+            return movdqu(widen(dest), widen(src));
+
         FTL_ERROR_ON(bits < 32, "unsupported floating point width: %d", bits);
         FTL_ERROR_ON(bits > 64, "unsupported floating point width: %d", bits);
         FTL_ERROR_ON(dest.is_reg(), "destination cannot be integer register");
@@ -1216,20 +1913,15 @@ namespace ftl {
         if (dest.is_mem && src.is_mem)
             FTL_ERROR("destination and source cannot both be in memory");
 
-        size_t len = 0;
         int pfx = bits == 32 ? PREFIX_SINGLE : PREFIX_DOUBLE;
         int op = dest.is_mem ? OPCODE2_MOVSS + 1 : OPCODE2_MOVSS;
 
         rm oprm(dest.is_mem ? dest : src); // operand used for modrm.rm
         rm op_r(dest.is_mem ? src : dest); // operand used for modrm.reg
 
-        len += m_buffer.write<u8>(pfx);
-        len += prefix(32, op_r.r, oprm);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(op);
-        len += modrm(op_r.r, oprm);
-
-        return len;
+        // register moves merge into the destination, memory forms do not
+        int merge = oprm.is_mem ? NXMM : dest.r;
+        return xmmop(pfx, op, false, false, op_r.r, merge, oprm);
     }
 
     size_t emitter::movx(int bits, const rm& dest, const rm& src) {
@@ -1241,40 +1933,65 @@ namespace ftl {
         const rm& xmm_op = dest.is_xmm ? dest : src;
         const rm& int_op = dest.is_xmm ? src : dest;
 
-        size_t len = 0;
-        len += m_buffer.write<u8>(PREFIX_16BIT);
-        len += prefix(bits, xmm_op.r, int_op);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(dest.is_xmm ? OPCODE2_MOVX1 : OPCODE2_MOVX2);
-        len += modrm(xmm_op.r, int_op);
-
-        return len;
+        int op = dest.is_xmm ? OPCODE2_MOVX1 : OPCODE2_MOVX2;
+        return xmmop(PREFIX_16BIT, op, bits == 64, false, xmm_op.r, NXMM,
+                     int_op);
     }
 
     size_t emitter::adds(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_ADDSS, bits, dest, src);
     }
 
+    size_t emitter::adds(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_ADDSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::subs(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_SUBSS, bits, dest, src);
     }
 
+    size_t emitter::subs(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_SUBSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::muls(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_MULSS, bits, dest, src);
     }
 
+    size_t emitter::muls(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_MULSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::divs(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_DIVSS, bits, dest, src);
     }
 
+    size_t emitter::divs(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_DIVSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::mins(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_MINSS, bits, dest, src);
     }
 
+    size_t emitter::mins(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_MINSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::maxs(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_MAXSS, bits, dest, src);
     }
 
+    size_t emitter::maxs(int bits, const rm& dest, const rm& src1,
+                         const rm& src2) {
+        return mmxop(OPCODE2_MAXSS, bits, dest, src1, src2);
+    }
+
     size_t emitter::sqrt(int bits, const rm& dest, const rm& src) {
         return mmxop(OPCODE2_SQRTSS, bits, dest, src);
     }
@@ -1283,15 +2000,7 @@ namespace ftl {
         FTL_ERROR_ON(!dest.is_xmm, "destination must be a FP-register");
         (void)bits;
 
-        size_t len = 0;
-
-        len += m_buffer.write<u8>(PREFIX_16BIT);
-        len += prefix(32, dest.r, src);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(OPCODE2_PXOR);
-        len += modrm(dest.r, src);
-
-        return len;
+        return intop(OPCODE2_PXOR, dest, src);
     }
 
     size_t emitter::comis(int bits, const rm& op1, const rm& op2) {
@@ -1317,16 +2026,8 @@ namespace ftl {
         FTL_ERROR_ON(dest.is_xmm, "destination must be an integer register");
         FTL_ERROR_ON(src.is_reg(), "source cannot be an integer register");
 
-        size_t len = 0;
         int pfx = (sbts == 32) ? PREFIX_SINGLE : PREFIX_DOUBLE;
-
-        len += m_buffer.write<u8>(pfx);
-        len += prefix(dbts, dest.r, src);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(OPCODE2_CVTS2I);
-        len += modrm(dest.r, src);
-
-        return len;
+        return xmmop(pfx, OPCODE2_CVTS2I, dbts == 64, false, dest.r, NXMM, src);
     }
 
     size_t emitter::cvti2s(int dbts, int sbts, const rm& dest, const rm& src) {
@@ -1337,16 +2038,9 @@ namespace ftl {
         FTL_ERROR_ON(!dest.is_xmm, "destination must be an xmm register");
         FTL_ERROR_ON(src.is_xmm, "source cannot be an xmm register");
 
-        size_t len = 0;
         int pfx = (dbts == 32) ? PREFIX_SINGLE : PREFIX_DOUBLE;
-
-        len += m_buffer.write<u8>(pfx);
-        len += prefix(sbts, dest.r, src);
-        len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(OPCODE2_CVTI2S);
-        len += modrm(dest.r, src);
-
-        return len;
+        return xmmop(pfx, OPCODE2_CVTI2S, sbts == 64, false, dest.r, dest.r,
+                     src);
     }
 
     size_t emitter::cvtts2i(int dbts, int sbts, const rm& dest, const rm& src) {
@@ -1358,16 +2052,392 @@ namespace ftl {
         FTL_ERROR_ON(dest.is_xmm, "destination must be an integer register");
         FTL_ERROR_ON(src.is_reg(), "source cannot be an integer register");
 
-        size_t len = 0;
         int pfx = (sbts == 32) ? PREFIX_SINGLE : PREFIX_DOUBLE;
+        return xmmop(pfx, OPCODE2_CVTTS2I, dbts == 64, false, dest.r, NXMM, src);
+    }
+
+    size_t emitter::movdqu(const rm& dest, const rm& src) {
+        FTL_ERROR_ON(dest.is_mem && src.is_mem,
+                     "destination and source cannot both be in memory");
+        if (dest.is_mem)
+            return sseunop(PREFIX_SINGLE, OPCODE2_MOVDQ + 0x10, src, dest);
+        return sseunop(PREFIX_SINGLE, OPCODE2_MOVDQ, dest, src);
+    }
+
+    size_t emitter::movdqa(const rm& dest, const rm& src) {
+        FTL_ERROR_ON(dest.is_mem && src.is_mem,
+                     "destination and source cannot both be in memory");
+        if (dest.is_mem)
+            return sseunop(PREFIX_16BIT, OPCODE2_MOVDQ + 0x10, src, dest);
+        return sseunop(PREFIX_16BIT, OPCODE2_MOVDQ, dest, src);
+    }
+
+    size_t emitter::padd(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PADD, bits), dest, src);
+    }
+
+    size_t emitter::psub(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PSUB, bits), dest, src);
+    }
+
+    size_t emitter::pmul(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PMUL, bits), dest, src);
+    }
+
+    size_t emitter::pand(const rm& dest, const rm& src) {
+        return intop(OPCODE2_PAND, dest, src);
+    }
+
+    size_t emitter::pandn(const rm& dest, const rm& src) {
+        return intop(OPCODE2_PANDN, dest, src);
+    }
+
+    size_t emitter::por(const rm& dest, const rm& src) {
+        return intop(OPCODE2_POR, dest, src);
+    }
+
+    size_t emitter::pcmpeq(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PCMPEQ, bits), dest, src);
+    }
+
+    size_t emitter::pcmpgt(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PCMPGT, bits), dest, src);
+    }
+
+    size_t emitter::pmins(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PMINS, bits), dest, src);
+    }
+
+    size_t emitter::pmaxs(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PMAXS, bits), dest, src);
+    }
+
+    size_t emitter::pminu(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PMINU, bits), dest, src);
+    }
+
+    size_t emitter::pmaxu(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PMAXU, bits), dest, src);
+    }
+
+    size_t emitter::psll(int bits, const rm& dest, u8 imm) {
+        FTL_ERROR_ON(bits < 16, "unsupported lane width: %d", bits);
+        int op = OPCODE2_PSHIFTW + log2i(bits / 16);
+        return pshift(op, OPCODE_PSHIFT_SLL, dest, imm);
+    }
+
+    size_t emitter::psrl(int bits, const rm& dest, u8 imm) {
+        FTL_ERROR_ON(bits < 16, "unsupported lane width: %d", bits);
+        int op = OPCODE2_PSHIFTW + log2i(bits / 16);
+        return pshift(op, OPCODE_PSHIFT_SRL, dest, imm);
+    }
+
+    size_t emitter::psra(int bits, const rm& dest, u8 imm) {
+        FTL_ERROR_ON(bits < 16 || bits > 32, "unsupported lane width: %d", bits);
+        int op = OPCODE2_PSHIFTW + log2i(bits / 16);
+        return pshift(op, OPCODE_PSHIFT_SRA, dest, imm);
+    }
+
+    size_t emitter::pshufd(const rm& dest, const rm& src, u8 imm) {
+        FTL_ERROR_ON(is_wide(dest, src) && !m_avx2,
+                     "256 bit integer operations require avx2");
+        size_t len = sseunop(PREFIX_16BIT, OPCODE2_PSHUFD, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
+
+    size_t emitter::pshufb(const rm& dest, const rm& src) {
+        return intop(OPCODE3_PSHUFB, dest, src);
+    }
+
+    size_t emitter::punpckl(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PUNPCKL, bits), dest, src);
+    }
+
+    size_t emitter::punpckh(int bits, const rm& dest, const rm& src) {
+        return intop(lane_op(OPS_PUNPCKH, bits), dest, src);
+    }
 
-        len += m_buffer.write<u8>(pfx);
-        len += prefix(dbts, dest.r, src);
+    size_t emitter::pblend(int bits, const rm& dest, const rm& src, u8 imm) {
+        int op = 0;
+        switch (bits) {
+        case 16: op = OPCODE3_PBLENDW; break;
+        case 32: op = OPCODE3_BLENDPS; break;
+        case 64: op = OPCODE3_BLENDPD; break;
+        default:
+            FTL_ERROR("unsupported lane width: %d", bits);
+        }
+
+        size_t len = bits == 16 ? intop(op, dest, src, 1)
+                                : sseop(PREFIX_16BIT, op, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
+
+    size_t emitter::pblendv(int bits, const rm& dest, const rm& src) {
+        int op = 0;
+        switch (bits) {
+        case  8: op = OPCODE3_BLENDVB; break;
+        case 32: op = OPCODE3_BLENDVS; break;
+        case 64: op = OPCODE3_BLENDVD; break;
+        default:
+            FTL_ERROR("unsupported lane width: %d", bits);
+        }
+
+        // the selection mask is implicitly taken from xmm0; the vex forms
+        // name it explicitly in the upper half of a trailing immediate
+        if (!m_avx)
+            return sseop(PREFIX_16BIT, op, dest, src);
+
+        switch (bits) {
+        case  8: op = OPCODE3_VBLENDVB; break;
+        case 32: op = OPCODE3_VBLENDVS; break;
+        case 64: op = OPCODE3_VBLENDVD; break;
+        }
+
+        size_t len = bits == 8 ? intop(op, dest, src, 1)
+                               : sseop(PREFIX_16BIT, op, dest, src, 1);
+        len += m_buffer.write<u8>(XMM0 << 4);
+        return len;
+    }
+
+    static int packed_prefix(int bits) {
+        FTL_ERROR_ON(bits != 32 && bits != 64, "unsupported lane width: %d",
+                     bits);
+        return bits == 64 ? PREFIX_16BIT : 0;
+    }
+
+    size_t emitter::addp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_ADDSS, dest, src);
+    }
+
+    size_t emitter::subp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_SUBSS, dest, src);
+    }
+
+    size_t emitter::mulp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_MULSS, dest, src);
+    }
+
+    size_t emitter::divp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_DIVSS, dest, src);
+    }
+
+    size_t emitter::minp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_MINSS, dest, src);
+    }
+
+    size_t emitter::maxp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_MAXSS, dest, src);
+    }
+
+    size_t emitter::sqrtp(int bits, const rm& dest, const rm& src) {
+        return sseunop(packed_prefix(bits), OPCODE2_SQRTSS, dest, src);
+    }
+
+    size_t emitter::andp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_ANDPS, dest, src);
+    }
+
+    size_t emitter::andnp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_ANDNPS, dest, src);
+    }
+
+    size_t emitter::orp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_ORPS, dest, src);
+    }
+
+    size_t emitter::xorp(int bits, const rm& dest, const rm& src) {
+        return sseop(packed_prefix(bits), OPCODE2_XORPS, dest, src);
+    }
+
+    size_t emitter::cmpp(int bits, const rm& dest, const rm& src, u8 pred) {
+        FTL_ERROR_ON(pred > 7, "invalid compare predicate: %d", (int)pred);
+        size_t len = sseop(packed_prefix(bits), OPCODE2_CMPPS, dest, src, 1);
+        len += m_buffer.write<u8>(pred);
+        return len;
+    }
+
+    size_t emitter::shufp(int bits, const rm& dest, const rm& src, u8 imm) {
+        size_t len = sseop(packed_prefix(bits), OPCODE2_SHUFPS, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
+
+    size_t emitter::vzeroupper() {
+        FTL_ERROR_ON(!m_avx, "vzeroupper requires avx");
+        size_t len = vex(0, OPCODE2_VZEROUPPER, false, false, 0, NXMM, XMM0);
+        len += m_buffer.write<u8>(OPCODE2_VZEROUPPER);
+        return len;
+    }
+
+    size_t emitter::shlx(int bits, reg dest, const rm& src, reg count) {
+        return bmiop(PREFIX_16BIT, OPCODE3_SHX, bits, dest, count, src);
+    }
+
+    size_t emitter::shrx(int bits, reg dest, const rm& src, reg count) {
+        return bmiop(PREFIX_DOUBLE, OPCODE3_SHX, bits, dest, count, src);
+    }
+
+    size_t emitter::sarx(int bits, reg dest, const rm& src, reg count) {
+        return bmiop(PREFIX_SINGLE, OPCODE3_SHX, bits, dest, count, src);
+    }
+
+    size_t emitter::rorx(int bits, reg dest, const rm& src, u8 imm) {
+        FTL_ERROR_ON(imm >= bits, "cannot rotate by %d", (int)imm);
+        size_t len = bmiop(PREFIX_DOUBLE, OPCODE3_RORX, bits, dest, NREGS, src,
+                           1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
+
+    size_t emitter::andn(int bits, reg dest, reg src1, const rm& src2) {
+        return bmiop(0, OPCODE3_ANDN, bits, dest, src1, src2);
+    }
+
+    size_t emitter::bzhi(int bits, reg dest, const rm& src, reg index) {
+        return bmiop(0, OPCODE3_BZHI, bits, dest, index, src);
+    }
+
+    size_t emitter::pdep(int bits, reg dest, reg src, const rm& mask) {
+        return bmiop(PREFIX_DOUBLE, OPCODE3_BZHI, bits, dest, src, mask);
+    }
+
+    size_t emitter::pext(int bits, reg dest, reg src, const rm& mask) {
+        return bmiop(PREFIX_SINGLE, OPCODE3_BZHI, bits, dest, src, mask);
+    }
+
+    size_t emitter::blsr(int bits, reg dest, const rm& src) {
+        return bmiop(0, OPCODE3_BLS, bits, OPCODE_BLS_BLSR, dest, src);
+    }
+
+    size_t emitter::blsi(int bits, reg dest, const rm& src) {
+        return bmiop(0, OPCODE3_BLS, bits, OPCODE_BLS_BLSI, dest, src);
+    }
+
+    size_t emitter::mulx(int bits, reg hi, reg lo, const rm& src) {
+        FTL_ERROR_ON(hi == lo, "mulx outputs must be distinct registers");
+        return bmiop(PREFIX_DOUBLE, OPCODE3_MULX, bits, hi, lo, src);
+    }
+
+    size_t emitter::popcnt(int bits, reg dest, const rm& src) {
+        return escop(PREFIX_SINGLE, OPCODE2_POPCNT, bits, dest, src);
+    }
+
+    size_t emitter::lzcnt(int bits, reg dest, const rm& src) {
+        return escop(PREFIX_SINGLE, OPCODE2_BSR, bits, dest, src);
+    }
+
+    size_t emitter::tzcnt(int bits, reg dest, const rm& src) {
+        return escop(PREFIX_SINGLE, OPCODE2_BSF, bits, dest, src);
+    }
+
+    size_t emitter::bsf(int bits, reg dest, const rm& src) {
+        return escop(0, OPCODE2_BSF, bits, dest, src);
+    }
+
+    size_t emitter::bsr(int bits, reg dest, const rm& src) {
+        return escop(0, OPCODE2_BSR, bits, dest, src);
+    }
+
+    size_t emitter::bswap(int bits, reg r) {
+        FTL_ERROR_ON(bits != 32 && bits != 64, "unsupported width: %d", bits);
+
+        size_t len = 0;
+        if (bits == 64 || r >= R8)
+            len += rex(bits == 64, false, false, r >= R8);
         len += m_buffer.write<u8>(OPCODE_ESCAPE);
-        len += m_buffer.write<u8>(OPCODE2_CVTTS2I);
-        len += modrm(dest.r, src);
+        len += m_buffer.write<u8>(OPCODE2_BSWAP + (r & 7));
+
+        return len;
+    }
+
+    size_t emitter::movbe(int bits, const rm& dest, const rm& src) {
+        FTL_ERROR_ON(dest.is_mem == src.is_mem,
+                     "movbe requires one register and one memory operand");
+
+        if (src.is_mem)
+            return escop(0, OPCODE3_MOVBE, bits, dest.r, src);
+        return escop(0, OPCODE3_MOVBE + 1, bits, src.r, dest);
+    }
+
+    size_t emitter::crc32(int bits, reg dest, const rm& src) {
+        FTL_ERROR_ON(src.is_xmm, "operand cannot be an xmm register");
+
+        // the operand size prefix has to come before the mandatory f2
+        size_t len = 0;
+        if (bits == 16)
+            len += m_buffer.write<u8>(PREFIX_16BIT);
+        len += m_buffer.write<u8>(PREFIX_DOUBLE);
+        len += prefix(bits == 64 ? 64 : 32, bits, dest, src);
+        len += m_buffer.write<u8>(OPCODE_ESCAPE);
+        len += m_buffer.write<u8>(OPCODE3_CRC32 >> 8);
+        len += m_buffer.write<u8>(bits == 8 ? OPCODE3_CRC32 & 0xff
+                                            : (OPCODE3_CRC32 & 0xff) + 1);
+        len += modrm(dest, src);
+        return len;
+    }
+
+    size_t emitter::aesenc(const rm& dest, const rm& src) {
+        return cryptop(OPCODE3_AESENC, dest, src);
+    }
+
+    size_t emitter::aesenclast(const rm& dest, const rm& src) {
+        return cryptop(OPCODE3_AESENCLAST, dest, src);
+    }
+
+    size_t emitter::aesdec(const rm& dest, const rm& src) {
+        return cryptop(OPCODE3_AESDEC, dest, src);
+    }
+
+    size_t emitter::aesdeclast(const rm& dest, const rm& src) {
+        return cryptop(OPCODE3_AESDECLAST, dest, src);
+    }
+
+    size_t emitter::aesimc(const rm& dest, const rm& src) {
+        return cryptop(OPCODE3_AESIMC, dest, src);
+    }
+
+    size_t emitter::aeskeygenassist(const rm& dest, const rm& src, u8 imm) {
+        size_t len = cryptop(OPCODE3_AESKEYGEN, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
 
+    size_t emitter::pclmulqdq(const rm& dest, const rm& src, u8 imm) {
+        size_t len = cryptop(OPCODE3_PCLMULQDQ, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
         return len;
     }
 
+    size_t emitter::sha1rnds4(const rm& dest, const rm& src, u8 imm) {
+        size_t len = shaop(OPCODE3_SHA1RNDS4, dest, src, 1);
+        len += m_buffer.write<u8>(imm);
+        return len;
+    }
+
+    size_t emitter::sha1nexte(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA1NEXTE, dest, src);
+    }
+
+    size_t emitter::sha1msg1(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA1MSG1, dest, src);
+    }
+
+    size_t emitter::sha1msg2(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA1MSG2, dest, src);
+    }
+
+    size_t emitter::sha256rnds2(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA256RNDS, dest, src);
+    }
+
+    size_t emitter::sha256msg1(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA256MSG1, dest, src);
+    }
+
+    size_t emitter::sha256msg2(const rm& dest, const rm& src) {
+        return shaop(OPCODE3_SHA256MSG2, dest, src);
+    }
+
 }
@@ -17,16 +17,107 @@
  ******************************************************************************/
 
 #include "ftl/func.h"
+#include "ftl/cpuinfo.h"
 
 namespace ftl {
 
+    // bmi instructions only exist for 32 and 64 bit operands
+    static bool use_bmi1(int bits) {
+        return bits >= 32 && cpuinfo::get().bmi1;
+    }
+
+    static bool use_bmi2(int bits) {
+        return bits >= 32 && cpuinfo::get().bmi2;
+    }
+
+    // bit counting and movbe also work on 16 bit operands
+    static bool use_popcnt(int bits) {
+        return bits >= 16 && cpuinfo::get().popcnt;
+    }
+
+    static bool use_lzcnt(int bits) {
+        return bits >= 16 && cpuinfo::get().lzcnt;
+    }
+
+    static bool use_tzcnt(int bits) {
+        return bits >= 16 && cpuinfo::get().bmi1;
+    }
+
+    static bool use_movbe(int bits) {
+        return bits >= 16 && cpuinfo::get().movbe;
+    }
+
+    static bool use_crc32() {
+        return cpuinfo::get().sse42;
+    }
+
+    // the crypto extensions and the sse4.1 vector ops come without fallbacks,
+    // frontends are expected to check cpuinfo and use something else on
+    // older hosts
+    static void require(bool feature, const char* name) {
+        FTL_ERROR_ON(!feature, "%s not supported by target cpu", name);
+    }
+
+    // fallbacks for pdep and pext, visiting the mask bits from low to high
+    static u64 helper_pdep(void* bptr, u64 src, u64 mask) {
+        u64 res = 0;
+        for (; mask != 0; mask &= mask - 1, src >>= 1)
+            if (src & 1)
+                res |= mask & -mask;
+        (void)bptr;
+        return res;
+    }
+
+    static u64 helper_pext(void* bptr, u64 src, u64 mask) {
+        u64 res = 0;
+        for (u64 bit = 1; mask != 0; mask &= mask - 1, bit <<= 1)
+            if (src & mask & -mask)
+                res |= bit;
+        (void)bptr;
+        return res;
+    }
+
+    // bitwise crc-32c with the reflected polynomial, consuming the low
+    // sizeof(T) bytes of data like the crc32 instruction
+    template <typename T>
+    static u64 helper_crc32(void* bptr, u64 crc, u64 data) {
+        u32 res = crc;
+        for (size_t i = 0; i < sizeof(T) * 8; i++, data >>= 1)
+            res = (res >> 1) ^ (((res ^ data) & 1) ? 0x82f63b78 : 0);
+        (void)bptr;
+        return res;
+    }
+
+    // everything the out-of-line slow path of a tlb access needs to know
+    // about the register state at the probe
+    struct func::tlb_miss {
+        label entry;
+        label resume;
+        reg   addr;
+        reg   val;
+        int   bits;
+        bool  store;
+        u64   handler;
+        bool  ymm;
+        vector<reg> regs;
+        vector<xmm> xmms;
+
+        tlb_miss(func& fn):
+            entry(fn.gen_label("tlb.miss")),
+            resume(fn.gen_label("tlb.resume")),
+            addr(NREGS), val(NREGS), bits(0), store(false), handler(0),
+            ymm(false), regs(), xmms() {
+        }
+    };
+
     void func::gen_prologue_epilogue() {
         for (reg r : callee_saved_regs)
             m_emitter.push(r);
 
-        i32 frame_size = 64 * sizeof(u64);
-
-        m_emitter.subi(64, STACK_POINTER, frame_size);
+        // the frame size is passed by invoke and stored in the first slot of
+        // the frame, so that functions can size their frames individually
+        m_emitter.subr(64, STACK_POINTER, argreg(2));
+        m_emitter.movr(64, memop(STACK_POINTER, 0), argreg(2));
         m_emitter.movr(64, BASE_POINTER, argreg(1));
         m_emitter.jmpr(argreg(0));
         m_buffer.align(4);
@@ -34,7 +125,7 @@ namespace ftl {
         m_buffer.mark_exit();
         m_exit.place(false);
 
-        m_emitter.addi(64, STACK_POINTER, frame_size);
+        m_emitter.addr(64, STACK_POINTER, memop(STACK_POINTER, 0));
         for (size_t i = FTL_ARRAY_SIZE(callee_saved_regs); i != 0; i--)
             m_emitter.pop(callee_saved_regs[i-1]);
 
@@ -53,8 +144,13 @@ namespace ftl {
         m_head(m_buffer.get_code_entry()),
         m_code(m_buffer.get_code_ptr()),
         m_last(nullptr),
+        m_frame(0),
+        m_nt_stores(false),
         m_entry(nm + ".entry", m_buffer, m_alloc, m_buffer.get_code_entry()),
-        m_exit(nm + ".exit", m_buffer, m_alloc, m_buffer.get_code_exit()) {
+        m_exit(nm + ".exit", m_buffer, m_alloc, m_buffer.get_code_exit()),
+        m_ret(nm + ".ret", m_buffer, m_alloc),
+        m_nt_point(nullptr),
+        m_tlb_misses() {
         if (m_buffer.is_empty())
             gen_prologue_epilogue();
     }
@@ -68,8 +164,13 @@ namespace ftl {
         m_head(m_buffer.get_code_entry()),
         m_code(m_buffer.get_code_ptr()),
         m_last(nullptr),
+        m_frame(0),
+        m_nt_stores(false),
         m_entry(nm + ".entry", m_buffer, m_alloc, m_buffer.get_code_entry()),
-        m_exit(nm + ".exit", m_buffer, m_alloc, m_buffer.get_code_exit()) {
+        m_exit(nm + ".exit", m_buffer, m_alloc, m_buffer.get_code_exit()),
+        m_ret(nm + ".ret", m_buffer, m_alloc),
+        m_nt_point(nullptr),
+        m_tlb_misses() {
         if (m_buffer.is_empty())
             gen_prologue_epilogue();
         if (dataptr != nullptr)
@@ -85,12 +186,28 @@ namespace ftl {
         m_head(other.m_head),
         m_code(other.m_code),
         m_last(other.m_last),
+        m_frame(other.m_frame),
+        m_nt_stores(other.m_nt_stores),
         m_entry(std::move(other.m_entry)),
-        m_exit(std::move(other.m_exit)) {
+        m_exit(std::move(other.m_exit)),
+        m_ret(std::move(other.m_ret)),
+        m_nt_point(other.m_nt_point),
+        m_tlb_misses(std::move(other.m_tlb_misses)) {
         other.m_bufptr = nullptr;
+        other.m_nt_point = nullptr;
+        other.m_tlb_misses.clear();
     }
 
     func::~func() {
+        // returns of unfinished functions still need a target
+        if (!m_ret.is_placed())
+            m_ret.place(m_exit.get_address(), false);
+
+        // pending slow paths hold labels that are tracked by the buffer
+        for (tlb_miss* miss : m_tlb_misses)
+            delete miss;
+        if (m_nt_point)
+            delete m_nt_point;
         if (m_bufptr)
             delete m_bufptr;
     }
@@ -101,7 +218,7 @@ namespace ftl {
 
     i64 func::exec(void* data) {
         FTL_ERROR_ON(!is_finished(), "function '%s' not finished", name());
-        return invoke(m_buffer, m_code, data);
+        return invoke(m_buffer, m_code, data, m_frame);
     }
 
     void func::set_data_ptr(void* ptr) {
@@ -124,171 +241,196 @@ namespace ftl {
     }
 
     void func::gen_ret() {
+        m_alloc.discard_local_regs();
         m_alloc.flush_all_regs();
-        gen_jmp(m_exit, true);
+        m_alloc.store_pinned_regs();
+        if (m_emitter.is_ymm_used())
+            m_emitter.vzeroupper();
+
+        // non-temporal stores emitted later can still reach this return
+        // through a loop, so all returns share the fence placed by finish
+        gen_jmp(m_ret);
     }
 
     void func::gen_ret(i64 val) {
+        m_alloc.discard_local_regs();
         m_alloc.flush_all_regs();
         m_emitter.movi(64, RAX, val);
         gen_ret();
     }
 
     void func::gen_ret(value& val) {
+        // rax may hold a dirty value, e.g. the comparand of a cmpxchg
+        if (val.r() != RAX)
+            m_alloc.flush(RAX);
+
         m_emitter.movsx(64, val.bits, RAX, val);
+        m_alloc.discard_local_regs();
         m_alloc.flush_all_regs();
         gen_ret();
     }
 
+    i32 func::branch_offset(const label& l, bool far) const {
+        // only selects the encoding, the label patches in the actual offset;
+        // short forward branches get relaxed when their target is placed
+        if (far)
+            return 128;
+        if (!l.is_placed())
+            return 0;
+
+        ptrdiff_t offset = l.get_address() - m_buffer.get_code_ptr() - 2;
+        return fits_i8(offset) ? 0 : 128;
+    }
+
     void func::gen_jmp(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jmpi(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jmpi(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jo(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jo(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jo(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jno(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jno(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jno(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jb(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jb(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jb(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jae(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jae(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jae(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jz(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jz(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jz(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jnz(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jnz(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jnz(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_je(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.je(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.je(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jne(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jne(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jne(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jbe(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jbe(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jbe(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_ja(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.ja(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.ja(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_js(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.js(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.js(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jns(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jns(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jns(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jp(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jp(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jp(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jnp(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jnp(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jnp(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jl(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jl(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jl(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jge(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jge(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jge(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jle(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jle(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jle(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
     void func::gen_jg(label& l, bool far) {
         fixup fix;
-        i32 offset = far ? 128 : 0;
         m_alloc.flush_all_regs();
-        m_emitter.jg(offset, &fix);
+        fence_nt_loop(l);
+        m_emitter.jg(branch_offset(l, far), &fix);
         l.add(fix);
     }
 
@@ -729,6 +871,625 @@ namespace ftl {
         m_emitter.tstr(dest.bits, dest, src);
     }
 
+    reg func::lock_reg(value& val, vector<reg>& locked) {
+        reg r = val.fetch();
+        if (!m_alloc.is_blocked(r)) {
+            m_alloc.block(r);
+            locked.push_back(r);
+        }
+
+        return r;
+    }
+
+    rm func::lock_address(value& base, value* index, int scale, i32 offset,
+                          vector<reg>& locked) {
+        // keep base and index in their registers while the other operands
+        // are brought in, otherwise the allocator might pick them for reuse
+        reg rb = lock_reg(base, locked);
+        if (index == nullptr)
+            return memop(rb, offset);
+
+        reg ri = lock_reg(*index, locked);
+        return memop(rb, ri, scale, offset);
+    }
+
+    void func::unlock_regs(const vector<reg>& locked) {
+        for (reg r : locked)
+            m_alloc.unblock(r);
+    }
+
+    void func::swap_reg(int bits, reg r) {
+        switch (bits) {
+        case  8: break;
+        case 16: m_emitter.roli(16, r, 8); break;
+        default: m_emitter.bswap(bits, r); break;
+        }
+    }
+
+    void func::gen_memop(value& val, value& base, value* index, int scale,
+                         i32 offset, bool load, bool swap) {
+        vector<reg> locked;
+        rm mem = lock_address(base, index, scale, offset, locked);
+
+        if (!load)
+            val.fetch();
+        else if (val.is_mem())
+            val.assign();
+
+        unlock_regs(locked);
+
+        if (swap && use_movbe(val.bits)) {
+            if (load) {
+                m_emitter.movbe(val.bits, val, mem);
+                val.mark_dirty();
+            } else {
+                m_emitter.movbe(val.bits, mem, val);
+            }
+
+            return;
+        }
+
+        if (load) {
+            m_emitter.movr(val.bits, val, mem);
+            if (swap)
+                swap_reg(val.bits, val.r());
+            val.mark_dirty();
+        } else if (swap) {
+            // swap in place and back, so val stays clean
+            swap_reg(val.bits, val.r());
+            m_emitter.movr(val.bits, mem, val);
+            swap_reg(val.bits, val.r());
+        } else {
+            m_emitter.movr(val.bits, mem, val);
+        }
+    }
+
+    void func::gen_load(value& dest, value& base, i32 offset) {
+        gen_memop(dest, base, nullptr, 1, offset, true);
+    }
+
+    void func::gen_load(value& dest, value& base, value& index, int scale,
+                        i32 offset) {
+        gen_memop(dest, base, &index, scale, offset, true);
+    }
+
+    void func::gen_store(value& src, value& base, i32 offset) {
+        gen_memop(src, base, nullptr, 1, offset, false);
+    }
+
+    void func::gen_store(value& src, value& base, value& index, int scale,
+                         i32 offset) {
+        gen_memop(src, base, &index, scale, offset, false);
+    }
+
+    void func::gen_load_bswap(value& dest, value& base, i32 offset) {
+        gen_memop(dest, base, nullptr, 1, offset, true, true);
+    }
+
+    void func::gen_load_bswap(value& dest, value& base, value& index,
+                              int scale, i32 offset) {
+        gen_memop(dest, base, &index, scale, offset, true, true);
+    }
+
+    void func::gen_store_bswap(value& src, value& base, i32 offset) {
+        gen_memop(src, base, nullptr, 1, offset, false, true);
+    }
+
+    void func::gen_store_bswap(value& src, value& base, value& index,
+                               int scale, i32 offset) {
+        gen_memop(src, base, &index, scale, offset, false, true);
+    }
+
+    void func::gen_memop_nt(value& val, value& base, value* index, int scale,
+                            i32 offset) {
+        // movnti only exists for 32 and 64 bit operands
+        if (val.bits < 32) {
+            gen_memop(val, base, index, scale, offset, false);
+            return;
+        }
+
+        vector<reg> locked;
+        rm mem = lock_address(base, index, scale, offset, locked);
+        val.fetch();
+        unlock_regs(locked);
+
+        m_emitter.movnti(val.bits, mem, val);
+        m_nt_stores = true;
+    }
+
+    void func::gen_store_nt(value& src, value& base, i32 offset) {
+        gen_memop_nt(src, base, nullptr, 1, offset);
+    }
+
+    void func::gen_store_nt(value& src, value& base, value& index, int scale,
+                            i32 offset) {
+        gen_memop_nt(src, base, &index, scale, offset);
+    }
+
+    void func::gen_prefetch(value& base, value* index, int scale, i32 offset,
+                            int hint) {
+        vector<reg> locked;
+        rm mem = lock_address(base, index, scale, offset, locked);
+        unlock_regs(locked);
+
+        switch (hint) {
+        case PREFETCH_T0:    m_emitter.prefetcht0(mem); break;
+        case PREFETCH_T1:    m_emitter.prefetcht1(mem); break;
+        case PREFETCH_T2:    m_emitter.prefetcht2(mem); break;
+        case PREFETCH_NTA:   m_emitter.prefetchnta(mem); break;
+        case PREFETCH_WRITE: m_emitter.prefetchw(mem); break;
+        default: FTL_ERROR("invalid prefetch hint: %d", hint);
+        }
+    }
+
+    void func::gen_prefetch(value& base, i32 offset, int hint) {
+        gen_prefetch(base, nullptr, 1, offset, hint);
+    }
+
+    void func::gen_prefetch(value& base, value& index, int scale, i32 offset,
+                            int hint) {
+        gen_prefetch(base, &index, scale, offset, hint);
+    }
+
+    void func::flush_nt_stores() {
+        // a fence only covers the code path it is on, so once there are
+        // non-temporal stores in the function every later exit fences again;
+        // earlier exits are remembered in case a loop leads back to them
+        if (m_nt_stores) {
+            gen_fence(false, true);
+            return;
+        }
+
+        if (m_nt_point)
+            delete m_nt_point;
+        m_nt_point = new label(m_name + ".nt", m_buffer, m_alloc,
+                               m_buffer.get_code_ptr());
+    }
+
+    void func::fence_nt_loop(const label& l) {
+        // a backward branch closes a loop; if that loop contains an exit that
+        // was emitted before the first non-temporal store, fence before the
+        // branch leads back to it
+        if (!m_nt_stores || !m_nt_point || !l.is_placed())
+            return;
+        if (m_nt_point->get_address() >= l.get_address())
+            m_emitter.sfence();
+    }
+
+    void func::gen_ret_fence() {
+        if (m_ret.is_placed())
+            return;
+
+        if (!m_nt_stores) {
+            m_ret.place(m_exit.get_address(), false);
+            return;
+        }
+
+        fixup fix;
+        m_ret.place(false);
+        m_emitter.sfence();
+        m_emitter.jmpi(branch_offset(m_exit, false), &fix);
+        m_exit.add(fix);
+    }
+
+    void func::gen_tlb_access(value& val, value& addr, const tlb_layout& tlb,
+                              u64 handler, bool store) {
+        FTL_ERROR_ON(!is_pow2(tlb.entries), "tlb entries must be power of 2");
+        FTL_ERROR_ON(!is_pow2(tlb.entry_size), "tlb entry size not power of 2");
+        FTL_ERROR_ON(addr.bits != 64, "guest address must be 64 bits wide");
+
+        // a single shift and mask turn the address into the entry offset
+        int esz = log2i(tlb.entry_size);
+        u64 mask = (tlb.entries - 1) << esz;
+        FTL_ERROR_ON(tlb.page_bits < (size_t)esz || tlb.page_bits > 31,
+                     "unsupported tlb page size: %zu", tlb.page_bits);
+        FTL_ERROR_ON(!fits_i32(mask), "too many tlb entries: %zu", tlb.entries);
+
+        vector<reg> locked;
+        reg ra = lock_reg(addr, locked);
+        reg rv = NREGS;
+        if (store)
+            rv = lock_reg(val, locked);
+
+        value ent = gen_scratch_i64("tlb.entry");
+        reg re = lock_reg(ent, locked);
+        value tmp = gen_scratch_i64("tlb.tmp");
+        reg rt = lock_reg(tmp, locked);
+
+        if (!store) {
+            rv = val == addr ? ra : val.assign();
+            if (!m_alloc.is_blocked(rv)) {
+                m_alloc.block(rv);
+                locked.push_back(rv);
+            }
+        }
+
+        tlb_miss* miss = new tlb_miss(*this);
+        m_tlb_misses.push_back(miss);
+        miss->addr = ra;
+        miss->val = rv;
+        miss->bits = val.bits;
+        miss->store = store;
+        miss->handler = handler;
+        miss->ymm = m_emitter.is_ymm_used();
+
+        // everything that is live at the probe has to survive the handler,
+        // only the scratch registers and the load destination are dead
+        for (reg r : caller_saved_regs) {
+            if (m_alloc.is_empty(r) && !m_alloc.is_blocked(r))
+                continue;
+            if (r == re || r == rt || (!store && r == rv))
+                continue;
+            miss->regs.push_back(r);
+        }
+
+        for (xmm r : caller_saved_xmms) {
+            if (!m_alloc.is_empty(r) || m_alloc.is_blocked(r))
+                miss->xmms.push_back(r);
+        }
+
+        m_emitter.movr(64, re, ra);
+        m_emitter.shri(64, re, tlb.page_bits - esz);
+        m_emitter.andi(64, re, mask);
+
+        // the table is addressed from the data pointer if it is close enough
+        reg tb = BASE_POINTER;
+        i64 off = tlb.base - m_alloc.get_base_addr();
+        if (m_alloc.get_base_addr() == 0 ||
+            !fits_i32(off) || !fits_i32(off + (i64)(mask + tlb.entry_size))) {
+            m_emitter.movi(64, rt, tlb.base);
+            m_emitter.addr(64, re, rt);
+            tb = re;
+            off = 0;
+        }
+
+        auto field = [&](i32 offset) -> rm {
+            if (tb == re)
+                return memop(re, offset);
+            return memop(tb, re, 1, off + offset);
+        };
+
+        // accesses that cross into the next page compare that page against
+        // the tag and miss
+        size_t size = val.bits / 8;
+        if (size > 1)
+            m_emitter.lear(64, rt, memop(ra, size - 1));
+        else
+            m_emitter.movr(64, rt, ra);
+        m_emitter.andi(64, rt, -(1ll << tlb.page_bits));
+        m_emitter.cmpr(64, rt, field(store ? tlb.tag_write : tlb.tag_read));
+
+        fixup fix;
+        m_emitter.jne(branch_offset(miss->entry, true), &fix);
+        miss->entry.add(fix);
+
+        m_emitter.movr(64, rt, ra);
+        m_emitter.addr(64, rt, field(tlb.addend));
+        if (store)
+            m_emitter.movr(val.bits, memop(rt, 0), rv);
+        else
+            m_emitter.movr(val.bits, rv, memop(rt, 0));
+
+        miss->resume.place(false);
+        unlock_regs(locked);
+
+        if (!store)
+            val.mark_dirty();
+    }
+
+    void func::gen_tlb_load(value& dest, value& addr, const tlb_layout& tlb,
+                            tlb_load_fn handler) {
+        gen_tlb_access(dest, addr, tlb, (u64)handler, false);
+    }
+
+    void func::gen_tlb_store(value& src, value& addr, const tlb_layout& tlb,
+                             tlb_store_fn handler) {
+        gen_tlb_access(src, addr, tlb, (u64)handler, true);
+    }
+
+    void func::gen_tlb_misses() {
+        for (tlb_miss* miss : m_tlb_misses) {
+            miss->entry.place(false);
+
+            // keep the stack aligned for the call
+            size_t xsize = miss->ymm ? 32 : 16;
+            size_t frame = miss->xmms.size() * xsize;
+            if (miss->regs.size() % 2)
+                frame += 8;
+
+            for (reg r : miss->regs)
+                m_emitter.push(r);
+            if (frame > 0)
+                m_emitter.subi(64, STACK_POINTER, frame);
+            for (size_t i = 0; i < miss->xmms.size(); i++) {
+                rm dest = memop(STACK_POINTER, i * xsize);
+                if (miss->ymm)
+                    m_emitter.movdqu(dest, to_ymm(miss->xmms[i]));
+                else
+                    m_emitter.movdqu(dest, miss->xmms[i]);
+            }
+
+            // the address and store value may sit in any argument register
+            if (miss->store)
+                m_emitter.push(miss->val);
+            m_emitter.movr(64, argreg(1), miss->addr);
+            if (miss->store) {
+                reg r = argreg(2);
+                m_emitter.pop(r);
+                switch (miss->bits) {
+                case  8: m_emitter.movzx(32, 8, r, r); break;
+                case 16: m_emitter.movzx(32, 16, r, r); break;
+                case 32: m_emitter.movr(32, r, r); break;
+                }
+            }
+
+            flush_nt_stores();
+            m_emitter.movi(64, argreg(miss->store ? 3 : 2), miss->bits / 8);
+            m_emitter.movr(64, argreg(0), BASE_POINTER);
+            if (miss->ymm)
+                m_emitter.vzeroupper();
+
+            u8* fn = (u8*)miss->handler;
+            if (can_call_directly(m_buffer.get_code_ptr(), fn)) {
+                m_emitter.call(fn);
+            } else {
+                m_emitter.movi(64, RAX, miss->handler);
+                m_emitter.call(RAX);
+            }
+
+            if (!miss->store)
+                m_emitter.movr(miss->bits, miss->val, RAX);
+
+            for (size_t i = 0; i < miss->xmms.size(); i++) {
+                rm src = memop(STACK_POINTER, i * xsize);
+                if (miss->ymm)
+                    m_emitter.movdqu(to_ymm(miss->xmms[i]), src);
+                else
+                    m_emitter.movdqu(miss->xmms[i], src);
+            }
+            if (frame > 0)
+                m_emitter.addi(64, STACK_POINTER, frame);
+            for (size_t i = miss->regs.size(); i != 0; i--)
+                m_emitter.pop(miss->regs[i - 1]);
+
+            fixup fix;
+            m_emitter.jmpi(branch_offset(miss->resume, false), &fix);
+            miss->resume.add(fix);
+
+            delete miss;
+        }
+
+        m_tlb_misses.clear();
+    }
+
+    // block operations of up to this many bytes with a size known at
+    // generation time are unrolled into sse or integer moves
+    static const size_t MEMOP_INLINE = 128;
+    static const u64 BYTE_PATTERN = 0x0101010101010101ull;
+
+    static bool use_erms() {
+        return cpuinfo::get().erms;
+    }
+
+    void func::gen_copy_const(value& dest, value& src, size_t size,
+                              bool move) {
+        vector<reg> locked;
+        reg rd = lock_reg(dest, locked);
+        reg rs = lock_reg(src, locked);
+
+        if (size < 16) {
+            // at most two overlapping integer moves, both loads go first to
+            // allow for overlapping source and destination
+            size_t w = 1ull << (63 - __builtin_clzll(size));
+            int bits = w * 8;
+            value a = gen_scratch_val("memcpy.a", bits);
+            m_emitter.movr(bits, a, memop(rs, 0));
+            lock_reg(a, locked);
+            if (size > w) {
+                value b = gen_scratch_val("memcpy.b", bits);
+                m_emitter.movr(bits, b, memop(rs, size - w));
+                m_emitter.movr(bits, memop(rd, size - w), b);
+            }
+
+            m_emitter.movr(bits, memop(rd, 0), a);
+        } else if (move) {
+            // only up to 32 bytes, loaded as a whole before storing
+            vec a = gen_scratch_vec("memcpy.a");
+            vec b = gen_scratch_vec("memcpy.b");
+            m_emitter.movdqu(a, memop(rs, 0));
+            m_emitter.movdqu(b, memop(rs, size - 16));
+            m_emitter.movdqu(memop(rd, 0), a);
+            m_emitter.movdqu(memop(rd, size - 16), b);
+        } else {
+            // a trailing partial block overlaps its predecessor
+            vec a = gen_scratch_vec("memcpy.a");
+            for (size_t off = 0; off < size; off += 16) {
+                i32 at = min(off, size - 16);
+                m_emitter.movdqu(a, memop(rs, at));
+                m_emitter.movdqu(memop(rd, at), a);
+            }
+        }
+
+        unlock_regs(locked);
+    }
+
+    void func::gen_fill_const(value& dest, value& pattern, size_t size) {
+        vector<reg> locked;
+        reg rd = lock_reg(dest, locked);
+        reg rp = lock_reg(pattern, locked);
+
+        if (size < 16) {
+            size_t w = 1ull << (63 - __builtin_clzll(size));
+            m_emitter.movr(w * 8, memop(rd, 0), rp);
+            if (size > w)
+                m_emitter.movr(w * 8, memop(rd, size - w), rp);
+        } else {
+            vec a = gen_scratch_vec("memset.a");
+            m_emitter.movx(64, a, rp);
+            m_emitter.punpckl(64, a, a);
+            for (size_t off = 0; off < size; off += 16)
+                m_emitter.movdqu(memop(rd, min(off, size - 16)), a);
+        }
+
+        unlock_regs(locked);
+    }
+
+    void func::gen_rep_movs() {
+        if (use_erms()) {
+            m_emitter.rep_movs(8);
+            return;
+        }
+
+        // without fast strings, bulk copy with 8 byte elements
+        value rem = gen_scratch_i64("memcpy.rem");
+        m_emitter.movr(64, rem, RCX);
+        m_emitter.andi(64, rem, 7);
+        m_emitter.shri(64, RCX, 3);
+        m_emitter.rep_movs(64);
+        m_emitter.movr(64, RCX, rem);
+        m_emitter.rep_movs(8);
+    }
+
+    void func::gen_movs(value& dest, value& src, value& size, bool move) {
+        value rdi = gen_scratch_i64("memcpy.rdi", RDI);
+        value rsi = gen_scratch_i64("memcpy.rsi", RSI);
+        value rcx = gen_scratch_i64("memcpy.rcx", RCX);
+        gen_mov(rdi, dest);
+        gen_mov(rsi, src);
+        gen_mov(rcx, size);
+
+        vector<reg> locked;
+        lock_reg(rdi, locked);
+        lock_reg(rsi, locked);
+        lock_reg(rcx, locked);
+
+        if (move) {
+            // copy backwards if the destination starts inside the source
+            label fwd = gen_label("memmove.fwd");
+            label done = gen_label("memmove.done");
+            value diff = gen_scratch_i64("memmove.diff");
+            m_emitter.movr(64, diff, RDI);
+            m_emitter.subr(64, diff, RSI);
+            m_emitter.cmpr(64, diff, RCX);
+
+            fixup fix;
+            m_emitter.jae(0, &fix);
+            fwd.add(fix);
+
+            m_emitter.lear(64, RSI, memop(RSI, RCX, 1, -1));
+            m_emitter.lear(64, RDI, memop(RDI, RCX, 1, -1));
+            m_emitter.std();
+            m_emitter.rep_movs(8);
+            m_emitter.cld();
+            m_emitter.jmpi(0, &fix);
+            done.add(fix);
+
+            fwd.place(false);
+            gen_rep_movs();
+            done.place(false);
+        } else {
+            gen_rep_movs();
+        }
+
+        unlock_regs(locked);
+    }
+
+    void func::gen_stos(value& dest, value& val, value& size) {
+        value rdi = gen_scratch_i64("memset.rdi", RDI);
+        value rax = gen_scratch_i64("memset.rax", RAX);
+        value rcx = gen_scratch_i64("memset.rcx", RCX);
+        gen_mov(rdi, dest);
+        gen_mov(rcx, size);
+        m_emitter.movzx(32, 8, RAX, val);
+
+        vector<reg> locked;
+        lock_reg(rdi, locked);
+        lock_reg(rax, locked);
+        lock_reg(rcx, locked);
+
+        if (use_erms()) {
+            m_emitter.rep_stos(8);
+        } else {
+            value tmp = gen_scratch_i64("memset.tmp", BYTE_PATTERN);
+            m_emitter.imulr(64, RAX, tmp);
+            m_emitter.movr(64, tmp, RCX);
+            m_emitter.andi(64, tmp, 7);
+            m_emitter.shri(64, RCX, 3);
+            m_emitter.rep_stos(64);
+            m_emitter.movr(64, RCX, tmp);
+            m_emitter.rep_stos(8);
+        }
+
+        unlock_regs(locked);
+    }
+
+    void func::gen_memcpy(value& dest, value& src, value& size) {
+        gen_movs(dest, src, size, false);
+    }
+
+    void func::gen_memcpy(value& dest, value& src, size_t size) {
+        if (size == 0)
+            return;
+
+        if (size <= MEMOP_INLINE) {
+            gen_copy_const(dest, src, size, false);
+        } else {
+            value n = gen_scratch_i64("memcpy.size", size);
+            gen_movs(dest, src, n, false);
+        }
+    }
+
+    void func::gen_memmove(value& dest, value& src, value& size) {
+        gen_movs(dest, src, size, true);
+    }
+
+    void func::gen_memmove(value& dest, value& src, size_t size) {
+        if (size == 0)
+            return;
+
+        if (size <= 32) {
+            gen_copy_const(dest, src, size, true);
+        } else {
+            value n = gen_scratch_i64("memmove.size", size);
+            gen_movs(dest, src, n, true);
+        }
+    }
+
+    void func::gen_memset(value& dest, value& val, value& size) {
+        gen_stos(dest, val, size);
+    }
+
+    void func::gen_memset(value& dest, value& val, size_t size) {
+        if (size == 0)
+            return;
+
+        if (size <= MEMOP_INLINE) {
+            value pattern = gen_scratch_i64("memset.pattern", BYTE_PATTERN);
+            value byte = gen_scratch_i64("memset.byte");
+            m_emitter.movzx(32, 8, byte, val);
+            m_emitter.imulr(64, byte.r(), pattern);
+            gen_fill_const(dest, byte, size);
+        } else {
+            value n = gen_scratch_i64("memset.size", size);
+            gen_stos(dest, val, n);
+        }
+    }
+
+    void func::gen_memset(value& dest, u8 val, size_t size) {
+        if (size == 0)
+            return;
+
+        if (size <= MEMOP_INLINE) {
+            value pattern = gen_scratch_i64("memset.pattern",
+                                            val * BYTE_PATTERN);
+            gen_fill_const(dest, pattern, size);
+        } else {
+            value byte = gen_scratch_i8("memset.byte", val);
+            value n = gen_scratch_i64("memset.size", size);
+            gen_stos(dest, byte, n);
+        }
+    }
+
     void func::gen_xchg(value& dest, value& src) {
         if (dest.is_mem())
             dest.fetch();
@@ -825,6 +1586,8 @@ namespace ftl {
 
         if (val == 0 && dest.is_reg())
             m_emitter.xorr(dest.bits, dest, dest);
+        else if (dest.is_reg())
+            m_alloc.load_const(dest.bits, dest.r(), val);
         else
             m_emitter.movi(dest.bits, dest, val);
 
@@ -969,6 +1732,29 @@ namespace ftl {
     }
 
     void func::gen_umul(value& hi, value& dest, const value& src) {
+        if (use_bmi2(dest.bits) && hi != dest && hi.bits == dest.bits &&
+            src.bits == dest.bits) {
+            // mulx only needs one factor in rdx, its outputs are free to
+            // choose and the flags remain untouched
+            m_alloc.fetch(&dest, RDX);
+
+            vector<reg> locked;
+            lock_reg(dest, locked);
+            reg rs = src.r();
+            if (reg_valid(rs) && !m_alloc.is_blocked(rs)) {
+                m_alloc.block(rs);
+                locked.push_back(rs);
+            }
+
+            reg rh = hi == src ? hi.fetch() : hi.assign();
+            unlock_regs(locked);
+
+            m_emitter.mulx(dest.bits, rh, RDX, src);
+            hi.mark_dirty();
+            dest.mark_dirty();
+            return;
+        }
+
         m_alloc.fetch(&dest, RAX);
         m_alloc.flush(RDX);
         m_emitter.mulr(dest.bits, src);
@@ -1033,14 +1819,7 @@ namespace ftl {
             return;
         }
 
-        if (is_pow2(val)) {
-            gen_shl(dest, log2i(val));
-            return;
-        }
-
-        value src = gen_local_val("temp_imul_imm", dest.bits, val);
-        gen_imul(dest, src);
-        m_alloc.free_value(src);
+        gen_mul_const(dest, val);
     }
 
     void func::gen_idiv(value& dest, i64 val) {
@@ -1055,13 +1834,26 @@ namespace ftl {
             return;
         }
 
-        if (is_pow2(val)) {
-            gen_sha(dest, log2i(val));
+        u64 abs = val < 0 ? -(u64)val : (u64)val;
+        if (is_pow2(abs)) {
+            // round towards zero by adding 2^k - 1 to negative dividends
+            int k = log2i(abs);
+            value bias = gen_scratch_val("idiv.bias", dest.bits);
+            m_emitter.movr(dest.bits, bias, dest);
+            if (k > 1)
+                m_emitter.sari(dest.bits, bias, dest.bits - 1);
+            m_emitter.shri(dest.bits, bias, dest.bits - k);
+            m_emitter.addr(dest.bits, dest, bias);
+            m_emitter.sari(dest.bits, dest, k);
+            if (val < 0)
+                m_emitter.negr(dest.bits, dest);
+            dest.mark_dirty();
             return;
         }
 
-        value src = gen_local_val("temp_idiv_imm", dest.bits, val);
-        gen_idiv(dest, src);
+        value quot = gen_idiv_magic(dest, val);
+        m_emitter.movr(dest.bits, dest, quot);
+        dest.mark_dirty();
     }
 
     void func::gen_imod(value& dest, i64 val) {
@@ -1073,8 +1865,26 @@ namespace ftl {
             return;
         }
 
-        value src = gen_local_val("temp_imod_imm", dest.bits, val);
-        gen_imod(dest, src);
+        u64 abs = val < 0 ? -(u64)val : (u64)val;
+        if (is_pow2(abs)) {
+            // the remainder takes the sign of the dividend, so subtract the
+            // biased and truncated multiple of 2^k
+            int k = log2i(abs);
+            value mult = gen_scratch_val("imod.mult", dest.bits);
+            m_emitter.movr(dest.bits, mult, dest);
+            if (k > 1)
+                m_emitter.sari(dest.bits, mult, dest.bits - 1);
+            m_emitter.shri(dest.bits, mult, dest.bits - k);
+            m_emitter.addr(dest.bits, mult, dest);
+            m_emitter.sari(dest.bits, mult, k);
+            m_emitter.shli(dest.bits, mult, k);
+            m_emitter.subr(dest.bits, dest, mult);
+            dest.mark_dirty();
+            return;
+        }
+
+        value quot = gen_idiv_magic(dest, val);
+        gen_mod_fixup(dest, quot, val);
     }
 
     void func::gen_umul(value& dest, u64 val) {
@@ -1088,14 +1898,7 @@ namespace ftl {
         if (val == 1)
             return;
 
-        if (is_pow2(val)) {
-            gen_shl(dest, log2i(val));
-            return;
-        }
-
-        value src = gen_local_val("temp_umul_imm", dest.bits, val);
-        gen_umul(dest, src);
-        m_alloc.free_value(src);
+        gen_mul_const(dest, (i64)val);
     }
 
     void func::gen_udiv(value& dest, u64 val) {
@@ -1110,8 +1913,9 @@ namespace ftl {
             return;
         }
 
-        value src = gen_local_val("temp_udiv_imm", dest.bits, val);
-        gen_udiv(dest, src);
+        value quot = gen_udiv_magic(dest, val);
+        m_emitter.movr(dest.bits, dest, quot);
+        dest.mark_dirty();
     }
 
     void func::gen_umod(value& dest, u64 val) {
@@ -1128,8 +1932,165 @@ namespace ftl {
             return;
         }
 
-        value src = gen_local_val("temp_umod_imm", dest.bits, val);
-        gen_umod(dest, src);
+        if (is_pow2(val)) {
+            int k = log2i(val);
+            m_emitter.shli(dest.bits, dest, dest.bits - k);
+            m_emitter.shri(dest.bits, dest, dest.bits - k);
+            dest.mark_dirty();
+            return;
+        }
+
+        value quot = gen_udiv_magic(dest, val);
+        gen_mod_fixup(dest, quot, val);
+    }
+
+    // Division by invariant integers using multiplication, Granlund and
+    // Montgomery, PLDI 1994: unsigned division uses figure 4.1, signed
+    // division figure 5.2. Values up to 32 bits are widened so that the
+    // full product fits a 64 bit register, 64 bit values need mul/imul.
+    value func::gen_udiv_magic(const value& src, u64 val) {
+        typedef unsigned __int128 u128;
+
+        int n = src.bits;
+        int l = 64 - __builtin_clzl(val - 1); // ceil(log2(val))
+        u64 m = (u64)(((u128)1 << n) * (((u128)1 << l) - val) / val + 1);
+
+        if (n < 64) {
+            value quot = gen_scratch_i64("udiv.quot");
+            value temp = gen_scratch_i64("udiv.temp");
+            m_emitter.movzx(32, n, quot, src);
+            if (fits_i32(m)) {
+                m_emitter.imuli(64, temp.fetch(), quot, (i32)m);
+            } else {
+                m_emitter.movi(64, temp, m);
+                m_emitter.imulr(64, temp.fetch(), quot);
+            }
+
+            m_emitter.shri(64, temp, n);
+            m_emitter.addr(64, quot, temp);
+            m_emitter.shri(64, quot, l);
+            return quot;
+        }
+
+        value hi = gen_scratch_i64("udiv.hi", RDX);
+        value lo = gen_scratch_i64("udiv.lo", (i64)m, RAX);
+        m_emitter.mulr(64, src);
+        m_emitter.movr(64, RAX, src);
+        m_emitter.subr(64, RAX, RDX);
+        m_emitter.shri(64, RAX, 1);
+        m_emitter.addr(64, RAX, RDX);
+        if (l > 1)
+            m_emitter.shri(64, RAX, l - 1);
+        m_alloc.mark_dirty(RAX);
+        return lo;
+    }
+
+    value func::gen_idiv_magic(const value& src, i64 val) {
+        typedef unsigned __int128 u128;
+
+        int n = src.bits;
+        u64 abs = val < 0 ? -(u64)val : (u64)val;
+        int l = 64 - __builtin_clzl(abs - 1); // ceil(log2(abs))
+        u64 m = (u64)(((u128)1 << (n + l - 1)) / abs + 1);
+
+        if (n < 64) {
+            value sign = gen_scratch_i64("idiv.sign");
+            value quot = gen_scratch_i64("idiv.quot");
+            m_emitter.movsx(64, n, sign, src);
+            if (fits_i32(m)) {
+                m_emitter.imuli(64, quot.fetch(), sign, (i32)m);
+            } else {
+                m_emitter.movi(64, quot, m);
+                m_emitter.imulr(64, quot.fetch(), sign);
+            }
+
+            m_emitter.sari(64, quot, n + l - 1);
+            m_emitter.sari(64, sign, 63);
+            m_emitter.subr(64, quot, sign);
+            if (val < 0)
+                m_emitter.negr(64, quot);
+            return quot;
+        }
+
+        // m exceeds 2^63, so its signed product is off by src * 2^64
+        value hi = gen_scratch_i64("idiv.hi", RDX);
+        value lo = gen_scratch_i64("idiv.lo", (i64)m, RAX);
+        m_emitter.imul(64, src);
+        m_emitter.addr(64, RDX, src);
+        if (l > 1)
+            m_emitter.sari(64, RDX, l - 1);
+        m_emitter.movr(64, RAX, src);
+        m_emitter.sari(64, RAX, 63);
+        m_emitter.subr(64, RDX, RAX);
+        if (val < 0)
+            m_emitter.negr(64, RDX);
+        m_alloc.mark_dirty(RDX);
+        return hi;
+    }
+
+    void func::gen_mul_const(value& dest, i64 val) {
+        // the low bits of a product are the same for signed and unsigned
+        // multiplication, so narrow values can use 32bit register operations
+        int bits = max(dest.bits, 32);
+        u64 abs = val < 0 ? -(u64)val : (u64)val;
+        if (dest.bits < 64)
+            abs &= (1ull << dest.bits) - 1;
+
+        int k = abs ? __builtin_ctzl(abs) : 0;
+        u64 odd = abs >> k;
+
+        if (odd == 1) {
+            m_emitter.shli(dest.bits, dest, k);
+        } else if (odd == 3 || odd == 5 || odd == 9) {
+            reg r = dest.fetch();
+            m_emitter.lear(bits, r, r, r, odd - 1);
+            if (k > 0)
+                m_emitter.shli(bits, r, k);
+        } else if (is_pow2(odd - 1) ||
+                   (is_pow2(odd + 1) && log2i(odd + 1) < bits)) {
+            // x * (2^n + 1) = (x << n) + x, x * (2^n - 1) = (x << n) - x
+            value temp = gen_scratch_i64("mul.temp");
+            reg r = dest.fetch();
+            m_emitter.movr(bits, temp, r);
+            if (is_pow2(odd - 1)) {
+                m_emitter.shli(bits, r, log2i(odd - 1));
+                m_emitter.addr(bits, r, temp);
+            } else {
+                m_emitter.shli(bits, r, log2i(odd + 1));
+                m_emitter.subr(bits, r, temp);
+            }
+
+            if (k > 0)
+                m_emitter.shli(bits, r, k);
+        } else if (bits == 32 || fits_i32(val)) {
+            reg r = dest.fetch();
+            m_emitter.imuli(bits, r, r, (i32)val);
+            dest.mark_dirty();
+            return;
+        } else {
+            value temp = gen_scratch_i64("mul.temp", val);
+            reg r = dest.fetch();
+            m_emitter.imulr(bits, r, temp);
+            dest.mark_dirty();
+            return;
+        }
+
+        if (val < 0)
+            m_emitter.negr(dest.bits, dest);
+        dest.mark_dirty();
+    }
+
+    void func::gen_mod_fixup(value& dest, value& quot, i64 val) {
+        // dest -= quot * val, only the low dest.bits of the product matter
+        if (dest.bits <= 32 || fits_i32(val)) {
+            m_emitter.imuli(64, quot.fetch(), quot, (i32)val);
+        } else {
+            value temp = gen_scratch_i64("mod.temp", val);
+            m_emitter.imulr(64, quot.fetch(), temp);
+        }
+
+        m_emitter.subr(dest.bits, dest, quot);
+        dest.mark_dirty();
     }
 
     void func::gen_inc(value& dest) {
@@ -1153,18 +2114,33 @@ namespace ftl {
     }
 
     void func::gen_shl(value& dest, value& src) {
+        if (use_bmi2(dest.bits)) {
+            gen_shiftx(&emitter::shlx, dest, src);
+            return;
+        }
+
         src.fetch(RCX);
         m_emitter.shlr(dest.bits, dest);
         dest.mark_dirty();
     }
 
     void func::gen_shr(value& dest, value& src) {
+        if (use_bmi2(dest.bits)) {
+            gen_shiftx(&emitter::shrx, dest, src);
+            return;
+        }
+
         src.fetch(RCX);
         m_emitter.shrr(dest.bits, dest);
         dest.mark_dirty();
     }
 
     void func::gen_sha(value& dest, value& src) {
+        if (use_bmi2(dest.bits)) {
+            gen_shiftx(&emitter::sarx, dest, src);
+            return;
+        }
+
         src.fetch(RCX);
         m_emitter.sarr(dest.bits, dest);
         dest.mark_dirty();
@@ -1182,6 +2158,17 @@ namespace ftl {
         dest.mark_dirty();
     }
 
+    void func::gen_shiftx(shiftx op, value& dest, value& src) {
+        // the count may live in any register and flags are left untouched
+        vector<reg> locked;
+        reg count = lock_reg(src, locked);
+        reg r = dest.fetch();
+        unlock_regs(locked);
+
+        (m_emitter.*op)(dest.bits, r, r, count);
+        dest.mark_dirty();
+    }
+
     void func::gen_shl(value& dest, u8 shift) {
         if (shift == 0)
             return;
@@ -1222,27 +2209,312 @@ namespace ftl {
         dest.mark_dirty();
     }
 
-    void func::gen_bt(value& dest, value& src) {
-        src.fetch();
-        // dest is not modified!
-        m_emitter.btr(dest.bits, dest, src);
-    }
+    void func::gen_rol(value& dest, const value& src, u8 shift) {
+        if (shift == 0 || !use_bmi2(dest.bits) || dest.bits != src.bits) {
+            gen_mov(dest, src);
+            gen_rol(dest, shift);
+            return;
+        }
 
-    void func::gen_bts(value& dest, value& src) {
-        src.fetch();
-        dest.mark_dirty();
-        m_emitter.btsr(dest.bits, dest, src);
+        gen_ror(dest, src, dest.bits - shift);
     }
 
-    void func::gen_btr(value& dest, value& src) {
-        src.fetch();
+    void func::gen_ror(value& dest, const value& src, u8 shift) {
+        if (shift == 0 || !use_bmi2(dest.bits) || dest.bits != src.bits) {
+            gen_mov(dest, src);
+            gen_ror(dest, shift);
+            return;
+        }
+
+        reg r = dest == src ? dest.fetch() : dest.assign();
+        m_emitter.rorx(dest.bits, r, src, shift);
         dest.mark_dirty();
-        m_emitter.btrr(dest.bits, dest, src);
     }
 
-    void func::gen_btc(value& dest, value& src) {
-        src.fetch();
-        dest.mark_dirty();
+    void func::gen_andn(value& dest, value& src1, const value& src2) {
+        bool same = dest.bits == src1.bits && dest.bits == src2.bits;
+        if (use_bmi1(dest.bits) && same) {
+            vector<reg> locked;
+            reg r1 = lock_reg(src1, locked);
+            reg r = dest == src2 ? dest.fetch() : dest.assign();
+            unlock_regs(locked);
+
+            m_emitter.andn(dest.bits, r, r1, src2);
+            dest.mark_dirty();
+            return;
+        }
+
+        if (dest == src2) {
+            value temp = gen_scratch_val("andn.temp", dest.bits);
+            gen_mov(temp, src1);
+            gen_not(temp);
+            gen_and(dest, temp);
+            return;
+        }
+
+        gen_mov(dest, src1);
+        gen_not(dest);
+        gen_and(dest, src2);
+    }
+
+    void func::gen_blsr(value& dest, const value& src) {
+        if (use_bmi1(dest.bits) && dest.bits == src.bits) {
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            m_emitter.blsr(dest.bits, r, src);
+            dest.mark_dirty();
+            return;
+        }
+
+        if (dest == src) {
+            value temp = gen_scratch_val("blsr.temp", dest.bits);
+            gen_add(temp, src, -1);
+            gen_and(dest, temp);
+            return;
+        }
+
+        gen_add(dest, src, -1);
+        gen_and(dest, src);
+    }
+
+    void func::gen_blsi(value& dest, const value& src) {
+        if (use_bmi1(dest.bits) && dest.bits == src.bits) {
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            m_emitter.blsi(dest.bits, r, src);
+            dest.mark_dirty();
+            return;
+        }
+
+        if (dest == src) {
+            value temp = gen_scratch_val("blsi.temp", dest.bits);
+            gen_mov(temp, src);
+            gen_neg(temp);
+            gen_and(dest, temp);
+            return;
+        }
+
+        gen_mov(dest, src);
+        gen_neg(dest);
+        gen_and(dest, src);
+    }
+
+    void func::gen_bzhi(value& dest, const value& src, value& index) {
+        FTL_ERROR_ON(dest.bits < 32, "bzhi requires 32 or 64 bit operands");
+        FTL_ERROR_ON(dest == index, "bzhi destination cannot be the index");
+
+        if (use_bmi2(dest.bits) && dest.bits == src.bits) {
+            vector<reg> locked;
+            reg ri = lock_reg(index, locked);
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            unlock_regs(locked);
+
+            m_emitter.bzhi(dest.bits, r, src, ri);
+            dest.mark_dirty();
+            return;
+        }
+
+        // mask = index < bits ? (1 << index) - 1 : ~0
+        value mask = gen_scratch_val("bzhi.mask", dest.bits, -1);
+        value ones = gen_scratch_val("bzhi.ones", dest.bits, -1);
+        gen_shl(mask, index);
+        gen_not(mask);
+        gen_cmp(index, dest.bits);
+        gen_cmovae(mask, ones);
+
+        gen_mov(dest, src);
+        gen_and(dest, mask);
+    }
+
+    void func::gen_pdep(value& dest, value& src, const value& mask) {
+        FTL_ERROR_ON(dest.bits < 32, "pdep requires 32 or 64 bit operands");
+
+        bool same = dest.bits == src.bits && dest.bits == mask.bits;
+        if (use_bmi2(dest.bits) && same) {
+            vector<reg> locked;
+            reg rs = lock_reg(src, locked);
+            reg r = dest == mask ? dest.fetch() : dest.assign();
+            unlock_regs(locked);
+
+            m_emitter.pdep(dest.bits, r, rs, mask);
+            dest.mark_dirty();
+            return;
+        }
+
+        value res = gen_call(helper_pdep, src, mask);
+        gen_mov(dest, res);
+    }
+
+    void func::gen_pext(value& dest, value& src, const value& mask) {
+        FTL_ERROR_ON(dest.bits < 32, "pext requires 32 or 64 bit operands");
+
+        bool same = dest.bits == src.bits && dest.bits == mask.bits;
+        if (use_bmi2(dest.bits) && same) {
+            vector<reg> locked;
+            reg rs = lock_reg(src, locked);
+            reg r = dest == mask ? dest.fetch() : dest.assign();
+            unlock_regs(locked);
+
+            m_emitter.pext(dest.bits, r, rs, mask);
+            dest.mark_dirty();
+            return;
+        }
+
+        value res = gen_call(helper_pext, src, mask);
+        gen_mov(dest, res);
+    }
+
+    void func::gen_popcnt(value& dest, const value& src) {
+        FTL_ERROR_ON(dest.bits != src.bits, "popcnt operand width mismatch");
+
+        if (use_popcnt(dest.bits)) {
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            m_emitter.popcnt(dest.bits, r, src);
+            dest.mark_dirty();
+            return;
+        }
+
+        // sum up bits in 2, 4 and 8 bit fields, then fold the byte counts
+        // into the lowest byte
+        int shift = 64 - dest.bits;
+        value x = gen_scratch_val("popcnt.x", dest.bits);
+        value t = gen_scratch_val("popcnt.t", dest.bits);
+        value m = gen_scratch_val("popcnt.m", dest.bits);
+
+        gen_mov(x, src);
+        gen_mov(t, x);
+        gen_shr(t, 1);
+        gen_mov(m, (i64)(0x5555555555555555ull >> shift));
+        gen_and(t, m);
+        gen_sub(x, t);
+
+        gen_mov(t, x);
+        gen_shr(t, 2);
+        gen_mov(m, (i64)(0x3333333333333333ull >> shift));
+        gen_and(t, m);
+        gen_and(x, m);
+        gen_add(x, t);
+
+        gen_mov(t, x);
+        gen_shr(t, 4);
+        gen_add(x, t);
+        gen_mov(m, (i64)(0x0f0f0f0f0f0f0f0full >> shift));
+        gen_and(x, m);
+
+        for (int n = 8; n < dest.bits; n *= 2) {
+            gen_mov(t, x);
+            gen_shr(t, n);
+            gen_add(x, t);
+        }
+
+        if (dest.bits > 8)
+            gen_and(x, 0xff);
+
+        gen_mov(dest, x);
+    }
+
+    void func::gen_clz(value& dest, const value& src) {
+        FTL_ERROR_ON(dest.bits < 16, "clz requires 16, 32 or 64 bit operands");
+        FTL_ERROR_ON(dest.bits != src.bits, "clz operand width mismatch");
+
+        if (use_lzcnt(dest.bits)) {
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            m_emitter.lzcnt(dest.bits, r, src);
+            dest.mark_dirty();
+            return;
+        }
+
+        // bsr yields the index of the highest set bit and sets zf for zero
+        // inputs, which are patched to 2*bits-1 so that the final xor with
+        // bits-1 produces bits for them
+        value zero = gen_scratch_val("clz.zero", dest.bits, 2 * dest.bits - 1);
+        vector<reg> locked;
+        reg rz = lock_reg(zero, locked);
+        reg r = dest == src ? dest.fetch() : dest.assign();
+        unlock_regs(locked);
+
+        m_emitter.bsr(dest.bits, r, src);
+        m_emitter.cmovz(dest.bits, r, rz);
+        m_emitter.xori(dest.bits, r, dest.bits - 1);
+        dest.mark_dirty();
+    }
+
+    void func::gen_ctz(value& dest, const value& src) {
+        FTL_ERROR_ON(dest.bits < 16, "ctz requires 16, 32 or 64 bit operands");
+        FTL_ERROR_ON(dest.bits != src.bits, "ctz operand width mismatch");
+
+        if (use_tzcnt(dest.bits)) {
+            reg r = dest == src ? dest.fetch() : dest.assign();
+            m_emitter.tzcnt(dest.bits, r, src);
+            dest.mark_dirty();
+            return;
+        }
+
+        value zero = gen_scratch_val("ctz.zero", dest.bits, dest.bits);
+        vector<reg> locked;
+        reg rz = lock_reg(zero, locked);
+        reg r = dest == src ? dest.fetch() : dest.assign();
+        unlock_regs(locked);
+
+        m_emitter.bsf(dest.bits, r, src);
+        m_emitter.cmovz(dest.bits, r, rz);
+        dest.mark_dirty();
+    }
+
+    void func::gen_bswap(value& dest) {
+        if (dest.bits == 8)
+            return;
+
+        if (dest.bits == 16) {
+            m_emitter.roli(16, dest, 8);
+        } else {
+            reg r = dest.fetch();
+            m_emitter.bswap(dest.bits, r);
+        }
+
+        dest.mark_dirty();
+    }
+
+    void func::gen_crc32(value& crc, const value& src) {
+        FTL_ERROR_ON(crc.bits != 32, "crc32 requires a 32 bit accumulator");
+
+        if (use_crc32()) {
+            reg r = crc.fetch();
+            m_emitter.crc32(src.bits, r, src);
+            crc.mark_dirty();
+            return;
+        }
+
+        u64 (*helper)(void*, u64, u64) = helper_crc32<u64>;
+        switch (src.bits) {
+        case  8: helper = helper_crc32<u8>; break;
+        case 16: helper = helper_crc32<u16>; break;
+        case 32: helper = helper_crc32<u32>; break;
+        }
+
+        value res = gen_call(helper, crc, src);
+        gen_mov(crc, res);
+    }
+
+    void func::gen_bt(value& dest, value& src) {
+        src.fetch();
+        // dest is not modified!
+        m_emitter.btr(dest.bits, dest, src);
+    }
+
+    void func::gen_bts(value& dest, value& src) {
+        src.fetch();
+        dest.mark_dirty();
+        m_emitter.btsr(dest.bits, dest, src);
+    }
+
+    void func::gen_btr(value& dest, value& src) {
+        src.fetch();
+        dest.mark_dirty();
+        m_emitter.btrr(dest.bits, dest, src);
+    }
+
+    void func::gen_btc(value& dest, value& src) {
+        src.fetch();
+        dest.mark_dirty();
         m_emitter.btcr(dest.bits, dest, src);
     }
 
@@ -1311,6 +2583,7 @@ namespace ftl {
         cmpv.fetch(RAX);
 
         m_emitter.cmpxchg(dest.bits, dest, src);
+        cmpv.mark_dirty();
     }
 
     void func::gen_fence(bool sync_loads, bool sync_stores) {
@@ -1322,6 +2595,98 @@ namespace ftl {
             m_emitter.sfence();
     }
 
+    void func::gen_barrier(int kind) {
+        // the peephole optimizer must not move or merge accesses across
+        m_emitter.barrier();
+        if (kind & (BARRIER_STORESTORE | BARRIER_STORELOAD))
+            flush_nt_stores();
+        if (kind & BARRIER_STORELOAD)
+            m_emitter.lock_fence();
+    }
+
+    rm func::atomic_address(value& val, value& base, i32 offset) {
+        vector<reg> locked;
+        rm mem = lock_address(base, nullptr, 1, offset, locked);
+        val.fetch();
+        unlock_regs(locked);
+        return mem;
+    }
+
+    void func::gen_atomic_add(value& src, value& base, i32 offset) {
+        rm mem = atomic_address(src, base, offset);
+        m_emitter.lock();
+        m_emitter.addr(src.bits, mem, src);
+    }
+
+    void func::gen_atomic_and(value& src, value& base, i32 offset) {
+        rm mem = atomic_address(src, base, offset);
+        m_emitter.lock();
+        m_emitter.andr(src.bits, mem, src);
+    }
+
+    void func::gen_atomic_or(value& src, value& base, i32 offset) {
+        rm mem = atomic_address(src, base, offset);
+        m_emitter.lock();
+        m_emitter.orr(src.bits, mem, src);
+    }
+
+    void func::gen_atomic_xor(value& src, value& base, i32 offset) {
+        rm mem = atomic_address(src, base, offset);
+        m_emitter.lock();
+        m_emitter.xorr(src.bits, mem, src);
+    }
+
+    void func::gen_atomic_xchg(value& val, value& base, i32 offset) {
+        rm mem = atomic_address(val, base, offset);
+        m_emitter.xchg(val.bits, mem, val);
+        val.mark_dirty();
+    }
+
+    void func::gen_atomic_xadd(value& val, value& base, i32 offset) {
+        rm mem = atomic_address(val, base, offset);
+        m_emitter.xadd(val.bits, mem, val);
+        val.mark_dirty();
+    }
+
+    void func::gen_atomic_cmpxchg(value& src, value& cmpv, value& base,
+                                  i32 offset) {
+        vector<reg> locked;
+        cmpv.fetch(RAX);
+        lock_reg(cmpv, locked);
+
+        rm mem = lock_address(base, nullptr, 1, offset, locked);
+        src.fetch();
+        unlock_regs(locked);
+
+        m_emitter.cmpxchg(src.bits, mem, src);
+        cmpv.mark_dirty();
+    }
+
+    void func::gen_atomic_cmpxchg16b(value& lo, value& hi, value& cmplo,
+                                     value& cmphi, value& base, i32 offset) {
+        FTL_ERROR_ON(!cpuinfo::get().cx16, "cmpxchg16b not supported");
+        FTL_ERROR_ON(lo.bits != 64 || hi.bits != 64 || cmplo.bits != 64 ||
+                     cmphi.bits != 64, "cmpxchg16b needs 64 bit operands");
+
+        // the comparand goes into rdx:rax, the replacement into rcx:rbx
+        vector<reg> locked;
+        cmplo.fetch(RAX);
+        lock_reg(cmplo, locked);
+        cmphi.fetch(RDX);
+        lock_reg(cmphi, locked);
+        lo.fetch(RBX);
+        lock_reg(lo, locked);
+        hi.fetch(RCX);
+        lock_reg(hi, locked);
+
+        rm mem = lock_address(base, nullptr, 1, offset, locked);
+        unlock_regs(locked);
+
+        m_emitter.cmpxchg16b(mem);
+        cmplo.mark_dirty();
+        cmphi.mark_dirty();
+    }
+
     void func::gen_mov(scalar& dest, const value& src) {
         FTL_ERROR_ON(src.bits < 32, "integer value too narrow");
 
@@ -1472,6 +2837,78 @@ namespace ftl {
         m_emitter.sqrt(dest.bits, dest, temp);
     }
 
+    void func::gen_fpop(fpop2 op2, fpop3 op3, bool commutative, scalar& dest,
+                        const scalar& src1, const scalar& src2) {
+        if (dest == src1) {
+            (this->*op2)(dest, src2);
+            return;
+        }
+
+        if (commutative && dest == src2) {
+            (this->*op2)(dest, src1);
+            return;
+        }
+
+        bool same_width = dest.bits == src1.bits && dest.bits == src2.bits;
+        if (m_emitter.is_avx() && same_width && src1.is_reg()) {
+            // the vex form reads its first source from vvvv, so src1 does
+            // not need to be copied into the destination beforehand
+            xmm r = src1.r();
+            bool lock = !m_alloc.is_blocked(r);
+            if (lock)
+                m_alloc.block(r);
+
+            if (dest.is_mem()) {
+                if (dest == src2)
+                    dest.fetch();
+                else
+                    dest.assign();
+            }
+
+            if (lock)
+                m_alloc.unblock(r);
+
+            dest.mark_dirty();
+            (m_emitter.*op3)(dest.bits, dest, src1, src2);
+            return;
+        }
+
+        if (dest != src2) {
+            gen_mov(dest, src1);
+            (this->*op2)(dest, src2);
+            return;
+        }
+
+        scalar temp = gen_scratch_fp("fpop.temp", dest.bits);
+        gen_mov(temp, src1);
+        (this->*op2)(temp, src2);
+        gen_mov(dest, temp);
+    }
+
+    void func::gen_add(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_add, &emitter::adds, true, dest, src1, src2);
+    }
+
+    void func::gen_sub(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_sub, &emitter::subs, false, dest, src1, src2);
+    }
+
+    void func::gen_mul(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_mul, &emitter::muls, true, dest, src1, src2);
+    }
+
+    void func::gen_div(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_div, &emitter::divs, false, dest, src1, src2);
+    }
+
+    void func::gen_min(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_min, &emitter::mins, false, dest, src1, src2);
+    }
+
+    void func::gen_max(scalar& dest, const scalar& src1, const scalar& src2) {
+        gen_fpop(&func::gen_max, &emitter::maxs, false, dest, src1, src2);
+    }
+
     void func::gen_pxor(scalar& dest, const scalar& src) {
         if (dest.is_mem()) {
             if (dest == src)
@@ -1516,4 +2953,353 @@ namespace ftl {
         dest.mark_dirty();
     }
 
+    void func::gen_memop(vec& val, value& base, value* index, int scale,
+                         i32 offset, bool load) {
+        vector<reg> locked;
+        rm mem = lock_address(base, index, scale, offset, locked);
+
+        if (!load)
+            val.fetch();
+        else if (val.is_mem())
+            val.assign();
+
+        unlock_regs(locked);
+
+        if (load) {
+            m_emitter.movdqu(val, mem);
+            val.mark_dirty();
+        } else {
+            m_emitter.movdqu(mem, val);
+        }
+    }
+
+    void func::fetch_vec(vec& dest, vec& src) {
+        // packed operations fault on unaligned memory operands, so both
+        // operands are brought into registers first
+        xmm r = dest.fetch();
+        dest.mark_dirty();
+
+        bool lock = !m_alloc.is_blocked(r);
+        if (lock)
+            m_alloc.block(r);
+        src.fetch();
+        if (lock)
+            m_alloc.unblock(r);
+    }
+
+    void func::gen_load(vec& dest, value& base, i32 offset) {
+        gen_memop(dest, base, nullptr, 1, offset, true);
+    }
+
+    void func::gen_load(vec& dest, value& base, value& index, int scale,
+                        i32 offset) {
+        gen_memop(dest, base, &index, scale, offset, true);
+    }
+
+    void func::gen_store(vec& src, value& base, i32 offset) {
+        gen_memop(src, base, nullptr, 1, offset, false);
+    }
+
+    void func::gen_store(vec& src, value& base, value& index, int scale,
+                         i32 offset) {
+        gen_memop(src, base, &index, scale, offset, false);
+    }
+
+    void func::gen_memop_nt(vec& val, value& base, value* index, int scale,
+                            i32 offset) {
+        vector<reg> locked;
+        rm mem = lock_address(base, index, scale, offset, locked);
+        val.fetch();
+        unlock_regs(locked);
+
+        m_emitter.movntdq(mem, val);
+        m_nt_stores = true;
+    }
+
+    void func::gen_store_nt(vec& src, value& base, i32 offset) {
+        gen_memop_nt(src, base, nullptr, 1, offset);
+    }
+
+    void func::gen_store_nt(vec& src, value& base, value& index, int scale,
+                            i32 offset) {
+        gen_memop_nt(src, base, &index, scale, offset);
+    }
+
+    void func::gen_padd(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.padd(bits, dest, src);
+    }
+
+    void func::gen_psub(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.psub(bits, dest, src);
+    }
+
+    void func::gen_pmul(int bits, vec& dest, vec& src) {
+        if (bits == 32)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pmul(bits, dest, src);
+    }
+
+    void func::gen_pand(vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.pand(dest, src);
+    }
+
+    void func::gen_pandn(vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.pandn(dest, src);
+    }
+
+    void func::gen_por(vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.por(dest, src);
+    }
+
+    void func::gen_pxor(vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.pxor(128, dest, src);
+    }
+
+    void func::gen_pcmpeq(int bits, vec& dest, vec& src) {
+        if (bits == 64)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pcmpeq(bits, dest, src);
+    }
+
+    void func::gen_pcmpgt(int bits, vec& dest, vec& src) {
+        if (bits == 64)
+            require(cpuinfo::get().sse42, "sse4.2");
+        fetch_vec(dest, src);
+        m_emitter.pcmpgt(bits, dest, src);
+    }
+
+    void func::gen_pmins(int bits, vec& dest, vec& src) {
+        if (bits != 16)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pmins(bits, dest, src);
+    }
+
+    void func::gen_pmaxs(int bits, vec& dest, vec& src) {
+        if (bits != 16)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pmaxs(bits, dest, src);
+    }
+
+    void func::gen_pminu(int bits, vec& dest, vec& src) {
+        if (bits != 8)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pminu(bits, dest, src);
+    }
+
+    void func::gen_pmaxu(int bits, vec& dest, vec& src) {
+        if (bits != 8)
+            require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pmaxu(bits, dest, src);
+    }
+
+    void func::gen_psll(int bits, vec& dest, u8 imm) {
+        dest.fetch();
+        dest.mark_dirty();
+        m_emitter.psll(bits, dest, imm);
+    }
+
+    void func::gen_psrl(int bits, vec& dest, u8 imm) {
+        dest.fetch();
+        dest.mark_dirty();
+        m_emitter.psrl(bits, dest, imm);
+    }
+
+    void func::gen_psra(int bits, vec& dest, u8 imm) {
+        dest.fetch();
+        dest.mark_dirty();
+        m_emitter.psra(bits, dest, imm);
+    }
+
+    void func::gen_pshufd(vec& dest, vec& src, u8 imm) {
+        fetch_vec(dest, src);
+        m_emitter.pshufd(dest, src, imm);
+    }
+
+    void func::gen_pshufb(vec& dest, vec& src) {
+        require(cpuinfo::get().ssse3, "ssse3");
+        fetch_vec(dest, src);
+        m_emitter.pshufb(dest, src);
+    }
+
+    void func::gen_punpckl(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.punpckl(bits, dest, src);
+    }
+
+    void func::gen_punpckh(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.punpckh(bits, dest, src);
+    }
+
+    void func::gen_blend(int bits, vec& dest, vec& src, u8 imm) {
+        require(cpuinfo::get().sse41, "sse4.1");
+        fetch_vec(dest, src);
+        m_emitter.pblend(bits, dest, src, imm);
+    }
+
+    void func::gen_blendv(int bits, vec& dest, vec& src, vec& mask) {
+        require(cpuinfo::get().sse41, "sse4.1");
+
+        // the mask operand is implicit in xmm0
+        mask.fetch(XMM0);
+        bool lock = !m_alloc.is_blocked(XMM0);
+        if (lock)
+            m_alloc.block(XMM0);
+        fetch_vec(dest, src);
+        if (lock)
+            m_alloc.unblock(XMM0);
+
+        m_emitter.pblendv(bits, dest, src);
+    }
+
+    void func::gen_aesenc(vec& dest, vec& key) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, key);
+        m_emitter.aesenc(dest, key);
+    }
+
+    void func::gen_aesenclast(vec& dest, vec& key) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, key);
+        m_emitter.aesenclast(dest, key);
+    }
+
+    void func::gen_aesdec(vec& dest, vec& key) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, key);
+        m_emitter.aesdec(dest, key);
+    }
+
+    void func::gen_aesdeclast(vec& dest, vec& key) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, key);
+        m_emitter.aesdeclast(dest, key);
+    }
+
+    void func::gen_aesimc(vec& dest, vec& src) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, src);
+        m_emitter.aesimc(dest, src);
+    }
+
+    void func::gen_aeskeygenassist(vec& dest, vec& src, u8 rcon) {
+        require(cpuinfo::get().aes, "aes");
+        fetch_vec(dest, src);
+        m_emitter.aeskeygenassist(dest, src, rcon);
+    }
+
+    void func::gen_pclmul(vec& dest, vec& src, u8 imm) {
+        require(cpuinfo::get().pclmul, "pclmulqdq");
+        fetch_vec(dest, src);
+        m_emitter.pclmulqdq(dest, src, imm);
+    }
+
+    void func::gen_sha1rnds4(vec& dest, vec& src, u8 imm) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha1rnds4(dest, src, imm);
+    }
+
+    void func::gen_sha1nexte(vec& dest, vec& src) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha1nexte(dest, src);
+    }
+
+    void func::gen_sha1msg1(vec& dest, vec& src) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha1msg1(dest, src);
+    }
+
+    void func::gen_sha1msg2(vec& dest, vec& src) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha1msg2(dest, src);
+    }
+
+    void func::gen_sha256rnds2(vec& dest, vec& src, vec& wk) {
+        require(cpuinfo::get().sha, "sha");
+
+        // like blendv, the message and round constants come in xmm0
+        wk.fetch(XMM0);
+        bool lock = !m_alloc.is_blocked(XMM0);
+        if (lock)
+            m_alloc.block(XMM0);
+        fetch_vec(dest, src);
+        if (lock)
+            m_alloc.unblock(XMM0);
+
+        m_emitter.sha256rnds2(dest, src);
+    }
+
+    void func::gen_sha256msg1(vec& dest, vec& src) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha256msg1(dest, src);
+    }
+
+    void func::gen_sha256msg2(vec& dest, vec& src) {
+        require(cpuinfo::get().sha, "sha");
+        fetch_vec(dest, src);
+        m_emitter.sha256msg2(dest, src);
+    }
+
+    void func::gen_addp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.addp(bits, dest, src);
+    }
+
+    void func::gen_subp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.subp(bits, dest, src);
+    }
+
+    void func::gen_mulp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.mulp(bits, dest, src);
+    }
+
+    void func::gen_divp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.divp(bits, dest, src);
+    }
+
+    void func::gen_minp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.minp(bits, dest, src);
+    }
+
+    void func::gen_maxp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.maxp(bits, dest, src);
+    }
+
+    void func::gen_sqrtp(int bits, vec& dest, vec& src) {
+        fetch_vec(dest, src);
+        m_emitter.sqrtp(bits, dest, src);
+    }
+
+    void func::gen_cmpp(int bits, vec& dest, vec& src, u8 pred) {
+        fetch_vec(dest, src);
+        m_emitter.cmpp(bits, dest, src, pred);
+    }
+
+    void func::gen_shufp(int bits, vec& dest, vec& src, u8 imm) {
+        fetch_vec(dest, src);
+        m_emitter.shufp(bits, dest, src, imm);
+    }
+
 }
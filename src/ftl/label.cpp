@@ -20,15 +20,91 @@
 
 namespace ftl {
 
+    // with branch alignment enabled, labels that would start within the
+    // last bytes of a cache line are moved to the next one, so that short
+    // blocks are not split across two lines
+    static const u64 CACHELINE = 64;
+    static const u64 BLOCK_MINLEN = 16;
+
+    static u64 line_padding(const u8* ptr) {
+        u64 left = CACHELINE - (u64)ptr % CACHELINE;
+        return left < BLOCK_MINLEN ? left : 0;
+    }
+
     void label::patch() {
         if (!is_placed())
             FTL_ERROR("cannot patch: label '%s' not yet placed", name());
 
-        for (auto fix : m_fixups)
+        // branch alignment pads in front of a branch after its encoding has
+        // been chosen, which can push short backward branches out of reach
+        bool grown;
+        do {
+            grown = false;
+            for (const fixup& fix : m_fixups) {
+                if (fix.size == 1 && !fits_i8(m_location - fix.code - 1)) {
+                    m_buffer.relax(fix.code);
+                    grown = true;
+                    break;
+                }
+            }
+        } while (grown);
+
+        for (auto fix : m_fixups) {
             patch_jump(fix, m_location);
+            m_buffer.add_reloc(fix.code, fix.size, fix.code + fix.size,
+                               m_location);
+        }
+
         m_fixups.clear();
     }
 
+    void label::relax(size_t alignment) {
+        // grow short branches that cannot reach the (aligned) location, which
+        // moves along with the code each time a branch grows
+        const u64 mask = alignment > 1 ? alignment - 1 : 0;
+        const bool pad = alignment <= 1 &&
+                         m_alloc.get_emitter().is_align_branches();
+        bool grown;
+        do {
+            grown = false;
+            u8* target = (u8*)(((u64)m_buffer.get_code_ptr() + mask) & ~mask);
+            if (pad)
+                target += line_padding(target);
+            for (const fixup& fix : m_fixups) {
+                if (fix.size == 1 && !fits_i8(target - fix.code - 1)) {
+                    m_buffer.relax(fix.code);
+                    grown = true;
+                    break;
+                }
+            }
+        } while (grown);
+    }
+
+    void label::relocate(u8* from, u8* to, size_t n) {
+        if (m_location >= from && m_location <= to)
+            m_location += n;
+
+        for (fixup& fix : m_fixups)
+            if (fix.code >= from)
+                fix.code += n;
+    }
+
+    void label::grow(const u8* code, u8* field) {
+        for (fixup& fix : m_fixups) {
+            if (fix.code == code) {
+                fix.code = field;
+                fix.size = 4;
+            }
+        }
+    }
+
+    bool label::has_short_fixups() const {
+        for (const fixup& fix : m_fixups)
+            if (fix.size == 1)
+                return true;
+        return false;
+    }
+
 
     label::label(const string& name, cbuf& buffer, alloc& al, u8* location):
         m_location(location),
@@ -36,6 +112,7 @@ namespace ftl {
         m_buffer(buffer),
         m_alloc(al),
         m_name(name) {
+        m_buffer.track(this);
     }
 
     label::label(label&& other):
@@ -44,9 +121,11 @@ namespace ftl {
         m_buffer(other.m_buffer),
         m_alloc(other.m_alloc),
         m_name(other.m_name) {
+        m_buffer.track(this);
     }
 
     label::~label() {
+        m_buffer.untrack(this);
         if (!is_placed() && !m_fixups.empty() && !std::uncaught_exception())
             FTL_ERROR("unplaced label '%s'", name());
     }
@@ -57,12 +136,43 @@ namespace ftl {
             patch();
     }
 
-    void label::place(bool flush) {
+    void label::place(bool flush, size_t alignment) {
         FTL_ERROR_ON(m_location, "label '%s' has already been placed", name());
+        FTL_ERROR_ON(alignment && !is_pow2(alignment),
+                     "alignment must be a power of two: %zu", alignment);
         if (flush)
             m_alloc.flush_all_regs();
+
+        // padding would be off if code in front of the label moved later;
+        // every pending fixup is a branch in front of the label to a target
+        // that is not placed yet, and its final distance is unknown, so all
+        // of them are grown now
+        if (alignment > 1)
+            m_buffer.relax_all(this);
+
+        // cache line padding goes last, since growing branches in relax()
+        // moves the code in front of the label
+        relax(alignment);
+        if (alignment > 1)
+            m_buffer.align(log2i(alignment), true);
+        else if (m_alloc.get_emitter().is_align_branches())
+            m_buffer.pad(line_padding(m_buffer.get_code_ptr()));
+
+        m_alloc.get_emitter().barrier();
         m_location = m_buffer.get_code_ptr();
         patch();
+        m_buffer.prune_relocs();
+    }
+
+    void label::place(u8* location, bool flush) {
+        FTL_ERROR_ON(m_location, "label '%s' has already been placed", name());
+        FTL_ERROR_ON(!location, "cannot place label '%s' at nullptr", name());
+        if (flush)
+            m_alloc.flush_all_regs();
+
+        m_location = location;
+        patch();
+        m_buffer.prune_relocs();
     }
 
 }
@@ -34,13 +34,30 @@ std::ostream& operator << (std::ostream& os, const ftl::xmm& r) {
     return os;
 }
 
+std::ostream& operator << (std::ostream& os, const ftl::ymm& r) {
+    if (ftl::ymm_valid(r))
+        os << "ymm" << (int)r;
+    else
+        os << "???";
+    return os;
+}
+
 std::ostream& operator << (std::ostream& os, const ftl::rm& rm) {
     if (!rm.is_mem) {
+        if (rm.is_ymm) return os << (ftl::ymm)rm.r;
         if (rm.is_xmm) return os << (ftl::xmm)rm.r;
         else           return os << (ftl::reg)rm.r;
     }
 
+    if (rm.is_rip)
+        return os << "[rip " << std::hex << "0x" << rm.offset << std::dec << "]";
+
     os << "[" << (ftl::reg)rm.r;
+    if (rm.has_index()) {
+        os << "+" << (ftl::reg)rm.index;
+        if (rm.scale > 1)
+            os << "*" << rm.scale;
+    }
     if (rm.offset) {
         if (rm.offset > 0)
             os << "+";
@@ -22,7 +22,7 @@
 namespace ftl {
 
     static bool valid_width(int width) {
-        return width == 32 || width == 64;
+        return width == 32 || width == 64 || width == 128 || width == 256;
     }
 
     xmm scalar::r() const {
@@ -30,6 +30,10 @@ namespace ftl {
     }
 
     rm scalar::mem() const {
+        // scratch values get a stack slot the first time they are spilled
+        if (is_scratch())
+            return memop(STACK_POINTER, m_allocator.spill_slot(this));
+
         if (m_mem.is_addressable())
             return m_mem;
 
@@ -53,6 +57,10 @@ namespace ftl {
             m_allocator.mark_dirty(curr);
     }
 
+    bool scalar::is_spilled() const {
+        return is_scratch() && m_allocator.is_spilled(this);
+    }
+
     bool scalar::is_local() const {
         return m_mem.r == STACK_POINTER;
     }
@@ -95,10 +103,15 @@ namespace ftl {
 
     scalar::scalar(alloc& al, const string& nm, int bits, u64 addr, reg base,
                    i64 offset):
+        scalar(al, nm, bits, addr, rm(base, offset)) {
+    }
+
+    scalar::scalar(alloc& al, const string& nm, int bits, u64 addr,
+                   const rm& mem):
         m_allocator(al),
         m_name(nm),
         m_dead(false),
-        m_mem(base, offset),
+        m_mem(mem),
         bits(bits),
         addr(addr) {
         if (!valid_width(bits))
@@ -115,9 +128,14 @@ namespace ftl {
         addr(other.addr) {
         m_allocator.register_value(this);
 
+        bool dirty = other.is_dirty();
+        m_allocator.move_spill(&other, this);
         other.mark_dead();
-        if (other.is_reg())
+        if (other.is_reg()) {
             m_allocator.assign(this, other.r());
+            if (dirty)
+                mark_dirty();
+        }
     }
 
     scalar::~scalar() {
@@ -131,9 +149,7 @@ namespace ftl {
 
         xmm curr = r();
         if (xmm_valid(curr))
-            return curr;
-
-        FTL_ERROR_ON(is_scratch(), "attempt to get address of scratch scalar");
+            return bits == 256 ? rm(to_ymm(curr)) : rm(curr);
 
         return mem();
     }
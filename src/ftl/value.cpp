@@ -30,6 +30,10 @@ namespace ftl {
     }
 
     rm value::mem() const {
+        // scratch values get a stack slot the first time they are spilled
+        if (is_scratch())
+            return memop(STACK_POINTER, m_allocator.spill_slot(this));
+
         if (m_mem.is_addressable())
             return m_mem;
 
@@ -53,6 +57,10 @@ namespace ftl {
             m_allocator.mark_dirty(curr);
     }
 
+    bool value::is_spilled() const {
+        return is_scratch() && m_allocator.is_spilled(this);
+    }
+
     bool value::is_local() const {
         return m_mem.r == STACK_POINTER;
     }
@@ -95,10 +103,15 @@ namespace ftl {
 
     value::value(alloc& al, const string& nm, int bits, bool sign, u64 addr,
                  reg base, i64 offset):
+        value(al, nm, bits, sign, addr, rm(base, offset)) {
+    }
+
+    value::value(alloc& al, const string& nm, int bits, bool sign, u64 addr,
+                 const rm& mem):
         m_allocator(al),
         m_name(nm),
         m_dead(false),
-        m_mem(base, offset),
+        m_mem(mem),
         bits(bits),
         sign(sign),
         addr(addr) {
@@ -117,9 +130,23 @@ namespace ftl {
         addr(other.addr) {
         m_allocator.register_value(this);
 
+        // pinned registers are blocked, so release the pin for the handover
+        // and move it over to the new value afterwards
+        bool pinned = m_allocator.is_pinned(&other);
+        if (pinned)
+            m_allocator.unpin_value(other);
+
+        bool dirty = other.is_dirty();
+        m_allocator.move_spill(&other, this);
         other.mark_dead();
-        if (other.is_reg())
+        if (other.is_reg()) {
             m_allocator.assign(this, other.r());
+            if (dirty)
+                mark_dirty();
+        }
+
+        if (pinned)
+            m_allocator.pin_value(*this, r());
     }
 
     value::~value() {
@@ -135,8 +162,6 @@ namespace ftl {
         if (reg_valid(curr))
             return curr;
 
-        FTL_ERROR_ON(is_scratch(), "attempt to get address of scratch value");
-
         return mem();
     }
 
@@ -0,0 +1,128 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(align, nops) {
+    cbuf code(1 * KiB);
+
+    u8* p = code.get_code_ptr();
+    code.nop(1);
+    EXPECT_EQ(p[0], 0x90);
+
+    p = code.get_code_ptr();
+    code.nop(3);
+    EXPECT_EQ(p[0], 0x0f);
+    EXPECT_EQ(p[1], 0x1f);
+    EXPECT_EQ(p[2], 0x00);
+
+    p = code.get_code_ptr();
+    code.nop(11);
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(p[i], 0x66) << i;
+    EXPECT_EQ(p[3], 0x0f);
+    EXPECT_EQ(p[4], 0x1f);
+    EXPECT_EQ(p[5], 0x84);
+    for (int i = 6; i < 11; i++)
+        EXPECT_EQ(p[i], 0x00) << i;
+
+    p = code.get_code_ptr();
+    code.nop(15);
+    EXPECT_EQ(p[6], 0x66);
+    EXPECT_EQ(p[7], 0x0f);
+    EXPECT_EQ(code.get_code_ptr() - p, 15);
+}
+
+TEST(align, execute) {
+    func code("execute");
+    value x = code.gen_local_i64("x", 0);
+    for (size_t len = 1; len <= 15; len++) {
+        code.get_emitter().nop(len);
+        code.gen_add(x, 1);
+    }
+
+    code.get_cbuffer().pad(100);
+    code.get_cbuffer().align(6, true);
+    EXPECT_EQ((u64)code.get_cbuffer().get_code_ptr() % 64, 0);
+
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(code(), 15);
+}
+
+TEST(align, loop) {
+    for (size_t alignment : { 16, 32, 64 }) {
+        func code("loop");
+        value i = code.gen_local_i64("i", 0);
+        value s = code.gen_local_i64("s", 0);
+
+        label loop = code.gen_label("loop");
+        loop.place(true, alignment);
+        EXPECT_EQ((u64)loop.get_address() % alignment, 0) << alignment;
+
+        code.gen_add(s, i);
+        code.gen_add(i, 1);
+        code.gen_cmp(i, 10);
+        code.gen_jl(loop);
+        code.gen_ret(s);
+        code.finish();
+
+        EXPECT_EQ(code(), 45) << alignment;
+    }
+}
+
+TEST(align, relaxed) {
+    u64 a = 0;
+
+    func code("relaxed");
+    value va = code.gen_global_i64("a", &a);
+    value i = code.gen_local_i64("i", 0);
+
+    label skip = code.gen_label("skip");
+    label loop = code.gen_label("loop");
+
+    code.gen_cmp(va, 0);
+    code.gen_jnz(skip);
+
+    // the jnz above grows before padding for the loop head, had it grown
+    // when skip gets placed, the loop head would have moved
+    loop.place(true, 64);
+    u8* head = loop.get_address();
+    code.gen_add(i, 1);
+    code.gen_cmp(i, 5);
+    code.gen_jl(loop);
+    for (int n = 0; n < 40; n++)
+        code.gen_add(i, 0x1000);
+    code.gen_sub(i, 40 * 0x1000);
+
+    skip.place();
+    code.gen_ret(i);
+    code.finish();
+
+    EXPECT_EQ(loop.get_address(), head);
+    EXPECT_EQ((u64)loop.get_address() % 64, 0);
+
+    EXPECT_EQ(code(), 5);
+    a = 1;
+    EXPECT_EQ(code(), 0);
+}
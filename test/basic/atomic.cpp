@@ -60,3 +60,177 @@ MKTEST(64,  0,  0,  1);
 MKTEST(64,  1,  0,  1);
 MKTEST(64, 42, 14, 42);
 MKTEST(64, 21, 18, 20);
+
+TEST(atomic, encoding) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.xadd(32, memop(RDI, 0), RCX), 4);
+    EXPECT_EQ(p[0], 0xf0); // lock
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0xc1); // xadd
+    EXPECT_EQ(p[3], 0x0f); // modrm: [rdi], ecx
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.cmpxchg16b(memop(RSI, 0)), 5);
+    EXPECT_EQ(p[0], 0xf0); // lock
+    EXPECT_EQ(p[1], 0x48); // rex.w
+    EXPECT_EQ(p[2], 0x0f);
+    EXPECT_EQ(p[3], 0xc7); // cmpxchg16b
+    EXPECT_EQ(p[4], 0x0e); // modrm: [rsi]
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.xadd(64, RAX, RBX), 4);
+    EXPECT_EQ(p[0], 0x48); // rex.w, no lock for registers
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0xc1); // xadd
+    EXPECT_EQ(p[3], 0xd8); // modrm: rax, rbx
+}
+
+TEST(atomic, rmw) {
+    u64 mem[4] = { 1, 0xff, 0xf0, 0xff };
+    u32 cnt = 5;
+
+    func code("atomic.rmw");
+    value base = code.gen_local_val("base", 64, (i64)mem);
+    value pcnt = code.gen_local_val("pcnt", 64, (i64)&cnt);
+    value a = code.gen_local_i64("a", 41);
+    value b = code.gen_local_i64("b", 0x0f);
+    value c = code.gen_local_i64("c", 0x0f);
+    value d = code.gen_local_i64("d", 0xf0);
+    value e = code.gen_local_i32("e", -2);
+
+    code.gen_atomic_add(a, base);
+    code.gen_atomic_and(b, base, 8);
+    code.gen_atomic_or(c, base, 16);
+    code.gen_atomic_xor(d, base, 24);
+    code.gen_atomic_add(e, pcnt);
+    code.gen_add(a, b); // sources remain unchanged
+    code.gen_ret(a);
+    code.finish();
+
+    EXPECT_EQ(code(), 41 + 0x0f);
+    EXPECT_EQ(mem[0], 42);
+    EXPECT_EQ(mem[1], 0x0f);
+    EXPECT_EQ(mem[2], 0xff);
+    EXPECT_EQ(mem[3], 0x0f);
+    EXPECT_EQ(cnt, 3);
+}
+
+TEST(atomic, xadd) {
+    u64 mem[2] = { 100, 7 };
+
+    func code("atomic.xadd");
+    value base = code.gen_local_val("base", 64, (i64)mem);
+    value a = code.gen_local_i64("a", 5);
+    value b = code.gen_local_i64("b", 9);
+
+    code.gen_atomic_xadd(a, base);
+    code.gen_atomic_xchg(b, base, 8);
+    code.gen_add(a, b);
+    code.gen_ret(a);
+    code.finish();
+
+    EXPECT_EQ(code(), 100 + 7);
+    EXPECT_EQ(mem[0], 105);
+    EXPECT_EQ(mem[1], 9);
+}
+
+TEST(atomic, cmpxchg) {
+    u32 mem = 10, cmp = 11, fail = 0, succ = 0;
+
+    func code("atomic.cmpxchg");
+    value base = code.gen_local_val("base", 64, (i64)&mem);
+    value src = code.gen_local_i32("src", 20);
+    value cmpv = code.gen_global_i32("cmpv", &cmp);
+    value vfail = code.gen_global_i32("fail", &fail);
+    value vsucc = code.gen_global_i32("succ", &succ);
+
+    // the first attempt fails and picks up the current value, which makes
+    // the second one succeed
+    code.gen_atomic_cmpxchg(src, cmpv, base);
+    code.gen_setnz(vfail);
+    code.gen_atomic_cmpxchg(src, cmpv, base);
+    code.gen_setz(vsucc);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(fail, 1);
+    EXPECT_EQ(succ, 1);
+    EXPECT_EQ(cmp, 10);
+    EXPECT_EQ(mem, 20);
+}
+
+TEST(atomic, cmpxchg16b) {
+    if (!cpuinfo::host().cx16)
+        GTEST_SKIP() << "cmpxchg16b not supported";
+
+    alignas(16) u64 mem[2] = { 1, 2 };
+    u64 old[2] = { 0, 0 };
+
+    func code("atomic.cmpxchg16b");
+    value base = code.gen_local_val("base", 64, (i64)mem);
+    value lo = code.gen_local_i64("lo", 3);
+    value hi = code.gen_local_i64("hi", 4);
+    value cmplo = code.gen_global_i64("cmplo", &old[0]);
+    value cmphi = code.gen_global_i64("cmphi", &old[1]);
+    value res = code.gen_local_i64("res", 0);
+
+    code.gen_atomic_cmpxchg16b(lo, hi, cmplo, cmphi, base);
+    code.gen_setz(res);
+    code.gen_ret(res);
+    code.finish();
+
+    EXPECT_EQ(code(), 0);
+    EXPECT_EQ(old[0], 1);
+    EXPECT_EQ(old[1], 2);
+    EXPECT_EQ(mem[0], 1);
+
+    EXPECT_EQ(code(), 1);
+    EXPECT_EQ(mem[0], 3);
+    EXPECT_EQ(mem[1], 4);
+}
+
+TEST(atomic, barrier) {
+    const struct {
+        int kind;
+        size_t len;
+    } kinds[] = {
+        { BARRIER_LOADLOAD,   0 },
+        { BARRIER_STORESTORE, 0 },
+        { BARRIER_ACQUIRE,    0 },
+        { BARRIER_RELEASE,    0 },
+        { BARRIER_ACQ_REL,    0 },
+        { BARRIER_STORELOAD,  5 },
+        { BARRIER_SEQ_CST,    5 },
+    };
+
+    for (const auto& k : kinds) {
+        u32 x = 0;
+
+        func code("atomic.barrier");
+        value vx = code.gen_global_i32("x", &x);
+        code.gen_mov(vx, 1);
+        code.get_alloc().flush_all_regs();
+
+        u8* p = code.get_cbuffer().get_code_ptr();
+        code.gen_barrier(k.kind);
+        EXPECT_EQ((size_t)(code.get_cbuffer().get_code_ptr() - p), k.len);
+        if (k.len > 0) {
+            EXPECT_EQ(p[0], 0xf0); // lock
+            EXPECT_EQ(p[1], 0x83); // or imm8
+            EXPECT_EQ(p[2], 0x0c); // modrm: [rsp]
+            EXPECT_EQ(p[3], 0x24);
+            EXPECT_EQ(p[4], 0x00);
+        }
+
+        code.gen_mov(vx, 2);
+        code.gen_ret(vx);
+        code.finish();
+
+        EXPECT_EQ(code(), 2);
+        EXPECT_EQ(x, 2);
+    }
+}
@@ -0,0 +1,205 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(avx, encoding) {
+    if (!cpuinfo::host().avx2)
+        GTEST_SKIP();
+
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+    emitter.set_avx(false);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.adds(32, XMM1, XMM2), 4);
+    EXPECT_EQ(p[0], 0xf3); // legacy prefix
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0x58); // addss
+    EXPECT_EQ(p[3], 0xca); // modrm: xmm1, xmm2
+
+    emitter.set_avx(true);
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.adds(32, XMM1, XMM2, XMM3), 4);
+    EXPECT_EQ(p[0], 0xc5); // two byte vex
+    EXPECT_EQ(p[1], 0xea); // ~r, vvvv = xmm2, f3
+    EXPECT_EQ(p[2], 0x58); // vaddss
+    EXPECT_EQ(p[3], 0xcb); // modrm: xmm1, xmm3
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.padd(32, YMM9, YMM12), 5);
+    EXPECT_EQ(p[0], 0xc4); // three byte vex
+    EXPECT_EQ(p[1], 0x41); // ~x, map 0f
+    EXPECT_EQ(p[2], 0x35); // vvvv = ymm9, l, 66
+    EXPECT_EQ(p[3], 0xfe); // vpaddd
+    EXPECT_EQ(p[4], 0xcc); // modrm: ymm9, ymm12
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movx(64, XMM8, RAX), 5);
+    EXPECT_EQ(p[0], 0xc4); // three byte vex
+    EXPECT_EQ(p[1], 0x61); // ~x, ~b, map 0f
+    EXPECT_EQ(p[2], 0xf9); // w, vvvv unused, 66
+    EXPECT_EQ(p[3], 0x6e); // vmovq
+    EXPECT_EQ(p[4], 0xc0); // modrm: xmm8, rax
+
+    EXPECT_TRUE(emitter.is_ymm_used());
+}
+
+TEST(avx, three_operand) {
+    for (bool avx : { false, true }) {
+        if (avx && !cpuinfo::host().avx)
+            continue;
+
+        f64 a = 7.0, b = 2.0;
+        f64 sum, diff, rdiff, quot, mn;
+
+        func code("three_operand");
+        code.get_emitter().set_avx(avx);
+
+        scalar x = code.gen_local_f64("x");
+        scalar y = code.gen_local_f64("y");
+        code.gen_mov(x, code.gen_global_f64("a", &a));
+        code.gen_mov(y, code.gen_global_f64("b", &b));
+
+        scalar s = code.gen_global_f64("sum", &sum);
+        scalar d = code.gen_global_f64("diff", &diff);
+        scalar r = code.gen_global_f64("rdiff", &rdiff);
+        scalar q = code.gen_global_f64("quot", &quot);
+        scalar m = code.gen_global_f64("mn", &mn);
+
+        code.gen_add(s, x, y);
+        code.gen_sub(d, x, y);
+        code.gen_div(q, x, y);
+        code.gen_min(m, x, y);
+        code.gen_mov(r, y);
+        code.gen_sub(r, x, r); // destination aliases the second source
+        code.gen_ret();
+        code.finish();
+        code();
+
+        EXPECT_EQ(sum, a + b) << avx;
+        EXPECT_EQ(diff, a - b) << avx;
+        EXPECT_EQ(rdiff, a - b) << avx;
+        EXPECT_EQ(quot, a / b) << avx;
+        EXPECT_EQ(mn, b) << avx;
+    }
+}
+
+TEST(avx, no_copy) {
+    if (!cpuinfo::host().avx)
+        GTEST_SKIP();
+
+    func code("no_copy");
+    scalar x = code.gen_local_f32("x", 1.5f, XMM1);
+    scalar y = code.gen_local_f32("y", 2.5f, XMM2);
+    scalar z = code.gen_scratch_f32("z", XMM3);
+
+    // with all operands in registers this is a single two byte vex vaddss
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_add(z, x, y);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr() - p, 4);
+}
+
+TEST(avx, ymm) {
+    if (!cpuinfo::host().avx2)
+        GTEST_SKIP();
+
+    i32 a[8], b[8], r[8];
+    f64 c[4] = { 1.0, 2.5, -3.0, 8.0 };
+    f64 d[4] = { 0.5, 0.5, 4.0, -2.0 };
+    f64 e[4];
+    for (int i = 0; i < 8; i++) {
+        a[i] = i * 100;
+        b[i] = 1 - i;
+    }
+
+    func code("ymm");
+    vec va = code.gen_global_vec("a", 256, a);
+    vec vb = code.gen_global_vec("b", 256, b);
+    vec vr = code.gen_global_vec("r", 256, r);
+    vec vc = code.gen_global_vec("c", 256, c);
+    vec vd = code.gen_global_vec("d", 256, d);
+    vec ve = code.gen_global_vec("e", 256, e);
+
+    vec t = code.gen_scratch_vec("t", 256);
+    code.gen_mov(t, va);
+    code.gen_padd(32, t, vb);
+    code.gen_psll(32, t, 1);
+    code.gen_mov(vr, t);
+
+    vec u = code.gen_local_vec("u", 256);
+    code.gen_mov(u, vc);
+    code.gen_mulp(64, u, vd);
+    code.gen_mov(ve, u);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 8; i++)
+        EXPECT_EQ(r[i], (a[i] + b[i]) << 1) << i;
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(e[i], c[i] * d[i]) << i;
+}
+
+static f64 halved = 0.0;
+
+static void halve(f64 x) {
+    halved = x / 2.0;
+}
+
+TEST(avx, ymm_spill) {
+    if (!cpuinfo::host().avx2)
+        GTEST_SKIP();
+
+    const int N = 20;
+    u64 in[4] = { 1, 2, 3, 4 };
+    u64 out[4] = { 0 };
+
+    func code("ymm_spill");
+    vec vin = code.gen_global_vec("in", 256, in);
+    vec vout = code.gen_global_vec("out", 256, out);
+
+    vector<vec> vs;
+    for (int i = 0; i < N; i++) {
+        vs.push_back(code.gen_scratch_vec("v" + std::to_string(i), 256));
+        code.gen_mov(vs[i], vin);
+        code.gen_psll(64, vs[i], i);
+    }
+
+    // calling out clears the upper halves, values must survive in memory
+    scalar arg = code.gen_local_f64("arg", 9.0);
+    code.gen_call(halve, arg);
+
+    vec sum = code.gen_scratch_vec("sum", 256);
+    code.gen_pxor(sum, sum);
+    for (int i = 0; i < N; i++)
+        code.gen_padd(64, sum, vs[i]);
+    code.gen_mov(vout, sum);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(halved, 4.5);
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(out[i], in[i] * ((1ull << N) - 1)) << i;
+}
@@ -0,0 +1,190 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(bitcount, encoding) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.popcnt(64, RAX, RBX), 5);
+    EXPECT_EQ(p[0], 0xf3);
+    EXPECT_EQ(p[1], 0x48); // rex.w
+    EXPECT_EQ(p[2], 0x0f);
+    EXPECT_EQ(p[3], 0xb8); // popcnt
+    EXPECT_EQ(p[4], 0xc3); // modrm: rax, rbx
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.lzcnt(16, R8, RCX), 6);
+    EXPECT_EQ(p[0], 0xf3);
+    EXPECT_EQ(p[1], 0x66);
+    EXPECT_EQ(p[2], 0x44); // rex.r
+    EXPECT_EQ(p[3], 0x0f);
+    EXPECT_EQ(p[4], 0xbd); // lzcnt
+    EXPECT_EQ(p[5], 0xc1); // modrm: r8w, cx
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.bswap(64, R10), 3);
+    EXPECT_EQ(p[0], 0x49); // rex.w, rex.b
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0xca); // bswap r10
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movbe(32, RAX, memop(RDI, 4)), 5);
+    EXPECT_EQ(p[0], 0x0f);
+    EXPECT_EQ(p[1], 0x38);
+    EXPECT_EQ(p[2], 0xf0); // movbe load
+    EXPECT_EQ(p[3], 0x47); // modrm: eax, [rdi + disp8]
+    EXPECT_EQ(p[4], 0x04);
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movbe(64, memop(RSI, 0), RDX), 5);
+    EXPECT_EQ(p[0], 0x48);
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0x38);
+    EXPECT_EQ(p[3], 0xf1); // movbe store
+    EXPECT_EQ(p[4], 0x16); // modrm: rdx, [rsi]
+}
+
+TEST(bitcount, counts) {
+    u64 a = 0;
+    u32 b = 0;
+    u16 c = 0;
+    u64 pop64, clz64, ctz64;
+    u32 pop32, clz32, ctz32;
+    u16 pop16, clz16, ctz16;
+
+    func code("counts");
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i32("b", &b);
+    value vc = code.gen_global_i16("c", &c);
+    value vpop64 = code.gen_global_i64("pop64", &pop64);
+    value vclz64 = code.gen_global_i64("clz64", &clz64);
+    value vctz64 = code.gen_global_i64("ctz64", &ctz64);
+    value vpop32 = code.gen_global_i32("pop32", &pop32);
+    value vclz32 = code.gen_global_i32("clz32", &clz32);
+    value vctz32 = code.gen_global_i32("ctz32", &ctz32);
+    value vpop16 = code.gen_global_i16("pop16", &pop16);
+    value vclz16 = code.gen_global_i16("clz16", &clz16);
+    value vctz16 = code.gen_global_i16("ctz16", &ctz16);
+
+    code.gen_popcnt(vpop64, va);
+    code.gen_clz(vclz64, va);
+    code.gen_ctz(vctz64, va);
+    code.gen_popcnt(vpop32, vb);
+    code.gen_clz(vclz32, vb);
+    code.gen_ctz(vctz32, vb);
+    code.gen_popcnt(vpop16, vc);
+    code.gen_clz(vclz16, vc);
+    code.gen_ctz(vctz16, vc);
+    code.gen_ret();
+    code.finish();
+
+    for (u64 x : { 0x0ull, 0x1ull, 0x8000000000000000ull, ~0ull,
+                   0x0123456789abcdefull, 0x00f0000000010000ull,
+                   0x0000800000000400ull, 0xfedcba9800000000ull }) {
+        a = x;
+        b = (u32)(x >> 16);
+        c = (u16)(x >> 40);
+        code.exec();
+
+        EXPECT_EQ(pop64, (u64)__builtin_popcountll(a)) << std::hex << x;
+        EXPECT_EQ(clz64, a ? (u64)__builtin_clzll(a) : 64) << std::hex << x;
+        EXPECT_EQ(ctz64, a ? (u64)__builtin_ctzll(a) : 64) << std::hex << x;
+        EXPECT_EQ(pop32, (u32)__builtin_popcount(b)) << std::hex << x;
+        EXPECT_EQ(clz32, b ? (u32)__builtin_clz(b) : 32) << std::hex << x;
+        EXPECT_EQ(ctz32, b ? (u32)__builtin_ctz(b) : 32) << std::hex << x;
+        EXPECT_EQ(pop16, __builtin_popcount(c)) << std::hex << x;
+        EXPECT_EQ(clz16, c ? __builtin_clz(c) - 16 : 16) << std::hex << x;
+        EXPECT_EQ(ctz16, c ? __builtin_ctz(c) : 16) << std::hex << x;
+    }
+}
+
+TEST(bitcount, inplace) {
+    func code("inplace");
+    value x = code.gen_local_i64("x", 0x00ff00ff00000000);
+    value y = code.gen_local_i64("y", 0x0000000000001000);
+    code.gen_popcnt(x, x);
+    code.gen_ctz(y, y);
+    code.gen_add(x, y);
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(code(), 16 + 12);
+}
+
+TEST(bitcount, bswap) {
+    u64 a = 0x0123456789abcdef;
+    u32 b = 0x01234567;
+    u16 c = 0x0123;
+
+    func code("bswap");
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i32("b", &b);
+    value vc = code.gen_global_i16("c", &c);
+    code.gen_bswap(va);
+    code.gen_bswap(vb);
+    code.gen_bswap(vc);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(a, 0xefcdab8967452301);
+    EXPECT_EQ(b, 0x67452301);
+    EXPECT_EQ(c, 0x2301);
+}
+
+TEST(bitcount, loadstore) {
+    u8 data[24] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+    };
+
+    u64 a;
+    u32 b;
+    u16 c;
+
+    func code("loadstore");
+    value base = code.gen_local_val("base", 64, (i64)data);
+    value idx = code.gen_local_val("idx", 64, 1);
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i32("b", &b);
+    value vc = code.gen_global_i16("c", &c);
+    value x = code.gen_local_i32("x", 0x11223344);
+
+    code.gen_load_bswap(va, base);
+    code.gen_load_bswap(vc, base, idx, 2, 4);
+    code.gen_store_bswap(x, base, 8);
+    code.gen_store_bswap(va, base, idx, 4, 8);
+    code.gen_mov(vb, x); // x must not be swapped by the store
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(a, 0x0123456789abcdef);
+    EXPECT_EQ(c, 0xcdef);
+    EXPECT_EQ(b, 0x11223344);
+
+    const u8 expect[4] = { 0x11, 0x22, 0x33, 0x44 };
+    EXPECT_EQ(memcmp(data + 8, expect, 4), 0);
+    EXPECT_EQ(memcmp(data + 12, data, 8), 0);
+}
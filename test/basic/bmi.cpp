@@ -0,0 +1,228 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(bmi, encoding) {
+    if (!cpuinfo::host().bmi2)
+        GTEST_SKIP();
+
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.shlx(64, RAX, RBX, RCX), 5);
+    EXPECT_EQ(p[0], 0xc4);
+    EXPECT_EQ(p[1], 0xe2); // ~r, ~x, ~b, map 0f38
+    EXPECT_EQ(p[2], 0xf1); // w, vvvv = rcx, 66
+    EXPECT_EQ(p[3], 0xf7); // shlx
+    EXPECT_EQ(p[4], 0xc3); // modrm: rax, rbx
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.rorx(32, R9, RDX, 7), 6);
+    EXPECT_EQ(p[0], 0xc4);
+    EXPECT_EQ(p[1], 0x63); // ~x, ~b, map 0f3a
+    EXPECT_EQ(p[2], 0x7b); // vvvv unused, f2
+    EXPECT_EQ(p[3], 0xf0); // rorx
+    EXPECT_EQ(p[4], 0xca); // modrm: r9, rdx
+    EXPECT_EQ(p[5], 0x07);
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.blsr(64, RSI, memop(R12, 8)), 7);
+    EXPECT_EQ(p[0], 0xc4);
+    EXPECT_EQ(p[1], 0xc2); // ~r, ~x, map 0f38
+    EXPECT_EQ(p[2], 0xc8); // w, vvvv = rsi
+    EXPECT_EQ(p[3], 0xf3); // blsr group
+    EXPECT_EQ(p[4], 0x4c); // modrm: /1, [sib + disp8]
+    EXPECT_EQ(p[5], 0x24); // sib: r12
+    EXPECT_EQ(p[6], 0x08); // disp8
+}
+
+TEST(bmi, shifts) {
+    u64 a = 0xfedcba9876543210;
+    u64 n = 0;
+    u64 shl, shr, sar;
+    u32 shl32;
+
+    func code("shifts");
+    value va = code.gen_global_i64("a", &a);
+    value vn = code.gen_global_i64("n", &n);
+    value c = code.gen_local_i64("c", 42, RCX);
+
+    value vshl = code.gen_global_i64("shl", &shl);
+    value vshr = code.gen_global_i64("shr", &shr);
+    value vsar = code.gen_global_i64("sar", &sar);
+    value vshl32 = code.gen_global_i32("shl32", &shl32);
+
+    value x = code.gen_scratch_i64("x");
+    value y = code.gen_scratch_i32("y");
+    code.gen_mov(x, va);
+    code.gen_shl(x, vn);
+    code.gen_mov(vshl, x);
+    code.gen_mov(x, va);
+    code.gen_shr(x, vn);
+    code.gen_mov(vshr, x);
+    code.gen_mov(x, va);
+    code.gen_sha(x, vn);
+    code.gen_mov(vsar, x);
+    code.gen_mov(y, va);
+    code.gen_shl(y, vn);
+    code.gen_mov(vshl32, y);
+
+    // with bmi2 the shift count does not have to be moved into rcx
+    if (cpuinfo::host().bmi2) {
+        EXPECT_EQ(c.r(), RCX);
+    }
+
+    code.gen_ret(c);
+    code.finish();
+
+    for (n = 0; n < 64; n += 5) {
+        EXPECT_EQ(code(), 42);
+        EXPECT_EQ(shl, a << n) << n;
+        EXPECT_EQ(shr, a >> n) << n;
+        EXPECT_EQ(sar, (u64)((i64)a >> n)) << n;
+        EXPECT_EQ(shl32, (u32)a << (n % 32)) << n;
+    }
+}
+
+TEST(bmi, rotates) {
+    u32 a = 0x80000001;
+    u64 b = 0x0123456789abcdef;
+    u32 rol;
+    u64 ror;
+
+    func code("rotates");
+    value va = code.gen_global_i32("a", &a);
+    value vb = code.gen_global_i64("b", &b);
+    value vrol = code.gen_global_i32("rol", &rol);
+    value vror = code.gen_global_i64("ror", &ror);
+
+    code.gen_rol(vrol, va, 4);
+    code.gen_ror(vror, vb, 12);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(rol, 0x00000018u);
+    EXPECT_EQ(ror, 0xdef0123456789abcull);
+}
+
+TEST(bmi, bitops) {
+    u64 a = 0xf0f0f0f0f0f0f0f0, b = 0x123456789abcdef0;
+    u64 andn, blsr, blsi, blsr_self;
+
+    func code("bitops");
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i64("b", &b);
+    value vandn = code.gen_global_i64("andn", &andn);
+    value vblsr = code.gen_global_i64("blsr", &blsr);
+    value vblsi = code.gen_global_i64("blsi", &blsi);
+    value vself = code.gen_global_i64("blsr_self", &blsr_self);
+
+    code.gen_andn(vandn, va, vb);
+    code.gen_blsr(vblsr, vb);
+    code.gen_blsi(vblsi, vb);
+    code.gen_mov(vself, va);
+    code.gen_blsr(vself, vself);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(andn, ~a & b);
+    EXPECT_EQ(blsr, b & (b - 1));
+    EXPECT_EQ(blsi, b & -b);
+    EXPECT_EQ(blsr_self, a & (a - 1));
+}
+
+TEST(bmi, bzhi) {
+    u64 a = ~0ull;
+    u64 n = 0;
+    u64 res64;
+    u32 res32;
+
+    func code("bzhi");
+    value va = code.gen_global_i64("a", &a);
+    value vn = code.gen_global_i64("n", &n);
+    value r64 = code.gen_global_i64("res64", &res64);
+    value r32 = code.gen_global_i32("res32", &res32);
+    value a32 = code.gen_scratch_i32("a32");
+
+    code.gen_bzhi(r64, va, vn);
+    code.gen_mov(a32, va);
+    code.gen_bzhi(r32, a32, vn);
+    code.gen_ret();
+    code.finish();
+
+    for (n = 0; n < 80; n += 7) {
+        code();
+        EXPECT_EQ(res64, n >= 64 ? a : (1ull << n) - 1) << n;
+        EXPECT_EQ(res32, n >= 32 ? (u32)a : (1u << n) - 1) << n;
+    }
+}
+
+TEST(bmi, deposit_extract) {
+    u64 src = 0x00000000000000b5;
+    u64 mask = 0xf00f0000000000f0;
+    u64 dep, ext;
+    u32 ext32;
+
+    func code("deposit_extract");
+    value vsrc = code.gen_global_i64("src", &src);
+    value vmask = code.gen_global_i64("mask", &mask);
+    value vdep = code.gen_global_i64("dep", &dep);
+    value vext = code.gen_global_i64("ext", &ext);
+    value vext32 = code.gen_global_i32("ext32", &ext32);
+    value s32 = code.gen_scratch_i32("s32");
+    value m32 = code.gen_scratch_i32("m32");
+
+    code.gen_pdep(vdep, vsrc, vmask);
+    code.gen_pext(vext, vdep, vmask);
+    code.gen_mov(s32, vsrc);
+    code.gen_mov(m32, vmask);
+    code.gen_pext(vext32, s32, m32);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(dep, 0x000b000000000050ull);
+    EXPECT_EQ(ext, src);
+    EXPECT_EQ(ext32, 0xbu);
+}
+
+TEST(bmi, mulx) {
+    u64 a = 0xfedcba9876543210, b = 0x0123456789abcdef;
+    u64 hi, lo;
+
+    func code("mulx");
+    value vhi = code.gen_global_i64("hi", &hi);
+    value vlo = code.gen_global_i64("lo", &lo);
+    code.gen_mov(vlo, code.gen_global_i64("a", &a));
+    code.gen_umul(vhi, vlo, code.gen_global_i64("b", &b));
+    code.gen_ret();
+    code.finish();
+    code();
+
+    unsigned __int128 res = (unsigned __int128)a * b;
+    EXPECT_EQ(hi, (u64)(res >> 64));
+    EXPECT_EQ(lo, (u64)res);
+}
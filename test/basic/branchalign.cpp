@@ -0,0 +1,246 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+static bool crosses(const u8* start, const u8* end) {
+    return (u64)start / 32 != (u64)end / 32;
+}
+
+// push rax; pop rax: two bytes that change neither registers nor flags
+static void fill(func& code, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        code.get_emitter().push(RAX);
+        code.get_emitter().pop(RAX);
+    }
+}
+
+TEST(branchalign, fused) {
+    for (size_t k = 0; k < 64; k++) {
+        cbuf buffer(4 * KiB);
+        emitter e(buffer);
+        e.set_align_branches();
+        buffer.pad(k);
+
+        fixup fix;
+        e.cmpr(64, RAX, RBX);
+        e.jz(0, &fix);
+
+        u8* end = fix.code + fix.size;
+        u8* start = end - 5;
+        EXPECT_EQ(end, buffer.get_code_ptr());
+        EXPECT_EQ(start[0], 0x48) << "at " << k;
+        EXPECT_EQ(start[1], 0x39) << "at " << k; // cmp rax, rbx
+        EXPECT_EQ(start[3], 0x74) << "at " << k; // jz rel8
+        EXPECT_FALSE(crosses(start, end)) << "at " << k;
+        EXPECT_LE(start - buffer.get_code_entry(), k + 31);
+    }
+}
+
+TEST(branchalign, jumps) {
+    for (size_t k = 0; k < 64; k++) {
+        cbuf buffer(4 * KiB);
+        emitter e(buffer);
+        e.set_align_branches();
+        buffer.pad(k);
+
+        fixup fix;
+        e.jmpi(1000, &fix);
+        EXPECT_EQ(fix.code[-1], 0xe9);
+        EXPECT_FALSE(crosses(fix.code - 1, fix.code + 4)) << "at " << k;
+
+        e.call(buffer.get_code_entry());
+        EXPECT_FALSE(crosses(buffer.get_code_ptr() - 5,
+                             buffer.get_code_ptr())) << "at " << k;
+
+        e.ret();
+        EXPECT_FALSE(crosses(buffer.get_code_ptr() - 1,
+                             buffer.get_code_ptr())) << "at " << k;
+    }
+}
+
+TEST(branchalign, execute) {
+    for (size_t k = 0; k < 32; k++) {
+        func code("execute");
+        code.get_emitter().set_align_branches();
+        value x = code.gen_local_i64("x", 0);
+        value n = code.gen_local_i64("n", 0);
+
+        label loop = code.gen_label("loop");
+        label done = code.gen_label("done");
+
+        code.get_cbuffer().pad(k);
+        loop.place();
+        code.gen_cmp(n, 10);
+        code.gen_jge(done);
+        code.gen_add(x, n);
+        code.gen_add(n, 1);
+        code.gen_jmp(loop);
+
+        done.place();
+        code.gen_ret(x);
+        code.finish();
+
+        EXPECT_EQ(code(), 45) << "at " << k;
+    }
+}
+
+TEST(branchalign, relaxed) {
+    u64 a = 1;
+
+    func code("relaxed");
+    code.get_emitter().set_align_branches();
+    value va = code.gen_global_i64("a", &a);
+    value x = code.gen_local_i64("x", 0);
+
+    label skip = code.gen_label("skip");
+    label done = code.gen_label("done");
+
+    code.gen_cmp(va, 0);
+    code.gen_jz(skip);
+    code.gen_mov(x, 2);
+    code.get_alloc().flush_all_regs();
+
+    // r11 equals itself, so none of these jumps is taken; all of them grow
+    // when done is placed, as does the jz once skip is placed
+    emitter& e = code.get_emitter();
+    for (size_t i = 1; i <= 8; i++) {
+        fixup fix;
+        e.nop(i);
+        e.cmpr(64, R11, R11);
+        e.jnz(0, &fix);
+        done.add(fix);
+    }
+
+    fill(code, 70);
+    skip.place();
+    code.gen_add(x, 1);
+    done.place();
+    code.gen_ret(x);
+    code.finish();
+
+    size_t pairs = 0;
+    for (u8* p = code.entry(); p + 3 < code.final(); p++) {
+        if (p[0] != 0x4d || p[1] != 0x39 || p[2] != 0xdb)
+            continue;
+
+        ASSERT_EQ(p[3], 0x0f) << "expected jnz rel32";
+        EXPECT_EQ(p[4], 0x85) << "expected jnz rel32";
+        EXPECT_FALSE(crosses(p, p + 9)) << "pair " << pairs;
+        pairs++;
+    }
+
+    EXPECT_EQ(pairs, 8);
+    EXPECT_EQ(code(), 3);
+    a = 0;
+    EXPECT_EQ(code(), 1);
+}
+
+TEST(branchalign, blocks) {
+    func code("blocks");
+    code.get_emitter().set_align_branches();
+    value x = code.gen_local_i64("x", 0);
+
+    label near = code.gen_label("near");
+    label far = code.gen_label("far");
+
+    code.get_alloc().flush_all_regs();
+    cbuf& buffer = code.get_cbuffer();
+    buffer.pad(64 - (u64)buffer.get_code_ptr() % 64 + 60);
+    near.place();
+    EXPECT_EQ((u64)near.get_address() % 64, 0);
+
+    code.gen_add(x, 1);
+    code.get_alloc().flush_all_regs();
+    buffer.pad(64 - (u64)buffer.get_code_ptr() % 64 + 40);
+    far.place();
+    EXPECT_EQ((u64)far.get_address() % 64, 40);
+
+    code.gen_add(x, 1);
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(code(), 2);
+}
+
+TEST(branchalign, backward) {
+    // padding in front of the compare can push the short jnz out of reach
+    // of its target after the encoding has been chosen
+    for (size_t n = 54; n < 64; n++) {
+        for (size_t k = 0; k < 64; k++) {
+            func code("backward");
+            code.get_emitter().set_align_branches();
+            value x = code.gen_local_i64("x", 0);
+            value i = code.gen_local_i64("i", 3);
+
+            label loop = code.gen_label("loop");
+            code.get_cbuffer().pad(k);
+            loop.place();
+            fill(code, n);
+            code.gen_add(x, 1);
+            code.gen_sub(i, 1);
+            code.gen_jnz(loop);
+
+            code.get_alloc().flush_all_regs();
+            fill(code, n);
+            code.get_emitter().cmpr(64, R11, R11);
+            code.gen_jnz(loop);
+
+            code.gen_ret(x);
+            code.finish();
+
+            EXPECT_EQ(code(), 3) << "at " << n << "/" << k;
+        }
+    }
+}
+
+TEST(branchalign, padding) {
+    // a short branch that grows when its target gets placed must not move
+    // the target back into the end of a cache line
+    for (size_t n = 56; n < 72; n++) {
+        for (size_t k = 0; k < 64; k++) {
+            func code("padding");
+            code.get_emitter().set_align_branches();
+            value x = code.gen_local_i64("x", 0);
+
+            label skip = code.gen_label("skip");
+            code.get_alloc().flush_all_regs();
+            code.get_cbuffer().pad(k);
+
+            fixup fix;
+            code.get_emitter().cmpr(64, R11, R11);
+            code.get_emitter().jnz(0, &fix);
+            skip.add(fix);
+            fill(code, n);
+
+            skip.place();
+            u64 offset = (u64)skip.get_address() % 64;
+            EXPECT_LE(offset, 64 - 16) << "at " << n << "/" << k;
+
+            code.gen_add(x, 1);
+            code.gen_ret(x);
+            code.finish();
+
+            EXPECT_EQ(code(), 1) << "at " << n << "/" << k;
+        }
+    }
+}
@@ -141,3 +141,30 @@ TEST(call, fp) {
 
     EXPECT_EQ(result, 1337);
 }
+
+i64 test_add(void* bptr, i64 val) {
+    (void)bptr;
+    return val + 1;
+}
+
+TEST(call, preserve) {
+    func code("test", 4 * KiB);
+
+    value loc = code.gen_local_i64("loc", 40, RCX);
+    value tmp = code.gen_scratch_i64("tmp", 2, R8);
+    value ret = code.gen_call(test_add, loc);
+
+    EXPECT_FALSE(tmp.is_dead()) << "scratch value lost across call";
+    EXPECT_TRUE(stl_contains(callee_saved_regs, loc.r()));
+    EXPECT_TRUE(stl_contains(callee_saved_regs, tmp.r()));
+    EXPECT_TRUE(loc.is_dirty()) << "local written back before call";
+
+    code.gen_add(ret, loc);
+    code.gen_add(ret, tmp);
+    code.gen_ret(ret);
+    code.finish();
+
+    i64 result = code();
+
+    EXPECT_EQ(result, 41 + 40 + 2);
+}
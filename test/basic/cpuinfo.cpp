@@ -0,0 +1,244 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+// runs each test with all instruction set extensions disabled, so that the
+// fallback paths get exercised independent of the host cpu
+class baseline : public ::testing::Test {
+protected:
+    void SetUp() override { cpuinfo::set(cpuinfo::baseline()); }
+    void TearDown() override { cpuinfo::set(cpuinfo::host()); }
+};
+
+TEST(cpuinfo, override) {
+    const cpuinfo& host = cpuinfo::host();
+    EXPECT_EQ(cpuinfo::get().avx, host.avx);
+    EXPECT_EQ(cpuinfo::get().bmi2, host.bmi2);
+
+    cpuinfo info = host;
+    info.bmi2 = false;
+    cpuinfo::set(info);
+    EXPECT_FALSE(cpuinfo::get().bmi2);
+    EXPECT_EQ(cpuinfo::get().bmi1, host.bmi1);
+
+    cpuinfo::set(cpuinfo::baseline());
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+    EXPECT_FALSE(emitter.is_avx());
+    EXPECT_FALSE(emitter.is_avx2());
+
+    cpuinfo::set(host);
+    EXPECT_EQ(cpuinfo::get().bmi2, host.bmi2);
+}
+
+TEST_F(baseline, sse) {
+    f64 a = 7.0, b = 2.0;
+    f64 sum, rdiff;
+
+    func code("sse");
+    EXPECT_FALSE(code.get_emitter().is_avx());
+
+    scalar x = code.gen_local_f64("x");
+    scalar y = code.gen_local_f64("y");
+    code.gen_mov(x, code.gen_global_f64("a", &a));
+    code.gen_mov(y, code.gen_global_f64("b", &b));
+
+    scalar s = code.gen_global_f64("sum", &sum);
+    scalar r = code.gen_global_f64("rdiff", &rdiff);
+    code.gen_add(s, x, y);
+    code.gen_mov(r, y);
+    code.gen_sub(r, x, r);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(sum, a + b);
+    EXPECT_EQ(rdiff, a - b);
+}
+
+TEST_F(baseline, shifts) {
+    u64 a = 0xfedcba9876543210;
+    u64 n = 0;
+    u64 shl, sar, rol;
+
+    func code("shifts");
+    value va = code.gen_global_i64("a", &a);
+    value vn = code.gen_global_i64("n", &n);
+    value vshl = code.gen_global_i64("shl", &shl);
+    value vsar = code.gen_global_i64("sar", &sar);
+    value vrol = code.gen_global_i64("rol", &rol);
+
+    value x = code.gen_scratch_i64("x");
+    code.gen_mov(x, va);
+    code.gen_shl(x, vn);
+    code.gen_mov(vshl, x);
+    code.gen_mov(x, va);
+    code.gen_sha(x, vn);
+    code.gen_mov(vsar, x);
+    code.gen_rol(vrol, va, 8);
+    code.gen_ret();
+    code.finish();
+
+    for (n = 0; n < 64; n += 7) {
+        code.exec();
+        EXPECT_EQ(shl, a << n) << n;
+        EXPECT_EQ(sar, (u64)((i64)a >> n)) << n;
+        EXPECT_EQ(rol, 0xdcba9876543210fe);
+    }
+}
+
+TEST_F(baseline, bitops) {
+    u64 a = 0xf0f0f0f0f0f0f0f0, b = 0x123456789abcdef0;
+    u64 andn, blsr, bzhi, pdep, pext, hi;
+
+    func code("bitops");
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i64("b", &b);
+    value vandn = code.gen_global_i64("andn", &andn);
+    value vblsr = code.gen_global_i64("blsr", &blsr);
+    value vbzhi = code.gen_global_i64("bzhi", &bzhi);
+    value vpdep = code.gen_global_i64("pdep", &pdep);
+    value vpext = code.gen_global_i64("pext", &pext);
+    value vhi = code.gen_global_i64("hi", &hi);
+    value idx = code.gen_local_i64("idx", 12);
+
+    code.gen_andn(vandn, va, vb);
+    code.gen_blsr(vblsr, vb);
+    code.gen_bzhi(vbzhi, vb, idx);
+    code.gen_pdep(vpdep, vb, va);
+    code.gen_pext(vpext, vb, va);
+
+    value lo = code.gen_scratch_i64("lo");
+    code.gen_mov(lo, va);
+    code.gen_umul(vhi, lo, vb);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(andn, ~a & b);
+    EXPECT_EQ(blsr, b & (b - 1));
+    EXPECT_EQ(bzhi, b & 0xfff);
+    EXPECT_EQ(pdep, 0x90a0b0c0d0e0f000ull);
+    EXPECT_EQ(pext, 0x13579bdfull);
+    EXPECT_EQ(hi, (u64)(((unsigned __int128)a * b) >> 64));
+}
+
+TEST_F(baseline, counts) {
+    u64 a = 0x0000800000000400;
+    u8 data[8] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+    u8 b = 0xb5;
+    u64 be;
+
+    func code("counts");
+    value va = code.gen_global_i64("a", &a);
+    value vb = code.gen_global_i8("b", &b);
+    value base = code.gen_local_val("base", 64, (i64)data);
+    value vbe = code.gen_global_i64("be", &be);
+    value pop = code.gen_local_i64("pop", 0);
+    value clz = code.gen_local_i64("clz", 0);
+    value ctz = code.gen_local_i64("ctz", 0);
+    value pop8 = code.gen_local_i8("pop8", 0);
+
+    code.gen_popcnt(pop, va);
+    code.gen_clz(clz, va);
+    code.gen_ctz(ctz, va);
+    code.gen_popcnt(pop8, vb);
+    code.gen_load_bswap(vbe, base);
+    code.gen_store_bswap(va, base);
+
+    value res = code.gen_scratch_i64("res");
+    code.gen_shl(clz, 8);
+    code.gen_shl(ctz, 16);
+    code.gen_mov(res, pop);
+    code.gen_or(res, clz);
+    code.gen_or(res, ctz);
+    code.gen_zxt(pop, pop8);
+    code.gen_shl(pop, 24);
+    code.gen_or(res, pop);
+    code.gen_ret(res);
+    code.finish();
+
+    EXPECT_EQ(code(), 2u | 16u << 8 | 10u << 16 | 5u << 24);
+    EXPECT_EQ(be, 0x0123456789abcdef);
+    EXPECT_EQ(data[2], 0x80);
+    EXPECT_EQ(data[6], 0x04);
+}
+
+TEST_F(baseline, vec) {
+    alignas(16) u16 a[8] = { 1, 2, 3, 4, 0xfff0, 6, 7, 0x8000 };
+    alignas(16) u16 b[8] = { 8, 7, 6, 5, 4, 3, 2, 1 };
+    alignas(16) u16 mul[8], mins[8], minu[8];
+
+    // the sse2 lane widths keep working without sse4.1
+    func code("vec");
+    vec va = code.gen_global_vec("a", a);
+    vec vb = code.gen_global_vec("b", b);
+    vec vmul = code.gen_global_vec("mul", mul);
+    vec vmins = code.gen_global_vec("mins", mins);
+    vec vminu = code.gen_global_vec("minu", minu);
+
+    code.gen_mov(vmul, va);
+    code.gen_pmul(16, vmul, vb);
+    code.gen_mov(vmins, va);
+    code.gen_pmins(16, vmins, vb);
+    code.gen_mov(vminu, va);
+    code.gen_pminu(8, vminu, vb);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(mul[i], (u16)(a[i] * b[i])) << i;
+        EXPECT_EQ(mins[i], (u16)std::min((i16)a[i], (i16)b[i])) << i;
+        u16 lo = std::min(a[i] & 0xff, b[i] & 0xff);
+        u16 hi = std::min(a[i] >> 8, b[i] >> 8);
+        EXPECT_EQ(minu[i], (u16)(hi << 8 | lo)) << i;
+    }
+}
+
+static void gen_vec_op(void (*op)(func&, vec&, vec&)) {
+    func code("vec_ext");
+    vec x = code.gen_scratch_vec("x");
+    vec y = code.gen_scratch_vec("y");
+    op(code, x, y);
+}
+
+TEST_F(baseline, vec_ext) {
+    // the newer encodings raise #UD on sse2-only hosts, so refuse them
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pmul(32, x, y); }), "sse4.1 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pmins(32, x, y); }), "sse4.1 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pmaxu(16, x, y); }), "sse4.1 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pcmpeq(64, x, y); }), "sse4.1 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pcmpgt(64, x, y); }), "sse4.2 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_pshufb(x, y); }), "ssse3 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_blend(16, x, y, 0x0f); }), "sse4.1 not supported");
+    EXPECT_DEATH(gen_vec_op([](func& code, vec& x, vec& y) {
+        code.gen_blendv(8, x, y, y); }), "sse4.1 not supported");
+}
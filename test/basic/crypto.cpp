@@ -0,0 +1,306 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+// minimal reference implementations of the aes round steps; the state is
+// stored column by column like in the xmm registers
+static u8 gmul(u8 a, u8 b) {
+    u8 p = 0;
+    for (; b != 0; b >>= 1) {
+        if (b & 1)
+            p ^= a;
+        a = (a << 1) ^ ((a & 0x80) ? 0x1b : 0);
+    }
+    return p;
+}
+
+static u8 sbox(u8 x) {
+    u8 inv = 0;
+    for (int i = 1; x != 0 && i < 256; i++) {
+        if (gmul(x, i) == 1) {
+            inv = i;
+            break;
+        }
+    }
+
+    u8 s = 0x63;
+    for (int i = 0; i < 5; i++)
+        s ^= (u8)(inv << i | inv >> (8 - i));
+    return s;
+}
+
+static void aes_round(u8* out, const u8* in, const u8* key, bool mix) {
+    u8 t[16];
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            t[r + 4 * c] = sbox(in[r + 4 * ((c + r) % 4)]);
+
+    for (int c = 0; mix && c < 4; c++) {
+        u8 a0 = t[4 * c], a1 = t[4 * c + 1], a2 = t[4 * c + 2],
+           a3 = t[4 * c + 3];
+        t[4 * c + 0] = gmul(a0, 2) ^ gmul(a1, 3) ^ a2 ^ a3;
+        t[4 * c + 1] = a0 ^ gmul(a1, 2) ^ gmul(a2, 3) ^ a3;
+        t[4 * c + 2] = a0 ^ a1 ^ gmul(a2, 2) ^ gmul(a3, 3);
+        t[4 * c + 3] = gmul(a0, 3) ^ a1 ^ a2 ^ gmul(a3, 2);
+    }
+
+    for (int i = 0; i < 16; i++)
+        out[i] = t[i] ^ key[i];
+}
+
+static u32 subword(u32 w) {
+    return sbox(w) | sbox(w >> 8) << 8 | sbox(w >> 16) << 16 |
+           (u32)sbox(w >> 24) << 24;
+}
+
+static u32 ror(u32 x, int n) {
+    return x >> n | x << (32 - n);
+}
+
+// emits op on a copy of a and b, returning the result in a
+template <typename OP>
+static void run(OP op, u32* a, const u32* b) {
+    alignas(16) u32 x[4], y[4];
+    memcpy(x, a, sizeof(x));
+    memcpy(y, b, sizeof(y));
+
+    func code("crypto");
+    vec vx = code.gen_global_vec("x", x);
+    vec vy = code.gen_global_vec("y", y);
+    vec t = code.gen_scratch_vec("t");
+    code.gen_mov(t, vx);
+    op(code, t, vy);
+    code.gen_mov(vx, t);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    memcpy(a, x, sizeof(x));
+}
+
+static const u32 A[4] = { 0x33221100, 0x77665544, 0xbbaa9988, 0xffeeddcc };
+static const u32 B[4] = { 0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c };
+
+TEST(crypto, encoding) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.crc32(64, RAX, RCX), 6);
+    EXPECT_EQ(p[0], 0xf2);
+    EXPECT_EQ(p[1], 0x48); // rex.w
+    EXPECT_EQ(p[2], 0x0f);
+    EXPECT_EQ(p[3], 0x38);
+    EXPECT_EQ(p[4], 0xf1); // crc32
+    EXPECT_EQ(p[5], 0xc1); // modrm: rax, rcx
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.crc32(16, RAX, memop(RSI, 0)), 6);
+    EXPECT_EQ(p[0], 0x66);
+    EXPECT_EQ(p[1], 0xf2);
+    EXPECT_EQ(p[4], 0xf1);
+    EXPECT_EQ(p[5], 0x06); // modrm: eax, [rsi]
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.sha256rnds2(XMM1, XMM10), 5);
+    EXPECT_EQ(p[0], 0x41); // rex.b, never vex encoded
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0x38);
+    EXPECT_EQ(p[3], 0xcb); // sha256rnds2
+    EXPECT_EQ(p[4], 0xca); // modrm: xmm1, xmm10
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.sha1rnds4(XMM1, XMM2, 3), 5);
+    EXPECT_EQ(p[1], 0x3a);
+    EXPECT_EQ(p[2], 0xcc); // sha1rnds4
+    EXPECT_EQ(p[4], 0x03);
+}
+
+TEST(crypto, crc32) {
+    // the standard crc-32c check value over "123456789", accumulated in
+    // different chunk sizes
+    const char* data = "123456789";
+
+    for (bool sse42 : { true, false }) {
+        cpuinfo info = cpuinfo::host();
+        info.sse42 = info.sse42 && sse42;
+        cpuinfo::set(info);
+
+        u32 bytes = 0, wide = 0, mixed = 0;
+
+        func code("crc32");
+        value base = code.gen_local_val("base", 64, (i64)data);
+        value vb = code.gen_global_i32("bytes", &bytes);
+        value vw = code.gen_global_i32("wide", &wide);
+        value vm = code.gen_global_i32("mixed", &mixed);
+        value c = code.gen_local_i8("c", 0);
+        value h = code.gen_local_i16("h", 0);
+        value w = code.gen_local_i32("w", 0);
+        value q = code.gen_local_i64("q", 0);
+
+        code.gen_mov(vb, -1);
+        for (int i = 0; i < 9; i++) {
+            code.gen_load(c, base, i);
+            code.gen_crc32(vb, c);
+        }
+        code.gen_not(vb);
+
+        code.gen_mov(vw, -1);
+        code.gen_load(q, base);
+        code.gen_crc32(vw, q);
+        code.gen_crc32(vw, c);
+        code.gen_not(vw);
+
+        code.gen_mov(vm, -1);
+        code.gen_load(w, base);
+        code.gen_crc32(vm, w);
+        code.gen_load(h, base, 4);
+        code.gen_crc32(vm, h);
+        code.gen_load(c, base, 6);
+        code.gen_crc32(vm, c);
+        code.gen_load(h, base, 7);
+        code.gen_crc32(vm, h);
+        code.gen_not(vm);
+        code.gen_ret();
+        code.finish();
+        code();
+
+        EXPECT_EQ(bytes, 0xe3069283) << "sse4.2 " << sse42;
+        EXPECT_EQ(wide, 0xe3069283) << "sse4.2 " << sse42;
+        EXPECT_EQ(mixed, 0xe3069283) << "sse4.2 " << sse42;
+    }
+
+    cpuinfo::set(cpuinfo::host());
+}
+
+TEST(crypto, aes) {
+    if (!cpuinfo::host().aes)
+        GTEST_SKIP();
+
+    const u32 zero[4] = { 0 };
+    u32 r[4], ref[4];
+
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) { f.gen_aesenc(d, s); }, r, B);
+    aes_round((u8*)ref, (const u8*)A, (const u8*)B, true);
+    EXPECT_EQ(memcmp(r, ref, sizeof(r)), 0) << "aesenc";
+
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) { f.gen_aesenclast(d, s); }, r, B);
+    aes_round((u8*)ref, (const u8*)A, (const u8*)B, false);
+    EXPECT_EQ(memcmp(r, ref, sizeof(r)), 0) << "aesenclast";
+
+    // without round keys the last decryption round inverts the last
+    // encryption round
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) {
+        f.gen_aesenclast(d, s);
+        f.gen_aesdeclast(d, s);
+    }, r, zero);
+    EXPECT_EQ(memcmp(r, A, sizeof(r)), 0) << "aesdeclast";
+
+    // aesdec after aesenclast only leaves inverse mix columns behind
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) {
+        f.gen_aesenclast(d, s);
+        f.gen_aesdec(d, s);
+    }, r, zero);
+    memcpy(ref, zero, sizeof(ref));
+    run([](func& f, vec& d, vec& s) { f.gen_aesimc(d, s); }, ref, A);
+    EXPECT_EQ(memcmp(r, ref, sizeof(r)), 0) << "aesdec/aesimc";
+
+    memcpy(r, zero, sizeof(r));
+    run([](func& f, vec& d, vec& s) { f.gen_aeskeygenassist(d, s, 0x1b); },
+        r, A);
+    EXPECT_EQ(r[0], subword(A[1]));
+    EXPECT_EQ(r[1], ror(subword(A[1]), 8) ^ 0x1b);
+    EXPECT_EQ(r[2], subword(A[3]));
+    EXPECT_EQ(r[3], ror(subword(A[3]), 8) ^ 0x1b);
+}
+
+TEST(crypto, pclmul) {
+    if (!cpuinfo::host().pclmul)
+        GTEST_SKIP();
+
+    for (u8 imm : { 0x00, 0x01, 0x10, 0x11 }) {
+        u64 a = ((const u64*)A)[imm & 1];
+        u64 b = ((const u64*)B)[imm >> 4];
+        u64 lo = 0, hi = 0;
+        for (int i = 0; i < 64; i++) {
+            if (b >> i & 1) {
+                lo ^= a << i;
+                hi ^= i ? a >> (64 - i) : 0;
+            }
+        }
+
+        u64 r[2];
+        memcpy(r, A, sizeof(r));
+        run([imm](func& f, vec& d, vec& s) { f.gen_pclmul(d, s, imm); },
+            (u32*)r, B);
+        EXPECT_EQ(r[0], lo) << (int)imm;
+        EXPECT_EQ(r[1], hi) << (int)imm;
+    }
+}
+
+TEST(crypto, sha) {
+    if (!cpuinfo::host().sha)
+        GTEST_SKIP();
+
+    u32 r[4];
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) { f.gen_sha1msg1(d, s); }, r, B);
+    EXPECT_EQ(r[3], A[1] ^ A[3]);
+    EXPECT_EQ(r[2], A[0] ^ A[2]);
+    EXPECT_EQ(r[1], B[3] ^ A[1]);
+    EXPECT_EQ(r[0], B[2] ^ A[0]);
+
+    auto sigma0 = [](u32 x) { return ror(x, 7) ^ ror(x, 18) ^ x >> 3; };
+    memcpy(r, A, sizeof(r));
+    run([](func& f, vec& d, vec& s) { f.gen_sha256msg1(d, s); }, r, B);
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(r[i], A[i] + sigma0(i < 3 ? A[i + 1] : B[0])) << i;
+
+    // two rounds on the state { a, b, e, f } in src and { c, d, g, h } in
+    // dest, with the message and round constant words taken from xmm0
+    alignas(16) u32 wk[4] = { 0x428a2f98, 0x71374491, 0, 0 };
+    u32 s[8] = { B[3], B[2], A[3], A[2], B[1], B[0], A[1], A[0] };
+    for (int i = 0; i < 2; i++) {
+        u32 t1 = s[7] + (ror(s[4], 6) ^ ror(s[4], 11) ^ ror(s[4], 25)) +
+                 ((s[4] & s[5]) ^ (~s[4] & s[6])) + wk[i];
+        u32 t2 = (ror(s[0], 2) ^ ror(s[0], 13) ^ ror(s[0], 22)) +
+                 ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, 7 * sizeof(u32));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    memcpy(r, A, sizeof(r));
+    run([&wk](func& f, vec& d, vec& s) {
+        vec vwk = f.gen_global_vec("wk", wk);
+        f.gen_sha256rnds2(d, s, vwk);
+    }, r, B);
+    EXPECT_EQ(r[3], s[0]);
+    EXPECT_EQ(r[2], s[1]);
+    EXPECT_EQ(r[1], s[4]);
+    EXPECT_EQ(r[0], s[5]);
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(deadstore, kill_local) {
+    func code("kill_local");
+
+    value a = code.gen_local_i64("a", 1);
+    value b = code.gen_local_i64("b", 2);
+    label l = code.gen_label("l");
+
+    code.gen_add(a, 40);
+    code.gen_add(b, a);
+    code.kill_value(a);
+
+    EXPECT_FALSE(a.is_dead()) << "killed local should remain allocated";
+    EXPECT_EQ(code.get_alloc().count_dirty_regs(), 1);
+
+    u8* ptr = code.get_cbuffer().get_code_ptr();
+    code.kill_value(b);
+    l.place(true);
+
+    size_t nbytes = code.get_cbuffer().get_code_ptr() - ptr;
+    EXPECT_EQ(nbytes, 0) << "write-back of killed value emitted";
+
+    code.gen_mov(a, 42);
+    code.gen_ret(a);
+    code.finish();
+
+    i64 ret = code();
+    EXPECT_EQ(ret, 42);
+}
+
+TEST(deadstore, ret) {
+    func code("ret");
+
+    value a = code.gen_local_i64("a", 1);
+    code.gen_add(a, 41);
+    EXPECT_EQ(code.get_alloc().count_dirty_regs(), 1);
+
+    u8* ptr = code.get_cbuffer().get_code_ptr();
+    code.gen_ret(); // short jump back to exit: opcode 0xeb + 8bit offset
+
+    size_t nbytes = code.get_cbuffer().get_code_ptr() - ptr;
+    EXPECT_EQ(nbytes, 2) << "locals written back before return";
+    EXPECT_EQ(code.get_alloc().count_dirty_regs(), 0);
+
+    code.finish();
+    code();
+}
+
+TEST(deadstore, global) {
+    u64 global = 1;
+    u64 other = 2;
+
+    func code("global");
+    value g = code.gen_global_i64("g", &global);
+    value o = code.gen_global_i64("o", &other);
+
+    g.fetch();
+    o.fetch();
+    code.gen_add(g, 10);
+    code.gen_add(o, 20);
+    code.kill_value(g); // pretend g gets overwritten later
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(global, 1) << "killed global written back";
+    EXPECT_EQ(other, 22) << "live global not written back";
+}
@@ -0,0 +1,165 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+#include <limits>
+#include <random>
+
+using namespace ftl;
+
+template <typename T>
+static void gen_divmod(func& code, value& q, value& r, T d) {
+    if (std::is_signed<T>::value) {
+        code.gen_idiv(q, (i64)d);
+        code.gen_imod(r, (i64)d);
+    } else {
+        code.gen_udiv(q, (u64)d);
+        code.gen_umod(r, (u64)d);
+    }
+}
+
+template <typename T>
+static void check_divmod(T d, const vector<T>& dividends) {
+    T x = 0, q = 0, r = 0;
+
+    func code("divmod");
+    value vx = code.gen_global_val("x", sizeof(T) * 8, &x);
+    value vq = code.gen_global_val("q", sizeof(T) * 8, &q);
+    value vr = code.gen_global_val("r", sizeof(T) * 8, &r);
+
+    code.gen_mov(vq, vx);
+    code.gen_mov(vr, vx);
+    gen_divmod(code, vq, vr, d);
+    code.gen_ret();
+    code.finish();
+
+    for (T val : dividends) {
+        if (std::is_signed<T>::value && d == (T)-1 &&
+            val == std::numeric_limits<T>::min()) {
+            continue; // overflows in C++, quotient is val, remainder 0
+        }
+
+        x = val;
+        code();
+
+        ASSERT_EQ(q, (T)(val / d)) << +val << " / " << +d;
+        ASSERT_EQ(r, (T)(val % d)) << +val << " % " << +d;
+    }
+}
+
+template <typename T>
+static vector<T> all_values() {
+    vector<T> values;
+    T val = std::numeric_limits<T>::min();
+    do {
+        values.push_back(val);
+    } while (val++ != std::numeric_limits<T>::max());
+    return values;
+}
+
+template <typename T>
+static vector<T> sample_values(size_t n) {
+    std::mt19937_64 rng(n);
+    vector<T> values = {
+        0, 1, 2, 3, 7, 10, 100, std::numeric_limits<T>::max(),
+        std::numeric_limits<T>::min(), (T)(std::numeric_limits<T>::max() - 1),
+        (T)(std::numeric_limits<T>::min() + 1),
+    };
+
+    if (std::is_signed<T>::value) {
+        values.push_back((T)-1);
+        values.push_back((T)-2);
+        values.push_back((T)-3);
+        values.push_back((T)-100);
+    }
+
+    while (values.size() < n)
+        values.push_back((T)rng());
+
+    return values;
+}
+
+template <typename T>
+static vector<T> sample_divisors(size_t n) {
+    vector<T> divisors;
+    for (T d : sample_values<T>(n)) {
+        if (d != 0)
+            divisors.push_back(d);
+    }
+
+    for (T d = 1; d < 64; d++) {
+        divisors.push_back(d);
+        if (std::is_signed<T>::value)
+            divisors.push_back((T)-d);
+    }
+
+    return divisors;
+}
+
+TEST(divconst, u8) {
+    vector<u8> values = all_values<u8>();
+    for (u8 d : values)
+        if (d != 0)
+            check_divmod<u8>(d, values);
+}
+
+TEST(divconst, i8) {
+    vector<i8> values = all_values<i8>();
+    for (i8 d : values)
+        if (d != 0)
+            check_divmod<i8>(d, values);
+}
+
+TEST(divconst, u16) {
+    vector<u16> values = all_values<u16>();
+    for (u16 d : sample_divisors<u16>(200))
+        check_divmod<u16>(d, values);
+}
+
+TEST(divconst, i16) {
+    vector<i16> values = all_values<i16>();
+    for (i16 d : sample_divisors<i16>(200))
+        check_divmod<i16>(d, values);
+}
+
+TEST(divconst, u32) {
+    vector<u32> values = sample_values<u32>(10000);
+    for (u32 d : sample_divisors<u32>(200))
+        check_divmod<u32>(d, values);
+}
+
+TEST(divconst, i32) {
+    vector<i32> values = sample_values<i32>(10000);
+    for (i32 d : sample_divisors<i32>(200))
+        check_divmod<i32>(d, values);
+}
+
+TEST(divconst, u64) {
+    vector<u64> values = sample_values<u64>(10000);
+    for (u64 d : sample_divisors<u64>(200))
+        check_divmod<u64>(d, values);
+}
+
+TEST(divconst, i64) {
+    vector<i64> values = sample_values<i64>(10000);
+    for (i64 d : sample_divisors<i64>(200))
+        check_divmod<i64>(d, values);
+}
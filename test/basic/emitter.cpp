@@ -172,3 +172,59 @@ TEST(emitter, xchg) {
 
     EXPECT_EQ(fn(), 5);
 }
+
+TEST(emitter, sib) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    i32 table[8] = { 10, 11, 12, 13, 14, 15, 16, 17 };
+
+    // every base/index combination that needs special handling: rsp and r12
+    // as base need a sib anyway, rbp and r13 need a displacement
+    const reg bases[] = { RAX, RBX, R12, R13, RBP };
+    const reg index[] = { RCX, R9, R15 };
+
+    for (reg b : bases) {
+        for (reg i : index) {
+            entry_func* fn = (entry_func*)code.get_code_ptr();
+            emitter.push(RBP);
+            emitter.push(R12);
+            emitter.push(R13);
+            emitter.push(R15);
+            emitter.push(RBX);
+            emitter.movi(64, b, (i64)table - 4);
+            emitter.movi(64, i, 3);
+            emitter.movr(32, RSI, memop(b, i, 4, 4));
+            emitter.addr(32, RSI, memop(b, i, 8, 8));
+            emitter.movr(64, RAX, RSI);
+            emitter.pop(RBX);
+            emitter.pop(R15);
+            emitter.pop(R13);
+            emitter.pop(R12);
+            emitter.pop(RBP);
+            emitter.ret();
+
+            EXPECT_EQ(fn(), table[3] + table[7]) << b << " " << i;
+        }
+    }
+}
+
+TEST(emitter, sib_encoding) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movr(64, RAX, memop(RBX, RCX, 8, 0)), 4);
+    EXPECT_EQ(p[0], 0x48); // rex.w
+    EXPECT_EQ(p[1], 0x8b); // mov r64, r/m64
+    EXPECT_EQ(p[2], 0x04); // modrm: [sib]
+    EXPECT_EQ(p[3], 0xcb); // sib: rbx + rcx * 8
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movr(32, memop(R13, R10, 2, 0), RDX), 5);
+    EXPECT_EQ(p[0], 0x43); // rex.xb
+    EXPECT_EQ(p[1], 0x89); // mov r/m32, r32
+    EXPECT_EQ(p[2], 0x54); // modrm: [sib + disp8]
+    EXPECT_EQ(p[3], 0x55); // sib: r13 + r10 * 2
+    EXPECT_EQ(p[4], 0x00); // disp8
+}
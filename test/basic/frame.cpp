@@ -0,0 +1,86 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(frame, many_locals) {
+    func code("many_locals", 64 * KiB);
+
+    vector<value> locals;
+    locals.reserve(200);
+    for (int i = 0; i < 200; i++)
+        locals.push_back(code.gen_local_i64("local", i));
+
+    value sum = code.gen_local_i64("sum", 0);
+    for (auto& local : locals)
+        code.gen_add(sum, local);
+
+    code.gen_ret(sum);
+    code.finish();
+
+    EXPECT_GE(code.frame_size(), 201 * sizeof(u64));
+    EXPECT_EQ(code.frame_size() % 16, 0);
+    EXPECT_EQ(code(), 199 * 200 / 2);
+}
+
+TEST(frame, reuse) {
+    func code("reuse");
+
+    i32 offset;
+    {
+        value a = code.gen_local_i64("a", 1);
+        offset = a.offset();
+    }
+
+    value b = code.gen_local_i64("b", 2);
+    EXPECT_EQ(b.offset(), offset) << "stack slot not reused";
+
+    code.gen_ret(b);
+    code.finish();
+
+    EXPECT_EQ(code.frame_size(), 16);
+    EXPECT_EQ(code(), 2);
+}
+
+TEST(frame, size_classes) {
+    func code("size_classes");
+    value v8 = code.gen_local_i8("v8", 1);
+    value v16 = code.gen_local_i16("v16", 2);
+    value v32 = code.gen_local_i32("v32", 3);
+    value v64 = code.gen_local_i64("v64", 4);
+    scalar f32v = code.gen_local_f32("f32", 1.0f);
+    scalar f64v = code.gen_local_f64("f64", 2.0);
+
+    EXPECT_EQ(v8.offset() % 1, 0);
+    EXPECT_EQ(v16.offset() % 2, 0);
+    EXPECT_EQ(v32.offset() % 4, 0);
+    EXPECT_EQ(v64.offset() % 8, 0);
+    EXPECT_EQ(f32v.offset() % 4, 0);
+    EXPECT_EQ(f64v.offset() % 8, 0);
+
+    code.gen_ret(v64);
+    code.finish();
+
+    // header(8) + 1 + 2(+1) + 4 + 8 + 4(+4) + 8 = 40 -> 48
+    EXPECT_LE(code.frame_size(), 48);
+    EXPECT_EQ(code(), 4);
+}
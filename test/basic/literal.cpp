@@ -0,0 +1,103 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(literal, dedup) {
+    cbuf buffer(4 * KiB);
+    size_t cap = buffer.size_remaining();
+
+    const u8* a = buffer.get_literal(0x1122334455667788ull);
+    const u8* b = buffer.get_literal(0x8877665544332211ull);
+    const u8* c = buffer.get_literal(0x1122334455667788ull);
+
+    EXPECT_EQ(a, c);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(buffer.num_literals(), 2);
+    EXPECT_EQ(buffer.size_remaining(), cap - 16);
+    EXPECT_EQ(*(const u64*)a, 0x1122334455667788ull);
+    EXPECT_EQ(*(const u64*)b, 0x8877665544332211ull);
+    EXPECT_TRUE(buffer.is_rip_addressable((u64)a));
+}
+
+TEST(literal, integer) {
+    i64 out = 0;
+
+    func code("integer");
+    value x = code.gen_local_val("x", 64, 0x123456789abcdef0);
+    value y = code.gen_local_val("y", 64, 0x123456789abcdef0);
+    value r = code.gen_global_val("r", 64, &out);
+    code.gen_mov(r, 0x0fedcba987654321);
+    code.gen_sub(x, y);
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(code(), 0);
+    EXPECT_EQ(out, 0x0fedcba987654321);
+    EXPECT_EQ(code.get_emitter().get_buffer().num_literals(), 2);
+}
+
+TEST(literal, scalar) {
+    f64 out64 = 0.0;
+    f32 out32 = 0.0f;
+
+    func code("scalar");
+    scalar a = code.gen_local_f64("a", 1.25);
+    scalar b = code.gen_local_f64("b", 1.25);
+    scalar c = code.gen_local_f64("c", 0.0);
+    scalar d = code.gen_local_f32("d", 2.5f);
+    scalar e = code.gen_scratch_f32("e", 0.5f);
+    scalar r64 = code.gen_global_f64("r64", &out64);
+    scalar r32 = code.gen_global_f32("r32", &out32);
+
+    code.gen_add(a, b);
+    code.gen_add(a, c);
+    code.gen_mov(r64, a);
+    code.gen_add(d, e);
+    code.gen_mov(r32, d);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(out64, 2.5);
+    EXPECT_EQ(out32, 3.0f);
+
+    // 1.25, 2.5f and 0.5f; zero is materialized with pxor
+    EXPECT_EQ(code.get_emitter().get_buffer().num_literals(), 3);
+}
+
+static f64 g_arg = 0.0;
+
+static void take_f64(void* data, f64 val) {
+    (void)data;
+    g_arg = val;
+}
+
+TEST(literal, call) {
+    func code("call");
+    code.gen_call(take_f64, 6.75);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(g_arg, 6.75);
+}
@@ -0,0 +1,288 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(memop, load) {
+    u32 table[16];
+    for (u32 i = 0; i < 16; i++)
+        table[i] = i * i;
+
+    u64 i = 0;
+
+    func code("load");
+    value base = code.gen_local_val("base", 64, (i64)table);
+    value idx = code.gen_global_val("idx", 64, &i);
+    value res = code.gen_local_val("res", 32, 0);
+
+    code.gen_load(res, base, idx, 4, 8); // table[idx + 2]
+    code.gen_ret(res);
+    code.finish();
+
+    for (i = 0; i < 14; i++)
+        EXPECT_EQ(code(), table[i + 2]);
+}
+
+TEST(memop, store) {
+    u64 table[8] = { 0 };
+
+    func code("store");
+    value base = code.gen_local_val("base", 64, (i64)table);
+    value idx = code.gen_local_val("idx", 64, 5);
+    value val = code.gen_local_val("val", 64, 0x1122334455667788);
+
+    code.gen_store(val, base, idx, 8);
+    code.gen_add(idx, 1);
+    code.gen_store(idx, base, idx, 8, -16);
+    code.gen_store(idx, base);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(table[0], 6);
+    EXPECT_EQ(table[4], 6);
+    EXPECT_EQ(table[5], 0x1122334455667788);
+    for (int i : { 1, 2, 3, 6, 7 })
+        EXPECT_EQ(table[i], 0) << i;
+}
+
+TEST(memop, global) {
+    u16 table[4] = { 0xaaaa, 0xbbbb, 0xcccc, 0xdddd };
+    u64 base = (u64)table;
+    u64 idx = 3;
+    u16 res = 0;
+
+    func code("global");
+    value vbase = code.gen_global_val("base", 64, &base);
+    value vidx = code.gen_global_val("idx", 64, &idx);
+    value vres = code.gen_global_val("res", 16, &res);
+
+    code.gen_load(vres, vbase, vidx, 2);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(res, 0xdddd);
+}
+
+TEST(memop, pressure) {
+    u64 table[4] = { 1, 2, 3, 4 };
+
+    func code("pressure");
+    vector<value> vals;
+    for (int i = 0; i < 13; i++)
+        vals.push_back(code.gen_scratch_i64("s", i));
+    value base = code.gen_local_val("base", 64, (i64)table);
+    value idx = code.gen_local_val("idx", 64, 2);
+    value res = code.gen_local_val("res", 64, 0);
+
+    code.gen_load(res, base, idx, 8);
+    for (value& v : vals)
+        code.gen_add(res, v);
+    code.gen_ret(res);
+    code.finish();
+
+    EXPECT_EQ(code(), 3 + 78);
+}
+
+TEST(memop, encoding) {
+    cbuf code(1 * KiB);
+    emitter emitter(code);
+
+    u8* p = code.get_code_ptr();
+    EXPECT_EQ(emitter.movnti(64, memop(RDI, 0), RAX), 4);
+    EXPECT_EQ(p[0], 0x48); // rex.w
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0xc3); // movnti
+    EXPECT_EQ(p[3], 0x07); // modrm: [rdi], rax
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.prefetchnta(memop(R8, 8)), 5);
+    EXPECT_EQ(p[0], 0x41); // rex.b
+    EXPECT_EQ(p[1], 0x0f);
+    EXPECT_EQ(p[2], 0x18); // prefetch
+    EXPECT_EQ(p[3], 0x40); // modrm: /0 [r8 + disp8]
+    EXPECT_EQ(p[4], 0x08);
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.prefetcht0(memop(RSI, 0)), 3);
+    EXPECT_EQ(p[1], 0x18);
+    EXPECT_EQ(p[2], 0x0e); // modrm: /1 [rsi]
+
+    p = code.get_code_ptr();
+    EXPECT_EQ(emitter.prefetchw(memop(RAX, 0)), 3);
+    EXPECT_EQ(p[1], 0x0d); // prefetchw
+    EXPECT_EQ(p[2], 0x08); // modrm: /1 [rax]
+
+    if (!cpuinfo::get().avx) {
+        p = code.get_code_ptr();
+        EXPECT_EQ(emitter.movntdq(memop(RDI, 0), XMM1), 4);
+        EXPECT_EQ(p[0], 0x66);
+        EXPECT_EQ(p[1], 0x0f);
+        EXPECT_EQ(p[2], 0xe7); // movntdq
+        EXPECT_EQ(p[3], 0x0f); // modrm: [rdi], xmm1
+    }
+}
+
+TEST(memop, store_nt) {
+    alignas(16) u64 table[8] = { 0 };
+    alignas(16) u64 data[2] = { 0x1111, 0x2222 };
+
+    func code("store_nt");
+    value base = code.gen_local_val("base", 64, (i64)table);
+    value idx = code.gen_local_val("idx", 64, 3);
+    value val = code.gen_local_val("val", 64, 0x1122334455667788);
+    value half = code.gen_local_val("half", 32, 0x55aa);
+    value byte = code.gen_local_val("byte", 8, 0x7f);
+    value src = code.gen_local_val("src", 64, (i64)data);
+    vec v = code.gen_scratch_vec("v");
+
+    code.gen_prefetch(base, 0, PREFETCH_WRITE);
+    code.gen_prefetch(src, 0, PREFETCH_NTA);
+    code.gen_store_nt(val, base, idx, 8);
+    code.gen_store_nt(half, base, 8);
+    code.gen_store_nt(byte, base, 16);
+    code.gen_load(v, src);
+    code.gen_store_nt(v, base, 32);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(table[0], 0);
+    EXPECT_EQ(table[1], 0x55aa);
+    EXPECT_EQ(table[2], 0x7f);
+    EXPECT_EQ(table[3], 0x1122334455667788);
+    EXPECT_EQ(table[4], 0x1111);
+    EXPECT_EQ(table[5], 0x2222);
+}
+
+TEST(memop, sfence) {
+    u64 buf = 0;
+    u64 flag = 0;
+
+    func code("sfence");
+    value base = code.gen_local_val("base", 64, (i64)&buf);
+    value val = code.gen_local_val("val", 64, 42);
+    value vflag = code.gen_global_i64("flag", &flag);
+
+    code.gen_store_nt(val, base);
+    code.get_alloc().flush_all_regs();
+
+    // acquire does not order earlier stores, every release needs the sfence
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_barrier(BARRIER_ACQUIRE);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr(), p);
+    code.gen_barrier(BARRIER_RELEASE);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr() - p, 3);
+    EXPECT_EQ(p[0], 0x0f);
+    EXPECT_EQ(p[1], 0xae);
+    EXPECT_EQ(p[2], 0xf8); // sfence
+    code.gen_barrier(BARRIER_RELEASE);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr() - p, 6);
+
+    code.gen_mov(vflag, 1);
+    code.gen_store_nt(val, base);
+    code.gen_ret();
+    code.finish();
+    code.exec();
+
+    EXPECT_EQ(buf, 42);
+    EXPECT_EQ(flag, 1);
+}
+
+static size_t count_sfences(const u8* from, const u8* to) {
+    size_t n = 0;
+    for (const u8* p = from; p + 2 < to; p++)
+        if (p[0] == 0x0f && p[1] == 0xae && p[2] == 0xf8)
+            n++;
+    return n;
+}
+
+TEST(memop, sfence_paths) {
+    u64 buf = 0;
+
+    func code("sfence_paths");
+    value base = code.gen_local_val("base", 64, (i64)&buf);
+    value val = code.gen_local_val("val", 64, 42);
+    label other = code.gen_label("other");
+
+    code.gen_store_nt(val, base);
+    code.gen_cmp(val, 42);
+    code.gen_jz(other);
+    code.gen_ret(val);
+
+    // reached by the jump only, which never passed the first return; both
+    // returns share the fence that finish places in front of the epilogue
+    other.place();
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_ret(val);
+    EXPECT_EQ(count_sfences(code.entry(), code.get_cbuffer().get_code_ptr()),
+              0);
+
+    code.finish();
+    EXPECT_EQ(count_sfences(p, code.final()), 1);
+    EXPECT_EQ(count_sfences(code.entry(), code.final()), 1);
+    EXPECT_EQ(code.exec(), 42);
+    EXPECT_EQ(buf, 42);
+}
+
+static u64 g_calls = 0;
+
+static u64 count_call(void* data) {
+    (void)data;
+    return g_calls++;
+}
+
+TEST(memop, sfence_loop) {
+    // the early exit and the call come before the store in code order, but
+    // run after the stores of earlier iterations
+    for (bool call : { false, true }) {
+        alignas(16) u64 buf[4] = { 0 };
+        g_calls = 0;
+
+        func code("sfence_loop");
+        value base = code.gen_local_val("base", 64, (i64)buf);
+        value i = code.gen_local_i64("i", 0);
+        label loop = code.gen_label("loop");
+        label body = code.gen_label("body");
+
+        loop.place();
+        code.gen_cmp(i, 4);
+        code.gen_jnz(body);
+        code.gen_ret(i);
+
+        body.place();
+        if (call)
+            code.gen_call(count_call);
+        code.gen_store_nt(i, base, i, 8);
+        code.gen_add(i, 1);
+        code.gen_jmp(loop);
+        code.finish();
+
+        // the shared return fence, and with a call one on the back edge
+        size_t fences = call ? 2 : 1;
+        EXPECT_EQ(count_sfences(code.entry(), code.final()), fences);
+        EXPECT_EQ(code.exec(), 4);
+        EXPECT_EQ(buf[3], 3);
+        EXPECT_EQ(g_calls, call ? 4 : 0);
+    }
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+// sizes around the unrolling threshold and the vector width
+static const size_t sizes[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 100, 127, 128,
+    129, 200, 1000,
+};
+
+static void fill(u8* buf, size_t n, u8 seed) {
+    for (size_t i = 0; i < n; i++)
+        buf[i] = seed + i * 7;
+}
+
+class memops: public ::testing::TestWithParam<bool>
+{
+public:
+    virtual void SetUp() override {
+        cpuinfo info = cpuinfo::host();
+        info.erms = info.erms && GetParam();
+        cpuinfo::set(info);
+    }
+
+    virtual void TearDown() override {
+        cpuinfo::set(cpuinfo::host());
+    }
+};
+
+TEST_P(memops, memcpy) {
+    for (size_t n : sizes) {
+        for (bool constant : { true, false }) {
+            u8 src[1024], dst[1024];
+            fill(src, sizeof(src), 1);
+            fill(dst, sizeof(dst), 99);
+
+            func code("memcpy");
+            value vd = code.gen_local_val("dest", 64, (i64)(dst + 8));
+            value vs = code.gen_local_val("src", 64, (i64)src);
+            value vn = code.gen_local_val("n", 64, n);
+            if (constant)
+                code.gen_memcpy(vd, vs, n);
+            else
+                code.gen_memcpy(vd, vs, vn);
+            code.gen_ret(vn);
+            code.finish();
+
+            EXPECT_EQ(code(), n);
+            EXPECT_EQ(memcmp(dst + 8, src, n), 0) << "size " << n;
+
+            u8 ref[1024];
+            fill(ref, sizeof(ref), 99);
+            EXPECT_EQ(memcmp(dst, ref, 8), 0) << "size " << n;
+            EXPECT_EQ(memcmp(dst + 8 + n, ref + 8 + n, 1016 - n), 0)
+                << "size " << n;
+        }
+    }
+}
+
+TEST_P(memops, memmove) {
+    for (size_t n : sizes) {
+        for (int shift : { -5, 3, 16, -40 }) {
+            for (bool constant : { true, false }) {
+                u8 buf[1200], ref[1200];
+                fill(buf, sizeof(buf), 3);
+                memcpy(ref, buf, sizeof(ref));
+                memmove(ref + 80 + shift, ref + 80, n);
+
+                func code("memmove");
+                value vd = code.gen_local_val("dest", 64, (i64)(buf + 80 + shift));
+                value vs = code.gen_local_val("src", 64, (i64)(buf + 80));
+                value vn = code.gen_local_val("n", 64, n);
+                if (constant)
+                    code.gen_memmove(vd, vs, n);
+                else
+                    code.gen_memmove(vd, vs, vn);
+                code.gen_ret();
+                code.finish();
+                code.exec();
+
+                EXPECT_EQ(memcmp(buf, ref, sizeof(buf)), 0)
+                    << "size " << n << " shift " << shift;
+            }
+        }
+    }
+}
+
+TEST_P(memops, memset) {
+    for (size_t n : sizes) {
+        for (int kind = 0; kind < 3; kind++) {
+            u8 buf[1024], ref[1024];
+            fill(buf, sizeof(buf), 5);
+            memcpy(ref, buf, sizeof(ref));
+            memset(ref + 4, 0xa5, n);
+
+            func code("memset");
+            value vd = code.gen_local_val("dest", 64, (i64)(buf + 4));
+            value vv = code.gen_local_i8("val", (i8)0xa5);
+            value vn = code.gen_local_val("n", 32, n);
+            switch (kind) {
+            case 0: code.gen_memset(vd, 0xa5, n); break;
+            case 1: code.gen_memset(vd, vv, n); break;
+            case 2: code.gen_memset(vd, vv, vn); break;
+            }
+            code.gen_ret();
+            code.finish();
+            code.exec();
+
+            EXPECT_EQ(memcmp(buf, ref, sizeof(buf)), 0)
+                << "size " << n << " kind " << kind;
+        }
+    }
+}
+
+TEST_P(memops, registers) {
+    u8 src[300], dst[300];
+    fill(src, sizeof(src), 7);
+
+    // values living in the registers needed by the string instructions
+    // must survive the operation
+    func code("registers");
+    value a = code.gen_local_i64("a", 1, RDI);
+    value b = code.gen_local_i64("b", 2, RSI);
+    value c = code.gen_local_i64("c", 4, RCX);
+    value d = code.gen_local_i64("d", 8, RAX);
+    value vd = code.gen_local_val("dest", 64, (i64)dst);
+    value vs = code.gen_local_val("src", 64, (i64)src);
+    code.gen_memcpy(vd, vs, sizeof(src));
+    code.gen_memset(vd, 0, 10);
+    code.gen_memset(vd, 0xff, 200);
+    code.gen_add(a, b);
+    code.gen_add(a, c);
+    code.gen_add(a, d);
+    code.gen_ret(a);
+    code.finish();
+
+    EXPECT_EQ(code(), 15);
+    EXPECT_EQ(dst[0], 0xff);
+    EXPECT_EQ(dst[199], 0xff);
+    EXPECT_EQ(memcmp(dst + 200, src + 200, 100), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(erms, memops, ::testing::Values(true, false));
@@ -0,0 +1,127 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+#include <limits>
+#include <random>
+
+using namespace ftl;
+
+template <typename T>
+static void check_mul(T c, const vector<T>& values) {
+    T x = 0;
+
+    func code("mul");
+    value vx = code.gen_global_val("x", sizeof(T) * 8, &x);
+    value probe = code.gen_scratch_i64("probe", 0x1234, RDX);
+    value other = code.gen_scratch_i64("other", 0x5678, RAX);
+
+    if (std::is_signed<T>::value)
+        code.gen_imul(vx, (i64)c);
+    else
+        code.gen_umul(vx, (u64)c);
+
+    EXPECT_FALSE(probe.is_dead()) << "RDX clobbered for constant " << +c;
+    EXPECT_FALSE(other.is_dead()) << "RAX clobbered for constant " << +c;
+    EXPECT_EQ(probe.r(), RDX);
+    EXPECT_EQ(other.r(), RAX);
+
+    code.gen_sub(probe, other);
+    code.gen_ret(probe);
+    code.finish();
+
+    for (T val : values) {
+        x = val;
+        i64 ret = code();
+        ASSERT_EQ(x, (T)((u64)val * (u64)c)) << +val << " * " << +c;
+        ASSERT_EQ(ret, 0x1234 - 0x5678) << "scratch registers clobbered";
+    }
+}
+
+template <typename T>
+static vector<T> test_values() {
+    std::mt19937_64 rng(42);
+    vector<T> values = {
+        0, 1, 2, 3, 100, std::numeric_limits<T>::max(),
+        std::numeric_limits<T>::min(), (T)-1, (T)-7,
+    };
+
+    while (values.size() < 64)
+        values.push_back((T)rng());
+
+    return values;
+}
+
+template <typename T>
+static vector<T> test_constants() {
+    vector<T> constants;
+    for (int i = 2; i < 100; i++) {
+        constants.push_back((T)i);
+        constants.push_back((T)-i);
+    }
+
+    for (int i = 2; i < (int)sizeof(T) * 8; i++) {
+        constants.push_back((T)(1ull << i) - 1);
+        constants.push_back((T)(1ull << i) + 1);
+        constants.push_back((T)(3ull << (i - 1)));
+        constants.push_back((T)(9ull << (i - 2)));
+    }
+
+    constants.push_back(std::numeric_limits<T>::max());
+    constants.push_back(std::numeric_limits<T>::min());
+    constants.push_back((T)0x12345678deadbeefull);
+    return constants;
+}
+
+#define MKTEST(type)                                                          \
+    TEST(mulconst, type) {                                                    \
+        vector<type> values = test_values<type>();                            \
+        for (type c : test_constants<type>())                                 \
+            check_mul<type>(c, values);                                       \
+    }
+
+MKTEST(u8)
+MKTEST(i8)
+MKTEST(u16)
+MKTEST(i16)
+MKTEST(u32)
+MKTEST(i32)
+MKTEST(u64)
+MKTEST(i64)
+
+TEST(mulconst, lea) {
+    u64 x = 7;
+
+    func code("lea");
+    value vx = code.gen_global_i64("x", &x);
+    vx.fetch();
+
+    u8* ptr = code.get_cbuffer().get_code_ptr();
+    code.gen_imul(vx, 9); // lea r, [r + r * 8]
+    size_t nbytes = code.get_cbuffer().get_code_ptr() - ptr;
+    EXPECT_LE(nbytes, 5);
+
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(x, 63);
+}
@@ -0,0 +1,198 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+typedef i64 (entry_func)(void);
+
+TEST(peephole, disabled) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+
+    EXPECT_FALSE(e.is_peephole());
+    EXPECT_EQ(e.movi(64, RAX, 0), 7);
+    EXPECT_EQ(e.addi(64, RAX, 1), 4);
+    EXPECT_EQ(e.get_peephole_stats().total(), 0);
+}
+
+TEST(peephole, zero) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    entry_func* fn = (entry_func*)code.get_code_ptr();
+    e.movi(64, RAX, -1);
+    e.movi(64, RAX, 0);
+    e.movi(64, RCX, 0);
+    e.addi(64, RAX, 5);
+    e.addr(64, RAX, RCX);
+    e.ret();
+
+    // both moves become two byte xors once the add overwrites the flags
+    EXPECT_EQ(code.get_code_ptr() - (u8*)fn, 7 + 2 + 2 + 4 + 3 + 1);
+    EXPECT_EQ(e.get_peephole_stats().zero, 2);
+    EXPECT_EQ(fn(), 5);
+}
+
+TEST(peephole, zero_flags_live) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    entry_func* fn = (entry_func*)code.get_code_ptr();
+    e.movi(64, RCX, 1);
+    e.cmpi(64, RCX, 1);
+    e.movi(64, RAX, 0);
+    e.setz(RAX);
+    e.ret();
+
+    EXPECT_EQ(e.get_peephole_stats().zero, 0);
+    EXPECT_EQ(fn(), 1);
+}
+
+TEST(peephole, zero_barrier) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    e.movi(64, RAX, 0);
+    e.barrier();
+    e.addi(64, RAX, 3);
+    e.ret();
+
+    EXPECT_EQ(e.get_peephole_stats().zero, 0);
+}
+
+TEST(peephole, cmp0) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    entry_func* fn = (entry_func*)code.get_code_ptr();
+    e.movi(64, RCX, 0);
+    e.movi(64, RAX, 7);
+    e.movi(64, RDX, 9);
+    EXPECT_EQ(e.cmpi(64, RCX, 0), 3);
+    e.cmovz(64, RAX, RDX);
+    e.ret();
+
+    EXPECT_EQ(e.get_peephole_stats().cmp0, 1);
+    EXPECT_EQ(fn(), 9);
+}
+
+TEST(peephole, reload) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    u64 slot = 0;
+
+    entry_func* fn = (entry_func*)code.get_code_ptr();
+    e.movi(64, R8, (i64)&slot);
+    e.movi(64, RCX, 42);
+    e.movr(64, memop(R8, 0), RCX);
+    EXPECT_EQ(e.movr(64, RCX, memop(R8, 0)), 0);
+    EXPECT_EQ(e.movr(64, RAX, memop(R8, 0)), 3);
+    e.ret();
+
+    EXPECT_EQ(e.get_peephole_stats().reload, 2);
+    EXPECT_EQ(fn(), 42);
+    EXPECT_EQ(slot, 42);
+}
+
+TEST(peephole, reload_label) {
+    func code("reload_label");
+    code.get_emitter().set_peephole();
+
+    u64 slot = 0;
+    value v = code.gen_global_val("slot", 64, &slot);
+    label l = code.gen_label("target");
+
+    code.gen_mov(v, 11);
+    code.gen_jmp(l);
+    l.place();
+    code.gen_add(v, 1);
+    code.gen_ret(v);
+    code.finish();
+
+    EXPECT_EQ(code(), 12);
+    EXPECT_EQ(slot, 12);
+}
+
+TEST(peephole, setcc) {
+    func code("setcc");
+    emitter& e = code.get_emitter();
+    e.set_peephole();
+
+    value a = code.gen_local_val("a", 64, 3);
+    value b = code.gen_local_val("b", 64, 4);
+    value r = code.gen_local_val("r", 64, -1);
+    a.fetch();
+    b.fetch();
+    r.fetch();
+
+    code.gen_mov(r, 0);
+    code.gen_cmp(a, b);
+    code.gen_setl(r);
+    code.gen_ret(r);
+    code.finish();
+
+    EXPECT_EQ(e.get_peephole_stats().movzx, 1);
+    EXPECT_EQ(code(), 1);
+}
+
+TEST(peephole, setcc_dirty) {
+    func code("setcc_dirty");
+    emitter& e = code.get_emitter();
+    e.set_peephole();
+
+    value a = code.gen_local_val("a", 64, 3);
+    value b = code.gen_local_val("b", 64, 4);
+    value r = code.gen_local_val("r", 64, -1);
+    a.fetch();
+    b.fetch();
+    r.fetch();
+
+    code.gen_cmp(a, b);
+    code.gen_setl(r);
+    code.gen_ret(r);
+    code.finish();
+
+    EXPECT_EQ(e.get_peephole_stats().movzx, 0);
+    EXPECT_EQ(code(), 1);
+}
+
+TEST(peephole, zero_narrow) {
+    cbuf code(1 * KiB);
+    emitter e(code);
+    e.set_peephole();
+
+    u8* start = code.get_code_ptr();
+    e.movi(8, RAX, 0);
+    e.addi(64, RCX, 1);
+    e.movi(16, RDX, 0);
+    e.addi(64, RCX, 1);
+
+    // narrow moves are left alone, only full width ones become xors
+    EXPECT_EQ(e.get_peephole_stats().zero, 0);
+    EXPECT_EQ(code.get_code_ptr() - start, 5 + 4 + 5 + 4);
+}
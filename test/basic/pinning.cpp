@@ -0,0 +1,171 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2020 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(pinning, loop) {
+    u64 pc = 0x1000;
+    u64 count = 10;
+
+    func code("loop");
+    value vpc = code.gen_global_i64("pc", &pc);
+    value vcnt = code.gen_global_i64("count", &count);
+
+    reg r = code.gen_pin(vpc);
+    EXPECT_TRUE(code.get_alloc().is_blocked(r));
+    EXPECT_TRUE(code.get_alloc().is_pinned(r));
+
+    label loop = code.gen_label("loop");
+    loop.place();
+
+    code.gen_add(vpc, 4);
+    code.gen_dec(vcnt);
+
+    u8* ptr = code.get_cbuffer().get_code_ptr();
+    code.gen_jnz(loop); // opcode 0x75 + 8bit offset, vcnt lives in memory
+
+    size_t nbytes = code.get_cbuffer().get_code_ptr() - ptr;
+    EXPECT_EQ(nbytes, 2) << "pinned value flushed at branch";
+    EXPECT_EQ(vpc.r(), r) << "pinned value lost its register";
+
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(pc, 0x1000 + 10 * 4);
+    EXPECT_EQ(count, 0);
+}
+
+static u64 g_seen = 0;
+
+static u64 helper(void* data, u64 arg) {
+    u64* pc = (u64*)data;
+    g_seen = *pc;
+    *pc += arg;
+    return 0;
+}
+
+TEST(pinning, call) {
+    u64 pc = 100;
+
+    func code("call", 4 * KiB);
+    code.set_data_ptr(&pc);
+
+    value vpc = code.gen_global_i64("pc", &pc);
+    code.gen_pin(vpc, RBX);
+
+    code.gen_add(vpc, 1);
+    code.gen_call(&helper, vpc);
+    code.gen_add(vpc, 1);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(g_seen, 101) << "pinned value not written back before call";
+    EXPECT_EQ(pc, 101 + 101 + 1) << "pinned value not reloaded after call";
+}
+
+TEST(pinning, unpin) {
+    u64 pc = 7;
+
+    func code("unpin");
+    value vpc = code.gen_global_i64("pc", &pc);
+
+    reg r = code.gen_pin(vpc);
+    code.gen_add(vpc, 1);
+    code.gen_unpin(vpc);
+
+    EXPECT_FALSE(code.get_alloc().is_blocked(r));
+    EXPECT_FALSE(code.get_alloc().is_pinned(r));
+    EXPECT_TRUE(code.get_alloc().is_dirty(r));
+
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(pc, 8);
+}
+
+TEST(pinning, move) {
+    u64 pc = 3;
+
+    func code("move");
+    value vpc = code.gen_global_i64("pc", &pc);
+    reg r = code.gen_pin(vpc);
+
+    value moved(std::move(vpc));
+    EXPECT_TRUE(vpc.is_dead());
+    EXPECT_EQ(moved.r(), r) << "pinned register lost on move";
+    EXPECT_TRUE(code.get_alloc().is_pinned(r));
+    EXPECT_TRUE(code.get_alloc().is_pinned(&moved));
+    EXPECT_FALSE(code.get_alloc().is_pinned(&vpc));
+
+    code.gen_add(moved, 2);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(pc, 5);
+}
+
+TEST(pinning, kill) {
+    u64 pc = 11;
+
+    func code("kill");
+    value vpc = code.gen_global_i64("pc", &pc);
+    reg r = code.gen_pin(vpc);
+    code.gen_add(vpc, 1);
+
+    code.kill_value(vpc);
+    EXPECT_FALSE(code.get_alloc().is_pinned(r));
+    EXPECT_FALSE(code.get_alloc().is_blocked(r));
+    EXPECT_FALSE(vpc.is_reg());
+
+    code.gen_mov(vpc, 42);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(pc, 42);
+}
+
+TEST(pinning, cached) {
+    u64 pc = 20;
+
+    func code("cached");
+    value vpc = code.gen_global_i64("pc", &pc);
+    code.gen_add(vpc, 1);
+    vpc.fetch(RAX);
+
+    reg r = code.gen_pin(vpc);
+    EXPECT_NE(r, RAX);
+    EXPECT_EQ(vpc.r(), r);
+    EXPECT_TRUE(code.get_alloc().is_pinned(r));
+    EXPECT_FALSE(code.get_alloc().is_pinned(RAX));
+
+    code.gen_add(vpc, 1);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(pc, 22);
+}
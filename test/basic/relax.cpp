@@ -0,0 +1,176 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+// push rax; pop rax: two bytes that change neither registers nor flags
+static void fill(func& code, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        code.get_emitter().push(RAX);
+        code.get_emitter().pop(RAX);
+    }
+}
+
+static i64 twice(void* bptr, i64 val) {
+    (void)bptr;
+    return 2 * val;
+}
+
+TEST(relax, short) {
+    func code("short");
+    value x = code.gen_local_i64("x", 0);
+
+    label fwd = code.gen_label("fwd");
+    label back = code.gen_label("back");
+    back.place();
+
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_jz(fwd);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr() - p, 2);
+
+    code.gen_add(x, 1);
+    code.gen_cmp(x, 3);
+    p = code.get_cbuffer().get_code_ptr();
+    code.gen_jnz(back);
+    EXPECT_EQ(code.get_cbuffer().get_code_ptr() - p, 2);
+
+    fwd.place();
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(code(), 3);
+}
+
+TEST(relax, grow) {
+    u64 a = 1;
+
+    func code("grow");
+    value va = code.gen_global_i64("a", &a);
+    value x = code.gen_local_i64("x", 0);
+
+    label skip = code.gen_label("skip");
+    code.gen_cmp(va, 0);
+    code.get_alloc().flush_all_regs();
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_jz(skip);
+    code.gen_mov(x, 0x123456789abcdef);
+    code.gen_add(x, va);
+    fill(code, 70);
+    skip.place();
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(p[0], 0x0f);
+    EXPECT_EQ(p[1], 0x84); // jz rel32
+
+    EXPECT_EQ(code(), 0x123456789abcdef + 1);
+    a = 0;
+    EXPECT_EQ(code(), 0);
+}
+
+TEST(relax, moves) {
+    u64 a = 7;
+
+    func code("moves");
+    value va = code.gen_global_i64("a", &a);
+    value x = code.gen_local_i64("x", 0);
+
+    label skip = code.gen_label("skip");
+    label inner = code.gen_label("inner");
+    label done = code.gen_label("done");
+
+    code.gen_cmp(va, 0);
+    code.get_alloc().flush_all_regs();
+    u8* p = code.get_cbuffer().get_code_ptr();
+    code.gen_jz(skip);
+
+    // the call, the global and the literal all use displacements relative
+    // to the instruction pointer, which need fixing when the code moves
+    inner.place();
+    value r = code.gen_call(twice, va);
+    code.gen_mov(x, r);
+    code.free_value(r);
+    value k = code.gen_scratch_i64("k");
+    code.gen_mov(k, 0x1000000000000);
+    code.gen_add(x, k);
+    code.free_value(k);
+    code.gen_jmp(done);
+    fill(code, 60);
+
+    skip.place();
+    code.gen_mov(va, 5);
+    code.gen_jmp(inner);
+
+    done.place();
+    code.gen_ret(x);
+    code.finish();
+
+    EXPECT_EQ(p[0], 0x0f);
+    EXPECT_EQ(p[1], 0x84); // jz rel32
+
+    EXPECT_EQ(code(), 14 + 0x1000000000000);
+    a = 0;
+    EXPECT_EQ(code(), 10 + 0x1000000000000);
+    EXPECT_EQ(a, 5);
+}
+
+TEST(relax, cascade) {
+    u64 a = 0, n = 0;
+
+    func code("cascade");
+    value va = code.gen_global_i64("a", &a);
+    value vn = code.gen_global_i64("n", &n);
+
+    label top = code.gen_label("top");
+    label skip = code.gen_label("skip");
+
+    top.place();
+    code.gen_add(vn, 1);
+    code.gen_cmp(va, 0);
+    code.get_alloc().flush_all_regs();
+    u8* pjz = code.get_cbuffer().get_code_ptr();
+    code.gen_jz(skip);
+    code.gen_cmp(vn, 3);
+    code.get_alloc().flush_all_regs();
+
+    // the backward branch just reaches top, until the jz above grows
+    ptrdiff_t dist = code.get_cbuffer().get_code_ptr() - top.get_address();
+    fill(code, (123 - dist + 1) / 2);
+    u8* pjl = code.get_cbuffer().get_code_ptr();
+    code.gen_jl(top);
+    ASSERT_EQ(pjl[0], 0x7c) << "expected short jl";
+
+    fill(code, 45);
+    skip.place();
+    code.gen_ret(vn);
+    code.finish();
+
+    EXPECT_EQ(pjz[0], 0x0f);
+    EXPECT_EQ(pjz[1], 0x84); // jz rel32
+    EXPECT_EQ(pjl[4], 0x0f);
+    EXPECT_EQ(pjl[5], 0x8c); // jl rel32, moved by the grown jz
+
+    EXPECT_EQ(code(), 1);
+    a = 1;
+    n = 0;
+    EXPECT_EQ(code(), 3);
+}
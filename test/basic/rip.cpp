@@ -0,0 +1,86 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+TEST(rip, globals) {
+    // place the data inside the code buffer to make it reachable
+    cbuf buffer(64 * KiB);
+    u64* data = (u64*)(buffer.get_code_entry() + 32 * KiB);
+    data[0] = 5;
+    data[1] = 0;
+    data[2] = ~0ull;
+    data[3] = ~0ull;
+    data[4] = ~0ull;
+    ASSERT_TRUE(buffer.is_rip_addressable((u64)data));
+
+    func code("globals", buffer);
+    value a = code.gen_global_val("a", 64, data + 0);
+    value b = code.gen_global_val("b", 64, data + 1);
+    value c = code.gen_global_val("c", 32, data + 2);
+    value d = code.gen_global_val("d", 64, data + 3);
+    value e = code.gen_global_val("e", 16, data + 4);
+
+    EXPECT_TRUE(a.is_global());
+    EXPECT_TRUE(a.mem().is_rip);
+
+    code.gen_add(b, a);        // b = 5
+    code.gen_add(b, 37);       // b = 42
+    code.gen_cmp(a, 5);
+    code.gen_mov(c, 7);        // imm store after rip displacement
+    code.gen_mov(d, 9);
+    code.gen_mov(e, 0x1234);
+    code.gen_ret(b);
+    code.finish();
+
+    EXPECT_EQ(code(), 42);
+    EXPECT_EQ(data[1], 42);
+    EXPECT_EQ(data[2], 0xffffffff00000007ull);
+    EXPECT_EQ(data[3], 9);
+    EXPECT_EQ(data[4], 0xffffffffffff1234ull);
+}
+
+TEST(rip, scalar) {
+    cbuf buffer(64 * KiB);
+    f64* data = (f64*)(buffer.get_code_entry() + 32 * KiB);
+    data[0] = 1.5;
+    data[1] = 2.25;
+
+    func code("scalar", buffer);
+    scalar x = code.gen_global_f64("x", data + 0);
+    scalar y = code.gen_global_f64("y", data + 1);
+
+    EXPECT_TRUE(x.mem().is_rip);
+
+    code.gen_add(x, y);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    EXPECT_EQ(data[0], 3.75);
+}
+
+TEST(rip, far) {
+    cbuf buffer(64 * KiB);
+    EXPECT_FALSE(buffer.is_rip_addressable(0x1000));
+    EXPECT_FALSE(buffer.is_rip_addressable(~0ull));
+}
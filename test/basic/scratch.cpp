@@ -70,3 +70,78 @@ TEST(scratch, jumps) {
     nbytes = code.get_cbuffer().get_code_ptr() - ptr;
     EXPECT_EQ(nbytes, 0) << "flush instructions might have been emitted";
 }
+
+TEST(scratch, spill) {
+    func code("spill");
+
+    vector<value> temps;
+    temps.reserve(32);
+    for (int i = 0; i < 32; i++)
+        temps.push_back(code.gen_scratch_i64("temp", i));
+
+    size_t nspilled = 0;
+    for (auto& temp : temps) {
+        EXPECT_FALSE(temp.is_dead()) << "scratch value lost on eviction";
+        nspilled += temp.is_spilled() ? 1 : 0;
+    }
+
+    EXPECT_GT(nspilled, 0) << "expected register pressure to spill values";
+
+    value sum = code.gen_scratch_i64("sum", 0);
+    for (auto& temp : temps)
+        code.gen_add(sum, temp);
+
+    code.gen_ret(sum);
+    code.finish();
+
+    for (auto& temp : temps)
+        EXPECT_TRUE(temp.is_dead()) << "scratch value alive after return";
+
+    i64 ret = code();
+    EXPECT_EQ(ret, 31 * 32 / 2);
+}
+
+TEST(scratch, spill_jump) {
+    func code("spill_jump");
+
+    value temp = code.gen_scratch_i64("temp", 42);
+    temp.flush();
+
+    EXPECT_TRUE(temp.is_spilled());
+    EXPECT_FALSE(temp.is_dead());
+
+    label dest = code.gen_label("dest");
+    code.gen_jmp(dest);
+    dest.place();
+
+    EXPECT_FALSE(temp.is_spilled()) << "spill slot not released on jump";
+    EXPECT_TRUE(temp.is_dead()) << "spilled scratch value survived jump";
+
+    code.gen_ret();
+    code.finish();
+    code();
+}
+
+i64 clobber(void* bptr, i64 val) {
+    (void)bptr;
+    return val;
+}
+
+TEST(scratch, call) {
+    func code("call");
+
+    vector<value> temps;
+    temps.reserve(12);
+    for (int i = 0; i < 12; i++)
+        temps.push_back(code.gen_scratch_i64("temp", i + 1));
+
+    value ret = code.gen_call(clobber, temps[0]);
+    for (auto& temp : temps)
+        code.gen_add(ret, temp);
+
+    code.gen_ret(ret);
+    code.finish();
+
+    i64 result = code();
+    EXPECT_EQ(result, 1 + 12 * 13 / 2);
+}
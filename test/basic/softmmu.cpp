@@ -0,0 +1,245 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+#define PAGE_BITS 12
+#define PAGE_SIZE (1ull << PAGE_BITS)
+#define GUEST_BASE 0x40000000ull
+
+struct tlb_entry {
+    u64 tag_read;
+    u64 tag_write;
+    u64 addend;
+    u64 unused;
+};
+
+// four guest pages backed by host memory, the last one is only reachable
+// through the miss handlers
+struct guest {
+    tlb_entry tlb[16];
+    alignas(4096) u8 mem[4 * PAGE_SIZE];
+
+    size_t misses;
+    u64 last_addr;
+    u64 last_size;
+};
+
+static guest* current = nullptr;
+
+static u64 load_miss(void* data, u64 addr, u64 size) {
+    // clobber caller-saved registers, including the xmm ones
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%f %lu", (double)addr / 3.0, size);
+
+    current->misses++;
+    current->last_addr = addr;
+    current->last_size = size;
+
+    u64 val = 0;
+    memcpy(&val, current->mem + addr - GUEST_BASE, size);
+    (void)data;
+    return val;
+}
+
+static void store_miss(void* data, u64 addr, u64 val, u64 size) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%f %lu", (double)addr / 3.0, size);
+
+    current->misses++;
+    current->last_addr = addr;
+    current->last_size = size;
+
+    memcpy(current->mem + addr - GUEST_BASE, &val, size);
+    (void)data;
+}
+
+static const tlb_layout layout(const guest& g) {
+    tlb_layout tlb;
+    tlb.base = (u64)g.tlb;
+    tlb.entries = FTL_ARRAY_SIZE(g.tlb);
+    tlb.entry_size = sizeof(tlb_entry);
+    tlb.page_bits = PAGE_BITS;
+    tlb.tag_read = offsetof(tlb_entry, tag_read);
+    tlb.tag_write = offsetof(tlb_entry, tag_write);
+    tlb.addend = offsetof(tlb_entry, addend);
+    return tlb;
+}
+
+// runs with the table addressed relative to the data pointer, or through
+// its absolute address
+class softmmu: public ::testing::TestWithParam<bool>
+{
+public:
+    guest g;
+
+    virtual void SetUp() override {
+        memset(&g, 0, sizeof(g));
+        for (size_t i = 0; i < sizeof(g.mem); i++)
+            g.mem[i] = i * 13 + 1;
+
+        for (tlb_entry& e : g.tlb)
+            e.tag_read = e.tag_write = ~0ull;
+
+        for (u64 page = 0; page < 3; page++) {
+            u64 addr = GUEST_BASE + page * PAGE_SIZE;
+            tlb_entry& e = g.tlb[(addr >> PAGE_BITS) % 16];
+            e.tag_read = e.tag_write = addr;
+            e.addend = (u64)g.mem - GUEST_BASE;
+        }
+
+        // the second page is read-only
+        g.tlb[((GUEST_BASE >> PAGE_BITS) + 1) % 16].tag_write = ~0ull;
+        current = &g;
+    }
+
+    virtual void TearDown() override {
+        current = nullptr;
+    }
+
+    void setup(func& code) {
+        if (GetParam())
+            code.set_data_ptr(&g);
+    }
+
+    u64 host(u64 addr, size_t size) {
+        u64 val = 0;
+        memcpy(&val, g.mem + addr - GUEST_BASE, size);
+        return val;
+    }
+};
+
+TEST_P(softmmu, load) {
+    const u64 offsets[] = {
+        0, 8, 100, PAGE_SIZE + 2, 2 * PAGE_SIZE - 8, // hits
+        PAGE_SIZE - 4, 3 * PAGE_SIZE + 16,           // crossing, unmapped
+    };
+
+    for (int bits : { 8, 16, 32, 64 }) {
+        for (u64 offset : offsets) {
+            size_t size = bits / 8;
+            u64 addr = GUEST_BASE + offset;
+            u64 res = 0;
+
+            func code("load");
+            setup(code);
+            value va = code.gen_local_i64("addr", addr);
+            value dest = code.gen_local_val("dest", bits);
+            value vres = code.gen_global_i64("res", &res);
+            code.gen_tlb_load(dest, va, layout(g), load_miss);
+            code.gen_zxt(vres, dest);
+            code.gen_ret();
+            code.finish();
+
+            g.misses = 0;
+            code.exec();
+
+            bool cross = offset % PAGE_SIZE + size > PAGE_SIZE;
+            bool miss = offset >= 3 * PAGE_SIZE || cross;
+            EXPECT_EQ(res, host(addr, size)) << bits << " " << offset;
+            EXPECT_EQ(g.misses, miss ? 1 : 0) << bits << " " << offset;
+            if (miss) {
+                EXPECT_EQ(g.last_addr, addr);
+                EXPECT_EQ(g.last_size, size);
+            }
+        }
+    }
+}
+
+TEST_P(softmmu, store) {
+    const struct {
+        u64 offset;
+        bool miss;
+    } accesses[] = {
+        { 24, false },
+        { 2 * PAGE_SIZE + 40, false },
+        { PAGE_SIZE + 8, true },      // read-only
+        { 2 * PAGE_SIZE - 2, true },  // crossing
+        { 3 * PAGE_SIZE, true },      // unmapped
+    };
+
+    for (int bits : { 8, 16, 32, 64 }) {
+        for (const auto& acc : accesses) {
+            size_t size = bits / 8;
+            u64 addr = GUEST_BASE + acc.offset;
+            u64 val = 0x8877665544332211ull;
+
+            func code("store");
+            setup(code);
+            value va = code.gen_local_i64("addr", addr);
+            i64 init = (i64)(val << (64 - bits)) >> (64 - bits);
+            value src = code.gen_local_val("src", bits, init);
+            code.gen_tlb_store(src, va, layout(g), store_miss);
+            code.gen_ret();
+            code.finish();
+
+            g.misses = 0;
+            code.exec();
+
+            u64 mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+            EXPECT_EQ(host(addr, size), val & mask) << bits;
+            EXPECT_EQ(g.misses, acc.miss ? 1 : 0) << bits << " " << acc.offset;
+        }
+    }
+}
+
+TEST_P(softmmu, preserve) {
+    u64 res = 0;
+    alignas(16) u64 in[2] = { 5, 6 };
+    alignas(16) u64 out[2] = { 0, 0 };
+
+    func code("preserve");
+    setup(code);
+    vector<value> vals;
+    for (reg r : { RCX, RDX, RSI, RDI, R8, R9, R10, R11 })
+        vals.push_back(code.gen_scratch_i64("v", 1ll << r, r));
+    vec v = code.gen_scratch_vec("v");
+    vec vin = code.gen_global_vec("in", in);
+    code.gen_mov(v, vin);
+
+    value va = code.gen_scratch_i64("addr", GUEST_BASE + 3 * PAGE_SIZE, RAX);
+    value dest = code.gen_scratch_i64("dest");
+    code.gen_tlb_load(dest, va, layout(g), load_miss);
+    code.gen_tlb_store(dest, va, layout(g), store_miss);
+
+    value sum = code.gen_global_i64("res", &res);
+    code.gen_mov(sum, va);
+    for (value& val : vals)
+        code.gen_add(sum, val);
+    vec vout = code.gen_global_vec("out", out);
+    code.gen_mov(vout, v);
+    code.gen_ret();
+    code.finish();
+
+    g.misses = 0;
+    code.exec();
+
+    u64 expect = GUEST_BASE + 3 * PAGE_SIZE;
+    for (reg r : { RCX, RDX, RSI, RDI, R8, R9, R10, R11 })
+        expect += 1ull << r;
+    EXPECT_EQ(g.misses, 2);
+    EXPECT_EQ(res, expect);
+    EXPECT_EQ(out[0], 5);
+    EXPECT_EQ(out[1], 6);
+}
+
+INSTANTIATE_TEST_SUITE_P(tlb, softmmu, ::testing::Values(true, false));
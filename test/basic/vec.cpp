@@ -0,0 +1,251 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright 2026 Jan Henrik Weinstock                                        *
+ *                                                                            *
+ * Licensed under the Apache License, Version 2.0 (the "License");            *
+ * you may not use this file except in compliance with the License.           *
+ * You may obtain a copy of the License at                                    *
+ *                                                                            *
+ *     http://www.apache.org/licenses/LICENSE-2.0                             *
+ *                                                                            *
+ * Unless required by applicable law or agreed to in writing, software        *
+ * distributed under the License is distributed on an "AS IS" BASIS,          *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.   *
+ * See the License for the specific language governing permissions and        *
+ * limitations under the License.                                             *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstring>
+
+#include "ftl.h"
+
+using namespace ftl;
+
+template <typename T>
+struct lanes {
+    T v[16 / sizeof(T)];
+};
+
+TEST(vec, global) {
+    lanes<u32> a = {{ 1, 2, 3, 4 }};
+    lanes<u32> b = {{ 10, 20, 30, 40 }};
+    lanes<u32> r = {{ 0, 0, 0, 0 }};
+
+    func code("global");
+    vec va = code.gen_global_vec("a", &a);
+    vec vb = code.gen_global_vec("b", &b);
+    vec vr = code.gen_global_vec("r", &r);
+
+    code.gen_mov(vr, va);
+    code.gen_padd(32, vr, vb);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(r.v[i], a.v[i] + b.v[i]) << i;
+}
+
+TEST(vec, loadstore) {
+    u16 data[24];
+    for (int i = 0; i < 24; i++)
+        data[i] = i * 3;
+
+    func code("loadstore");
+    value base = code.gen_local_val("base", 64, (i64)data);
+    value idx = code.gen_local_val("idx", 64, 2);
+    vec x = code.gen_local_vec("x");
+    vec y = code.gen_local_vec("y");
+
+    code.gen_load(x, base, idx, 8);        // data[8..15]
+    code.gen_load(y, base, 2);             // data[1..8], unaligned
+    code.gen_psub(16, x, y);
+    code.gen_psll(16, x, 2);
+    code.gen_store(x, base, idx, 8, 16);   // data[16..23]
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 8; i++)
+        EXPECT_EQ(data[16 + i], (u16)((((8 + i) * 3) - ((1 + i) * 3)) << 2));
+}
+
+TEST(vec, integer) {
+    lanes<i32> a = {{ -5, 7, 100, -100 }};
+    lanes<i32> b = {{ 3, 7, -4, 9 }};
+    lanes<i32> mul, eq, gt, mins, maxu, sra;
+
+    func code("integer");
+    vec va = code.gen_global_vec("a", &a);
+    vec vb = code.gen_global_vec("b", &b);
+    vec t = code.gen_scratch_vec("t");
+
+    vec vmul = code.gen_global_vec("mul", &mul);
+    vec veq = code.gen_global_vec("eq", &eq);
+    vec vgt = code.gen_global_vec("gt", &gt);
+    vec vmins = code.gen_global_vec("mins", &mins);
+    vec vmaxu = code.gen_global_vec("maxu", &maxu);
+    vec vsra = code.gen_global_vec("sra", &sra);
+
+    code.gen_mov(t, va); code.gen_pmul(32, t, vb);   code.gen_mov(vmul, t);
+    code.gen_mov(t, va); code.gen_pcmpeq(32, t, vb); code.gen_mov(veq, t);
+    code.gen_mov(t, va); code.gen_pcmpgt(32, t, vb); code.gen_mov(vgt, t);
+    code.gen_mov(t, va); code.gen_pmins(32, t, vb);  code.gen_mov(vmins, t);
+    code.gen_mov(t, va); code.gen_pmaxu(32, t, vb);  code.gen_mov(vmaxu, t);
+    code.gen_mov(t, va); code.gen_psra(32, t, 1);    code.gen_mov(vsra, t);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(mul.v[i], a.v[i] * b.v[i]) << i;
+        EXPECT_EQ(eq.v[i], a.v[i] == b.v[i] ? -1 : 0) << i;
+        EXPECT_EQ(gt.v[i], a.v[i] > b.v[i] ? -1 : 0) << i;
+        EXPECT_EQ(mins.v[i], std::min(a.v[i], b.v[i])) << i;
+        EXPECT_EQ((u32)maxu.v[i], std::max((u32)a.v[i], (u32)b.v[i])) << i;
+        EXPECT_EQ(sra.v[i], a.v[i] >> 1) << i;
+    }
+}
+
+TEST(vec, shuffle) {
+    lanes<u8> a, sel, mask;
+    lanes<u8> shufd, shufb, unpack, blend, blendv;
+    for (int i = 0; i < 16; i++) {
+        a.v[i] = i;
+        sel.v[i] = 15 - i;
+        mask.v[i] = (i & 1) ? 0x80 : 0x00;
+    }
+
+    func code("shuffle");
+    vec va = code.gen_global_vec("a", &a);
+    vec vsel = code.gen_global_vec("sel", &sel);
+    vec vmask = code.gen_global_vec("mask", &mask);
+    vec t = code.gen_scratch_vec("t");
+
+    vec vshufd = code.gen_global_vec("shufd", &shufd);
+    vec vshufb = code.gen_global_vec("shufb", &shufb);
+    vec vunpack = code.gen_global_vec("unpack", &unpack);
+    vec vblend = code.gen_global_vec("blend", &blend);
+    vec vblendv = code.gen_global_vec("blendv", &blendv);
+
+    code.gen_pshufd(t, va, 0x1b);   // reverse the dwords
+    code.gen_mov(vshufd, t);
+
+    code.gen_mov(t, va);
+    code.gen_pshufb(t, vsel);       // reverse the bytes
+    code.gen_mov(vshufb, t);
+
+    code.gen_mov(t, va);
+    code.gen_punpckl(8, t, vsel);
+    code.gen_mov(vunpack, t);
+
+    code.gen_mov(t, va);
+    code.gen_blend(16, t, vsel, 0xf0);
+    code.gen_mov(vblend, t);
+
+    code.gen_mov(t, va);
+    code.gen_blendv(8, t, vsel, vmask);
+    code.gen_mov(vblendv, t);
+
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 16; i++) {
+        EXPECT_EQ(shufd.v[i], a.v[(3 - i / 4) * 4 + i % 4]) << i;
+        EXPECT_EQ(shufb.v[i], a.v[15 - i]) << i;
+        EXPECT_EQ(unpack.v[i], (i & 1) ? sel.v[i / 2] : a.v[i / 2]) << i;
+        EXPECT_EQ(blend.v[i], i >= 8 ? sel.v[i] : a.v[i]) << i;
+        EXPECT_EQ(blendv.v[i], (i & 1) ? sel.v[i] : a.v[i]) << i;
+    }
+}
+
+TEST(vec, floating) {
+    lanes<f32> a = {{ 1.0f, -2.5f, 9.0f, 16.0f }};
+    lanes<f32> b = {{ 0.5f, -2.5f, 3.0f, 100.0f }};
+    lanes<f32> add, sqrt, lt, shuf;
+    lanes<f64> c = {{ 1.5, -4.0 }};
+    lanes<f64> d = {{ 2.0, 8.0 }};
+    lanes<f64> mul, mx;
+
+    func code("floating");
+    vec va = code.gen_global_vec("a", &a);
+    vec vb = code.gen_global_vec("b", &b);
+    vec vc = code.gen_global_vec("c", &c);
+    vec vd = code.gen_global_vec("d", &d);
+    vec t = code.gen_scratch_vec("t");
+
+    vec vadd = code.gen_global_vec("add", &add);
+    vec vsqrt = code.gen_global_vec("sqrt", &sqrt);
+    vec vlt = code.gen_global_vec("lt", &lt);
+    vec vshuf = code.gen_global_vec("shuf", &shuf);
+    vec vmul = code.gen_global_vec("mul", &mul);
+    vec vmx = code.gen_global_vec("mx", &mx);
+
+    code.gen_mov(t, va); code.gen_addp(32, t, vb);    code.gen_mov(vadd, t);
+    code.gen_sqrtp(32, t, va);                        code.gen_mov(vsqrt, t);
+    code.gen_mov(t, va); code.gen_cmpp(32, t, vb, 1); code.gen_mov(vlt, t);
+    code.gen_mov(t, va); code.gen_shufp(32, t, vb, 0x4e);
+    code.gen_mov(vshuf, t);
+    code.gen_mov(t, vc); code.gen_mulp(64, t, vd);    code.gen_mov(vmul, t);
+    code.gen_mov(t, vc); code.gen_maxp(64, t, vd);    code.gen_mov(vmx, t);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(add.v[i], a.v[i] + b.v[i]) << i;
+        if (a.v[i] >= 0) {
+            EXPECT_EQ(sqrt.v[i], std::sqrt(a.v[i])) << i;
+        }
+
+        u32 bits;
+        memcpy(&bits, &lt.v[i], sizeof(bits));
+        EXPECT_EQ(bits, a.v[i] < b.v[i] ? 0xffffffffu : 0u) << i;
+    }
+
+    EXPECT_EQ(shuf.v[0], a.v[2]);
+    EXPECT_EQ(shuf.v[1], a.v[3]);
+    EXPECT_EQ(shuf.v[2], b.v[0]);
+    EXPECT_EQ(shuf.v[3], b.v[1]);
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(mul.v[i], c.v[i] * d.v[i]) << i;
+        EXPECT_EQ(mx.v[i], std::max(c.v[i], d.v[i])) << i;
+    }
+}
+
+TEST(vec, pressure) {
+    const int N = 20;
+    lanes<u32> in = {{ 1, 2, 3, 4 }};
+    lanes<u32> out = {{ 0, 0, 0, 0 }};
+
+    func code("pressure");
+    vec vin = code.gen_global_vec("in", &in);
+    vec vout = code.gen_global_vec("out", &out);
+
+    vector<vec> vs;
+    for (int i = 0; i < N; i++) {
+        vs.push_back(code.gen_local_vec("v" + std::to_string(i)));
+        code.gen_mov(vs[i], vin);
+        code.gen_psll(32, vs[i], i % 8);
+    }
+
+    vec sum = code.gen_scratch_vec("sum");
+    code.gen_pxor(sum, sum);
+    for (int i = 0; i < N; i++)
+        code.gen_padd(32, sum, vs[i]);
+    code.gen_mov(vout, sum);
+    code.gen_ret();
+    code.finish();
+    code();
+
+    u32 scale = 0;
+    for (int i = 0; i < N; i++)
+        scale += 1u << (i % 8);
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(out.v[i], in.v[i] * scale) << i;
+}